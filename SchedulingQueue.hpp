@@ -0,0 +1,232 @@
+// Bounded task queue with priority lanes, per-client fair sharing and
+// earliest-deadline-first ordering
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <utility>
+#include <vector>
+
+// Where a pushed item is scheduled
+struct ScheduleTicket {
+    size_t lane = 0;      // Index into the lane weights; out of range means the last lane
+    uint64_t client = 0;  // Items from one client share that client's slice of its lane
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+};
+
+// Stride scheduling between weighted lanes: with every lane busy, a lane
+// of weight 16 gets 16 turns for each turn of a weight-1 lane, and no lane
+// starves. An idle lane banks no credit. Not thread-safe; the owner locks.
+class LaneStride {
+public:
+    explicit LaneStride(const std::vector<unsigned>& weights) {
+        for (unsigned weight : weights) {
+            lanes_.push_back(Lane{kStrideUnit / std::max(weight, 1u)});
+        }
+        if (lanes_.empty()) {
+            lanes_.push_back(Lane{kStrideUnit});
+        }
+    }
+
+    size_t lanes() const { return lanes_.size(); }
+    // Out of range means the last lane
+    size_t clamp(size_t lane) const { return std::min(lane, lanes_.size() - 1); }
+
+    // Call when `lane` gets work after having none, so it starts level
+    // with the lane served last instead of cashing in its idle time
+    void activate(size_t lane) { lanes_[lane].pass = std::max(lanes_[lane].pass, pass_); }
+
+    // The lane whose turn is next among those `busy(lane)` says have work,
+    // at least one of which must; charges it one turn
+    template<typename Busy>
+    size_t next(Busy busy) {
+        size_t best = lanes_.size();
+        for (size_t i = 0; i < lanes_.size(); ++i) {
+            if (busy(i) && (best == lanes_.size() || lanes_[i].pass < lanes_[best].pass)) {
+                best = i;
+            }
+        }
+        pass_ = lanes_[best].pass;
+        lanes_[best].pass += lanes_[best].stride;
+        return best;
+    }
+
+private:
+    static constexpr uint64_t kStrideUnit = 1 << 20;
+
+    struct Lane {
+        uint64_t stride;
+        uint64_t pass = 0;  // Next turn of this lane among lanes
+    };
+
+    std::vector<Lane> lanes_;
+    uint64_t pass_ = 0;  // Pass of the lane served last
+};
+
+// Same blocking semantics as ThreadSafeQueue, but pop() picks the next
+// item instead of taking the oldest:
+//
+//  - Between lanes, stride scheduling by weight (see LaneStride).
+//  - Within a lane, each client gets an equal share (start-time fair
+//    queueing by item count), so one client's bulk upload cannot push a
+//    newcomer's single item to the back of the lane.
+//  - Within a client's share, earliest deadline first, then FIFO.
+//
+// Choosing needs a consistent view of every lane and client, so this is a
+// mutex and two condition variables; the critical section is a few heap
+// and tree operations. Every push and pop serializes on that mutex. A
+// push/pop pair costs well under a microsecond (see the queue group of
+// ocr_microbench) against milliseconds to seconds of OCR per item, so the
+// mutex is not what limits even a 64-worker server. Per-worker deques with
+// stealing, or a lock-free ring, would give up the ordering above.
+template<typename T>
+class SchedulingQueue {
+public:
+    SchedulingQueue(size_t capacity, const std::vector<unsigned>& lane_weights)
+        : capacity_(capacity > 0 ? capacity : 1), stride_(lane_weights), lanes_(stride_.lanes()) {}
+
+    SchedulingQueue(const SchedulingQueue&) = delete;
+    SchedulingQueue& operator=(const SchedulingQueue&) = delete;
+
+    // push item; waits while full. Returns false (dropping the item) once
+    // set_finished() has been called.
+    bool push(T item, const ScheduleTicket& ticket) {
+        std::unique_lock<std::mutex> lk(m_);
+        not_full_.wait(lk, [this] { return size_ < capacity_ || finished_; });
+        if (finished_) {
+            return false;
+        }
+        enqueue(item, ticket);
+        not_empty_.notify_one();
+        return true;
+    }
+
+    // push without waiting; moves from item only on success. Returns false
+    // if the queue is full or finished.
+    bool try_push(T& item, const ScheduleTicket& ticket) {
+        std::lock_guard<std::mutex> lk(m_);
+        if (finished_ || size_ >= capacity_) {
+            return false;
+        }
+        enqueue(item, ticket);
+        not_empty_.notify_one();
+        return true;
+    }
+
+    // pop the next item by lane, client and deadline; returns false if
+    // finished and queue empty
+    bool pop(T& out) {
+        std::unique_lock<std::mutex> lk(m_);
+        not_empty_.wait(lk, [this] { return size_ > 0 || finished_; });
+        if (size_ == 0) {
+            return false;
+        }
+        dequeue(out);
+        not_full_.notify_one();
+        return true;
+    }
+
+    void set_finished() {
+        std::lock_guard<std::mutex> lk(m_);
+        finished_ = true;
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+    bool empty() const { return size() == 0; }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lk(m_);
+        return size_;
+    }
+
+    size_t lane_size(size_t lane) const {
+        std::lock_guard<std::mutex> lk(m_);
+        return lane < lanes_.size() ? lanes_[lane].size : 0;
+    }
+
+    size_t lanes() const { return lanes_.size(); }
+    size_t capacity() const { return capacity_; }
+
+private:
+    struct Entry {
+        std::chrono::steady_clock::time_point deadline;
+        uint64_t seq;
+        T item;
+    };
+
+    // Heap order for std::push_heap: the earliest deadline, then the
+    // oldest item, ends up on top
+    struct Later {
+        bool operator()(const Entry& a, const Entry& b) const {
+            return a.deadline != b.deadline ? a.deadline > b.deadline : a.seq > b.seq;
+        }
+    };
+
+    // One client's queued items in a lane
+    struct Flow {
+        std::vector<Entry> heap;
+        uint64_t pass = 0;  // Items this client has been served, offset to the lane's clock
+    };
+
+    struct Lane {
+        uint64_t clock = 0;  // Pass of the flow served last; where new flows start
+        size_t size = 0;
+        std::map<uint64_t, Flow> flows;                 // Clients with queued items
+        std::set<std::pair<uint64_t, uint64_t>> order;  // (pass, client) of each flow
+    };
+
+    void enqueue(T& item, const ScheduleTicket& ticket) {
+        size_t index = stride_.clamp(ticket.lane);
+        Lane& lane = lanes_[index];
+        if (lane.size == 0) {
+            stride_.activate(index);
+        }
+        auto [it, added] = lane.flows.try_emplace(ticket.client);
+        Flow& flow = it->second;
+        if (added) {
+            flow.pass = lane.clock;
+            lane.order.emplace(flow.pass, ticket.client);
+        }
+        flow.heap.push_back(Entry{ticket.deadline, seq_++, std::move(item)});
+        std::push_heap(flow.heap.begin(), flow.heap.end(), Later());
+        ++lane.size;
+        ++size_;
+    }
+
+    void dequeue(T& out) {
+        Lane* lane = &lanes_[stride_.next([this](size_t i) { return lanes_[i].size > 0; })];
+
+        uint64_t client = lane->order.begin()->second;
+        lane->order.erase(lane->order.begin());
+        auto it = lane->flows.find(client);
+        Flow& flow = it->second;
+        std::pop_heap(flow.heap.begin(), flow.heap.end(), Later());
+        out = std::move(flow.heap.back().item);
+        flow.heap.pop_back();
+
+        lane->clock = flow.pass;
+        if (flow.heap.empty()) {
+            lane->flows.erase(it);
+        } else {
+            lane->order.emplace(++flow.pass, client);
+        }
+        --lane->size;
+        --size_;
+    }
+
+    const size_t capacity_;
+    LaneStride stride_;
+    std::vector<Lane> lanes_;
+    uint64_t seq_ = 0;
+    size_t size_ = 0;
+    bool finished_ = false;
+    mutable std::mutex m_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+};
@@ -10,15 +10,29 @@ class ThreadSafeQueue {
 public:
     explicit ThreadSafeQueue(size_t max_size = 0) : max_size_(max_size), finished_(false) {}
 
-    // push item; if bounded and full, wait
-    void push(T item) {
+    // push item; if bounded and full, wait. Returns false (dropping the
+    // item) once set_finished() has been called.
+    bool push(T item) {
         std::unique_lock<std::mutex> lk(m_);
         if (max_size_ > 0) {
             cv_full_.wait(lk, [&]() { return queue_.size() < max_size_ || finished_; });
         }
+        if (finished_) return false;
         queue_.push(std::move(item));
         lk.unlock();
         cv_.notify_one();
+        return true;
+    }
+
+    // push without waiting; moves from item only on success. Returns false
+    // if the queue is full or finished.
+    bool try_push(T &item) {
+        std::unique_lock<std::mutex> lk(m_);
+        if (finished_ || (max_size_ > 0 && queue_.size() >= max_size_)) return false;
+        queue_.push(std::move(item));
+        lk.unlock();
+        cv_.notify_one();
+        return true;
     }
 
     // pop item; returns false if finished and queue empty
@@ -33,6 +47,17 @@ public:
         return true;
     }
 
+    // pop without waiting; returns false if the queue is empty
+    bool try_pop(T &out) {
+        std::unique_lock<std::mutex> lk(m_);
+        if (queue_.empty()) return false;
+        out = std::move(queue_.front());
+        queue_.pop();
+        lk.unlock();
+        cv_full_.notify_one();
+        return true;
+    }
+
     void set_finished() {
         std::lock_guard<std::mutex> lk(m_);
         finished_ = true;
@@ -40,16 +65,24 @@ public:
         cv_full_.notify_all();
     }
 
-    bool empty() {
+    bool empty() const {
         std::lock_guard<std::mutex> lk(m_);
         return queue_.empty();
     }
 
+    size_t size() const {
+        std::lock_guard<std::mutex> lk(m_);
+        return queue_.size();
+    }
+
+    // 0 when unbounded
+    size_t capacity() const { return max_size_; }
+
 private:
     std::queue<T> queue_;
     size_t max_size_;
     bool finished_;
-    std::mutex m_;
+    mutable std::mutex m_;
     std::condition_variable cv_;
     std::condition_variable cv_full_;
 };
@@ -0,0 +1,753 @@
+// Headless load generator for ocr_server. Replays dataset/ (or a synthetic
+// image set) over unary, streaming or batch RPCs, closed-loop or at a fixed
+// arrival rate, and reports throughput, latency percentiles and errors as
+// text or JSON so runs can be compared between builds.
+//
+//   ocr_bench --server=localhost:50051 --mode=stream --concurrency=4 --duration=30
+//   ocr_bench --mode=unary --rate=50 --arrival=poisson --json=results.json
+//   ocr_bench --mode=batch --batch-size=32 --thumbnail=200
+//   ocr_bench --mode=stream --output=words,hocr
+//   ocr_bench --mode=unary --lang=eng+fil --psm=single_line
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <grpcpp/grpcpp.h>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "ocr.grpc.pb.h"
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct BenchOptions {
+    std::string server_address = "localhost:50051";
+    std::string mode = "stream";     // unary | stream | batch
+    std::string dataset = "dataset";
+    int synthetic = 0;               // Generate this many images instead of reading dataset
+    int concurrency = 4;             // Unary: calls in flight. Stream: open streams. Batch: batches in flight
+    int window = 16;                 // Images in flight per stream
+    int batch_size = 32;             // Images per ProcessBatch call
+    int thumbnail = 0;               // Scale images down to fit this many pixels; 0 = as loaded
+    double rate = 0;                 // Requests/s across all senders; 0 = closed loop
+    std::string arrival = "uniform"; // uniform | poisson (open loop only)
+    double duration_s = 30;
+    double warmup_s = 0;             // Requests sent before this are not measured
+    uint64_t max_requests = 0;       // 0 = until duration ends
+    int timeout_ms = 60000;
+    bool unique = false;             // Make every request's bytes distinct to defeat caches
+    ocr::Priority priority = ocr::PRIORITY_NORMAL;
+    uint32_t deadline_ms = 0;        // Per-image deadline sent with each request; 0 = none
+    ocr::OutputOptions output;       // Structured output asked for besides the text
+    ocr::OCRConfig config;           // Language, page segmentation mode etc.; empty = server defaults
+    std::string client_id;           // Sent as x-client-id; empty = server groups by host
+    uint32_t seed = 1;
+    std::string json_path;           // "-" prints JSON instead of text
+};
+
+struct Image {
+    std::string name;
+    std::string format;
+    std::string data;
+};
+
+std::string upper(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+    return text;
+}
+
+bool parseOptions(int argc, char** argv, BenchOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&arg](const char* flag) -> const char* {
+            size_t len = std::strlen(flag);
+            return arg.compare(0, len, flag) == 0 ? arg.c_str() + len : nullptr;
+        };
+        const char* v = nullptr;
+        if ((v = value("--server="))) {
+            options.server_address = v;
+        } else if ((v = value("--mode="))) {
+            options.mode = v;
+        } else if ((v = value("--dataset="))) {
+            options.dataset = v;
+        } else if ((v = value("--synthetic="))) {
+            options.synthetic = std::stoi(v);
+        } else if ((v = value("--concurrency="))) {
+            options.concurrency = std::stoi(v);
+        } else if ((v = value("--window="))) {
+            options.window = std::stoi(v);
+        } else if ((v = value("--batch-size="))) {
+            options.batch_size = std::stoi(v);
+        } else if ((v = value("--thumbnail="))) {
+            options.thumbnail = std::stoi(v);
+        } else if ((v = value("--rate="))) {
+            options.rate = std::stod(v);
+        } else if ((v = value("--arrival="))) {
+            options.arrival = v;
+        } else if ((v = value("--duration="))) {
+            options.duration_s = std::stod(v);
+        } else if ((v = value("--warmup="))) {
+            options.warmup_s = std::stod(v);
+        } else if ((v = value("--requests="))) {
+            options.max_requests = std::stoull(v);
+        } else if ((v = value("--timeout-ms="))) {
+            options.timeout_ms = std::stoi(v);
+        } else if ((v = value("--seed="))) {
+            options.seed = static_cast<uint32_t>(std::stoul(v));
+        } else if ((v = value("--json="))) {
+            options.json_path = v;
+        } else if (arg == "--json") {
+            options.json_path = "-";
+        } else if (arg == "--unique") {
+            options.unique = true;
+        } else if ((v = value("--priority="))) {
+            if (!ocr::Priority_Parse(std::string("PRIORITY_") + upper(v), &options.priority)) {
+                std::cerr << "--priority must be interactive, normal or bulk" << std::endl;
+                return false;
+            }
+        } else if ((v = value("--deadline-ms="))) {
+            options.deadline_ms = static_cast<uint32_t>(std::stoul(v));
+        } else if ((v = value("--client-id="))) {
+            options.client_id = v;
+        } else if ((v = value("--output="))) {
+            std::stringstream list(v);
+            std::string kind;
+            while (std::getline(list, kind, ',')) {
+                if (kind == "words") {
+                    options.output.set_words(true);
+                } else if (kind == "hocr") {
+                    options.output.set_hocr(true);
+                } else if (kind == "tsv") {
+                    options.output.set_tsv(true);
+                } else if (kind != "text") {
+                    std::cerr << "--output takes text, words, hocr and tsv" << std::endl;
+                    return false;
+                }
+            }
+        } else if ((v = value("--lang="))) {
+            options.config.set_language(v);
+        } else if ((v = value("--psm="))) {
+            ocr::PageSegMode mode;
+            if (!ocr::PageSegMode_Parse(std::string("PSM_") + upper(v), &mode)) {
+                std::cerr << "--psm must be auto, auto_osd, single_column, single_block, single_block_vertical,\n"
+                             "single_line, single_word, single_char, sparse_text or raw_line" << std::endl;
+                return false;
+            }
+            options.config.set_page_seg_mode(mode);
+        } else if ((v = value("--oem="))) {
+            ocr::EngineMode mode;
+            if (!ocr::EngineMode_Parse(std::string("OEM_") + upper(v), &mode)) {
+                std::cerr << "--oem must be lstm, legacy or legacy_lstm" << std::endl;
+                return false;
+            }
+            options.config.set_engine_mode(mode);
+        } else if ((v = value("--whitelist="))) {
+            options.config.set_whitelist(v);
+        } else if ((v = value("--dpi="))) {
+            options.config.set_dpi(static_cast<uint32_t>(std::stoul(v)));
+        } else {
+            std::cerr << "Unknown argument: " << arg << std::endl;
+            return false;
+        }
+    }
+    if (options.mode != "unary" && options.mode != "stream" && options.mode != "batch") {
+        std::cerr << "--mode must be unary, stream or batch" << std::endl;
+        return false;
+    }
+    if (options.arrival != "uniform" && options.arrival != "poisson") {
+        std::cerr << "--arrival must be uniform or poisson" << std::endl;
+        return false;
+    }
+    options.concurrency = std::max(1, options.concurrency);
+    options.window = std::max(1, options.window);
+    options.batch_size = std::max(1, options.batch_size);
+    return true;
+}
+
+// Every image in `dir` with an extension the server reads, sorted by name so runs replay the same order
+std::vector<Image> loadDataset(const std::string& dir) {
+    std::vector<Image> images;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(dir, error)) {
+        std::string ext = entry.path().extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(),
+                       [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        static const std::set<std::string> kImageExtensions = {
+            ".png", ".jpg", ".jpeg", ".bmp", ".tif", ".tiff", ".webp", ".pbm", ".pgm", ".ppm", ".pnm"};
+        if (!kImageExtensions.count(ext)) {
+            continue;
+        }
+        std::ifstream file(entry.path(), std::ios::binary);
+        std::ostringstream data;
+        data << file.rdbuf();
+        images.push_back({entry.path().filename().string(), ext.substr(1), data.str()});
+    }
+    std::sort(images.begin(), images.end(),
+              [](const Image& a, const Image& b) { return a.name < b.name; });
+    return images;
+}
+
+// Lines of random lowercase words on a white page, PNG encoded
+std::vector<Image> synthesizeImages(int count, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> letter('a', 'z');
+    std::uniform_int_distribution<int> word_length(2, 9);
+    std::vector<Image> images;
+    for (int i = 0; i < count; ++i) {
+        cv::Mat page(600, 800, CV_8UC1, cv::Scalar(255));
+        for (int line = 0; line < 12; ++line) {
+            std::string text;
+            while (text.size() < 40) {
+                int length = word_length(rng);
+                for (int c = 0; c < length; ++c) {
+                    text += static_cast<char>(letter(rng));
+                }
+                text += ' ';
+            }
+            cv::putText(page, text, cv::Point(20, 45 + line * 46), cv::FONT_HERSHEY_SIMPLEX, 0.9,
+                        cv::Scalar(0), 2);
+        }
+        std::vector<unsigned char> png;
+        cv::imencode(".png", page, png);
+        images.push_back({"synthetic" + std::to_string(i) + ".png", "png",
+                          std::string(png.begin(), png.end())});
+    }
+    return images;
+}
+
+// Re-encodes every image as a PNG no larger than `size` pixels on its
+// longer side, for measuring per-request overhead on small images
+void makeThumbnails(std::vector<Image>& images, int size) {
+    for (Image& image : images) {
+        std::vector<unsigned char> bytes(image.data.begin(), image.data.end());
+        cv::Mat decoded = cv::imdecode(bytes, cv::IMREAD_GRAYSCALE);
+        if (decoded.empty()) {
+            continue;
+        }
+        double scale = static_cast<double>(size) / std::max(decoded.cols, decoded.rows);
+        if (scale < 1.0) {
+            cv::resize(decoded, decoded, cv::Size(), scale, scale, cv::INTER_AREA);
+        }
+        std::vector<unsigned char> png;
+        cv::imencode(".png", decoded, png);
+        image.format = "png";
+        image.data.assign(png.begin(), png.end());
+    }
+}
+
+// Hands out the intended send time of every request. Closed loop sends as
+// soon as a sender is free; open loop follows a fixed schedule, and
+// latency is measured from the scheduled time so a slow server cannot hide
+// its queueing delay by slowing the generator down.
+class ArrivalSchedule {
+public:
+    ArrivalSchedule(const BenchOptions& options, Clock::time_point start)
+        : rate_(options.rate), poisson_(options.arrival == "poisson"), rng_(options.seed),
+          max_requests_(options.max_requests), start_(start),
+          end_(start + std::chrono::duration_cast<Clock::duration>(
+                           std::chrono::duration<double>(options.duration_s))) {}
+
+    // Returns false once the run is over. `seq` numbers requests globally.
+    bool next(Clock::time_point* when, uint64_t* seq) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (max_requests_ > 0 && issued_ >= max_requests_) {
+            return false;
+        }
+        if (rate_ > 0) {
+            if (poisson_) {
+                offset_s_ += std::exponential_distribution<double>(rate_)(rng_);
+            } else {
+                offset_s_ = issued_ / rate_;
+            }
+            *when = start_ + std::chrono::duration_cast<Clock::duration>(
+                                 std::chrono::duration<double>(offset_s_));
+        } else {
+            *when = Clock::now();
+        }
+        if (*when >= end_) {
+            return false;
+        }
+        *seq = issued_++;
+        return true;
+    }
+
+private:
+    std::mutex mutex_;
+    double rate_;
+    bool poisson_;
+    std::mt19937 rng_;
+    uint64_t max_requests_;
+    Clock::time_point start_;
+    Clock::time_point end_;
+    uint64_t issued_ = 0;
+    double offset_s_ = 0;
+};
+
+// Outcomes of every measured request
+class Recorder {
+public:
+    explicit Recorder(Clock::time_point measure_from) : measure_from_(measure_from) {}
+
+    void success(Clock::time_point intended, size_t bytes) {
+        Clock::time_point now = Clock::now();
+        if (intended < measure_from_) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        latencies_ms_.push_back(std::chrono::duration<double, std::milli>(now - intended).count());
+        bytes_ += bytes;
+        last_ = std::max(last_, now);
+    }
+
+    void failure(Clock::time_point intended, const std::string& kind) {
+        if (intended < measure_from_) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++errors_[kind];
+        last_ = std::max(last_, Clock::now());
+    }
+
+    struct Summary {
+        uint64_t completed = 0;
+        uint64_t errors = 0;
+        std::map<std::string, uint64_t> errors_by_kind;
+        double elapsed_s = 0;
+        double throughput = 0;    // Successful requests per second
+        double mb_per_s = 0;
+        double mean_ms = 0, p50_ms = 0, p95_ms = 0, p99_ms = 0, max_ms = 0;
+    };
+
+    Summary summarize() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Summary summary;
+        summary.completed = latencies_ms_.size();
+        summary.errors_by_kind = errors_;
+        for (const auto& [kind, count] : errors_) {
+            summary.errors += count;
+        }
+        summary.elapsed_s = std::max(0.0, std::chrono::duration<double>(last_ - measure_from_).count());
+        if (summary.elapsed_s > 0) {
+            summary.throughput = summary.completed / summary.elapsed_s;
+            summary.mb_per_s = bytes_ / summary.elapsed_s / (1024.0 * 1024.0);
+        }
+        if (!latencies_ms_.empty()) {
+            std::sort(latencies_ms_.begin(), latencies_ms_.end());
+            auto at = [this](double q) {
+                size_t index = static_cast<size_t>(q * (latencies_ms_.size() - 1) + 0.5);
+                return latencies_ms_[index];
+            };
+            double sum = 0;
+            for (double ms : latencies_ms_) {
+                sum += ms;
+            }
+            summary.mean_ms = sum / latencies_ms_.size();
+            summary.p50_ms = at(0.50);
+            summary.p95_ms = at(0.95);
+            summary.p99_ms = at(0.99);
+            summary.max_ms = latencies_ms_.back();
+        }
+        return summary;
+    }
+
+private:
+    std::mutex mutex_;
+    Clock::time_point measure_from_;
+    Clock::time_point last_ = measure_from_;
+    std::vector<double> latencies_ms_;
+    std::map<std::string, uint64_t> errors_;
+    uint64_t bytes_ = 0;
+};
+
+// Fills `request` for global request number `seq`. With --unique a counter
+// is appended after the image; PNG and JPEG decoders ignore trailing bytes,
+// but every request then hashes differently.
+void fillRequest(const BenchOptions& options, const std::vector<Image>& images, uint64_t seq,
+                 ocr::ImageRequest& request) {
+    const Image& image = images[seq % images.size()];
+    request.set_image_id(std::to_string(seq));
+    request.set_image_format(image.format);
+    request.set_image_data(image.data);
+    request.set_priority(options.priority);
+    request.set_deadline_ms(options.deadline_ms);
+    *request.mutable_output() = options.output;
+    *request.mutable_config() = options.config;
+    if (options.unique) {
+        request.mutable_image_data()->append(reinterpret_cast<const char*>(&seq), sizeof(seq));
+    }
+}
+
+// Appends the bytes of request `seq` to a batch, with the same --unique
+// suffix as fillRequest
+void appendToBatch(const BenchOptions& options, const std::vector<Image>& images, uint64_t seq,
+                   ocr::BatchRequest& batch) {
+    const Image& image = images[seq % images.size()];
+    std::string* packed = batch.mutable_packed();
+    size_t before = packed->size();
+    packed->append(image.data);
+    if (options.unique) {
+        packed->append(reinterpret_cast<const char*>(&seq), sizeof(seq));
+    }
+    batch.add_sizes(static_cast<uint32_t>(packed->size() - before));
+}
+
+void setClientId(const BenchOptions& options, grpc::ClientContext& context) {
+    if (!options.client_id.empty()) {
+        context.AddMetadata("x-client-id", options.client_id);
+    }
+}
+
+// Failure kind of an answered request: dropped by the server for missing
+// its deadline, turned away, or OCR itself failed
+std::string responseKind(const ocr::ImageResponse& response) {
+    switch (response.error_code()) {
+    case ocr::ERROR_TIMEOUT: return "deadline_dropped";
+    case ocr::ERROR_OVERLOADED: return "overloaded";
+    case ocr::ERROR_UNAVAILABLE: return "unavailable";
+    case ocr::ERROR_CANCELLED: return "cancelled";
+    default: return "ocr_failed";
+    }
+}
+
+std::string statusKind(const grpc::Status& status) {
+    switch (status.error_code()) {
+    case grpc::StatusCode::RESOURCE_EXHAUSTED: return "resource_exhausted";
+    case grpc::StatusCode::DEADLINE_EXCEEDED: return "deadline_exceeded";
+    case grpc::StatusCode::UNAVAILABLE: return "unavailable";
+    case grpc::StatusCode::CANCELLED: return "cancelled";
+    default: return "rpc_error";
+    }
+}
+
+// `concurrency` threads, each making one blocking ProcessImage call at a time
+void runUnary(const BenchOptions& options, const std::vector<Image>& images,
+              ocr::OCRService::Stub* stub, ArrivalSchedule& schedule, Recorder& recorder) {
+    std::vector<std::thread> senders;
+    for (int t = 0; t < options.concurrency; ++t) {
+        senders.emplace_back([&] {
+            ocr::ImageRequest request;
+            Clock::time_point when;
+            uint64_t seq = 0;
+            while (schedule.next(&when, &seq)) {
+                std::this_thread::sleep_until(when);
+                fillRequest(options, images, seq, request);
+
+                grpc::ClientContext context;
+                context.set_deadline(std::chrono::system_clock::now() +
+                                     std::chrono::milliseconds(options.timeout_ms));
+                setClientId(options, context);
+                ocr::ImageResponse response;
+                grpc::Status status = stub->ProcessImage(&context, request, &response);
+                if (!status.ok()) {
+                    recorder.failure(when, statusKind(status));
+                } else if (!response.success()) {
+                    recorder.failure(when, responseKind(response));
+                } else {
+                    recorder.success(when, request.image_data().size());
+                }
+            }
+        });
+    }
+    for (auto& sender : senders) {
+        sender.join();
+    }
+}
+
+// One ProcessImageStream call with at most `window` images in flight
+void runOneStream(const BenchOptions& options, const std::vector<Image>& images,
+                  ocr::OCRService::Stub* stub, ArrivalSchedule& schedule, Recorder& recorder) {
+    grpc::ClientContext context;
+    setClientId(options, context);
+    auto stream = stub->ProcessImageStream(&context);
+
+    std::mutex mutex;
+    std::condition_variable window_cv;
+    std::unordered_map<std::string, std::pair<Clock::time_point, size_t>> sent;
+    bool reader_done = false;
+
+    std::thread reader([&] {
+        ocr::ImageResponse response;
+        while (stream->Read(&response)) {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = sent.find(response.image_id());
+            if (it == sent.end() || response.partial()) {
+                continue;
+            }
+            if (response.success()) {
+                recorder.success(it->second.first, it->second.second);
+            } else {
+                recorder.failure(it->second.first, responseKind(response));
+            }
+            sent.erase(it);
+            window_cv.notify_one();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        reader_done = true;
+        window_cv.notify_one();
+    });
+
+    ocr::ImageRequest request;
+    Clock::time_point when;
+    uint64_t seq = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            window_cv.wait(lock, [&] {
+                return sent.size() < static_cast<size_t>(options.window) || reader_done;
+            });
+            if (reader_done) {
+                break;  // Server ended the call
+            }
+        }
+        if (!schedule.next(&when, &seq)) {
+            break;
+        }
+        std::this_thread::sleep_until(when);
+        fillRequest(options, images, seq, request);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            sent[request.image_id()] = {when, request.image_data().size()};
+        }
+        if (!stream->Write(request)) {
+            break;
+        }
+    }
+
+    stream->WritesDone();
+    reader.join();
+    grpc::Status status = stream->Finish();
+
+    // Whatever is left never got an answer
+    for (const auto& [id, entry] : sent) {
+        recorder.failure(entry.first, status.ok() ? "missing_response" : statusKind(status));
+    }
+}
+
+void runStreams(const BenchOptions& options, const std::vector<Image>& images,
+                ocr::OCRService::Stub* stub, ArrivalSchedule& schedule, Recorder& recorder) {
+    std::vector<std::thread> streams;
+    for (int t = 0; t < options.concurrency; ++t) {
+        streams.emplace_back(runOneStream, std::cref(options), std::cref(images), stub,
+                             std::ref(schedule), std::ref(recorder));
+    }
+    for (auto& stream : streams) {
+        stream.join();
+    }
+}
+
+// `concurrency` threads, each making one ProcessBatch call of up to
+// `batch_size` images at a time. A batch is sent when its last image is
+// due, so in open loop the wait to fill it counts as latency. Images carry
+// no ids; results are matched by their index in the batch.
+void runBatches(const BenchOptions& options, const std::vector<Image>& images,
+                ocr::OCRService::Stub* stub, ArrivalSchedule& schedule, Recorder& recorder) {
+    std::vector<std::thread> senders;
+    for (int t = 0; t < options.concurrency; ++t) {
+        senders.emplace_back([&] {
+            ocr::BatchRequest batch;
+            std::vector<Clock::time_point> sent;
+            Clock::time_point when;
+            uint64_t seq = 0;
+            bool more = true;
+            while (more) {
+                batch.Clear();
+                sent.clear();
+                while (sent.size() < static_cast<size_t>(options.batch_size) &&
+                       (more = schedule.next(&when, &seq))) {
+                    // Dataset images may mix formats; the server only uses this as a hint
+                    batch.set_image_format(images[seq % images.size()].format);
+                    appendToBatch(options, images, seq, batch);
+                    sent.push_back(when);
+                }
+                if (sent.empty()) {
+                    break;
+                }
+                batch.set_priority(options.priority);
+                *batch.mutable_output() = options.output;
+                *batch.mutable_config() = options.config;
+                batch.set_deadline_ms(options.deadline_ms);
+                std::this_thread::sleep_until(sent.back());
+
+                grpc::ClientContext context;
+                context.set_deadline(std::chrono::system_clock::now() +
+                                     std::chrono::milliseconds(options.timeout_ms));
+                setClientId(options, context);
+                std::vector<bool> answered(sent.size(), false);
+                auto reader = stub->ProcessBatch(&context, batch);
+                ocr::BatchResponse response;
+                while (reader->Read(&response)) {
+                    for (const ocr::ImageResponse& result : response.results()) {
+                        size_t index = std::strtoull(result.image_id().c_str(), nullptr, 10);
+                        if (index >= sent.size() || answered[index] || result.partial()) {
+                            continue;
+                        }
+                        answered[index] = true;
+                        if (result.success()) {
+                            recorder.success(sent[index], batch.sizes(static_cast<int>(index)));
+                        } else {
+                            recorder.failure(sent[index], responseKind(result));
+                        }
+                    }
+                }
+                grpc::Status status = reader->Finish();
+                for (size_t i = 0; i < sent.size(); ++i) {
+                    if (!answered[i]) {
+                        recorder.failure(sent[i], status.ok() ? "missing_response" : statusKind(status));
+                    }
+                }
+            }
+        });
+    }
+    for (auto& sender : senders) {
+        sender.join();
+    }
+}
+
+std::string jsonEscape(const std::string& text) {
+    std::string out;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out;
+}
+
+void printText(const BenchOptions& options, size_t image_count, const Recorder::Summary& s) {
+    std::cout << std::fixed << std::setprecision(2)
+              << "ocr_bench: " << options.mode << " against " << options.server_address << ", "
+              << image_count << " images, concurrency " << options.concurrency;
+    if (options.mode == "stream") {
+        std::cout << " x window " << options.window;
+    } else if (options.mode == "batch") {
+        std::cout << " x batch " << options.batch_size;
+    }
+    if (options.thumbnail > 0) {
+        std::cout << ", thumbnails " << options.thumbnail << " px";
+    }
+    if (options.rate > 0) {
+        std::cout << ", " << options.arrival << " arrivals at " << options.rate << " req/s";
+    } else {
+        std::cout << ", closed loop";
+    }
+    std::cout << "\n"
+              << "  completed   " << s.completed << " in " << s.elapsed_s << " s\n"
+              << "  throughput  " << s.throughput << " req/s, " << s.mb_per_s << " MB/s\n"
+              << "  latency ms  mean " << s.mean_ms << "  p50 " << s.p50_ms << "  p95 " << s.p95_ms
+              << "  p99 " << s.p99_ms << "  max " << s.max_ms << "\n"
+              << "  errors      " << s.errors;
+    for (const auto& [kind, count] : s.errors_by_kind) {
+        std::cout << "  " << kind << "=" << count;
+    }
+    std::cout << std::endl;
+}
+
+void writeJson(std::ostream& out, const BenchOptions& options, size_t image_count,
+               const Recorder::Summary& s) {
+    out << std::fixed << std::setprecision(3) << "{\n"
+        << "  \"server\": \"" << jsonEscape(options.server_address) << "\",\n"
+        << "  \"mode\": \"" << options.mode << "\",\n"
+        << "  \"images\": " << image_count << ",\n"
+        << "  \"concurrency\": " << options.concurrency << ",\n"
+        << "  \"window\": " << options.window << ",\n"
+        << "  \"batch_size\": " << options.batch_size << ",\n"
+        << "  \"thumbnail\": " << options.thumbnail << ",\n"
+        << "  \"rate\": " << options.rate << ",\n"
+        << "  \"arrival\": \"" << (options.rate > 0 ? options.arrival : "closed") << "\",\n"
+        << "  \"unique\": " << (options.unique ? "true" : "false") << ",\n"
+        << "  \"seed\": " << options.seed << ",\n"
+        << "  \"elapsed_s\": " << s.elapsed_s << ",\n"
+        << "  \"completed\": " << s.completed << ",\n"
+        << "  \"throughput_rps\": " << s.throughput << ",\n"
+        << "  \"throughput_mbps\": " << s.mb_per_s << ",\n"
+        << "  \"latency_ms\": {\"mean\": " << s.mean_ms << ", \"p50\": " << s.p50_ms
+        << ", \"p95\": " << s.p95_ms << ", \"p99\": " << s.p99_ms << ", \"max\": " << s.max_ms << "},\n"
+        << "  \"errors\": " << s.errors << ",\n"
+        << "  \"errors_by_kind\": {";
+    bool first = true;
+    for (const auto& [kind, count] : s.errors_by_kind) {
+        out << (first ? "" : ", ") << "\"" << kind << "\": " << count;
+        first = false;
+    }
+    out << "}\n}\n";
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        std::cerr << "Usage: ocr_bench [--server=ADDR] [--mode=unary|stream|batch] [--dataset=DIR | --synthetic=N]\n"
+                     "                 [--concurrency=N] [--window=N] [--batch-size=N] [--thumbnail=PX] [--rate=RPS] [--arrival=uniform|poisson]\n"
+                     "                 [--duration=S] [--warmup=S] [--requests=N] [--timeout-ms=N]\n"
+                     "                 [--unique] [--seed=N] [--json[=PATH]]\n"
+                     "                 [--priority=interactive|normal|bulk] [--deadline-ms=N] [--client-id=ID]\n"
+                     "                 [--output=text,words,hocr,tsv]\n"
+                     "                 [--lang=LANGS] [--psm=MODE] [--oem=MODE] [--whitelist=CHARS] [--dpi=N]"
+                  << std::endl;
+        return 2;
+    }
+
+    std::vector<Image> images = options.synthetic > 0
+        ? synthesizeImages(options.synthetic, options.seed)
+        : loadDataset(options.dataset);
+    if (images.empty()) {
+        std::cerr << "No images found in " << options.dataset << std::endl;
+        return 1;
+    }
+    if (options.thumbnail > 0) {
+        makeThumbnails(images, options.thumbnail);
+    }
+
+    auto channel = grpc::CreateChannel(options.server_address, grpc::InsecureChannelCredentials());
+    if (!channel->WaitForConnected(std::chrono::system_clock::now() + std::chrono::seconds(5))) {
+        std::cerr << "Could not connect to " << options.server_address << std::endl;
+        return 1;
+    }
+    auto stub = ocr::OCRService::NewStub(channel);
+
+    Clock::time_point start = Clock::now();
+    auto warmup = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.warmup_s));
+    ArrivalSchedule schedule(options, start);
+    Recorder recorder(start + warmup);
+
+    if (options.mode == "unary") {
+        runUnary(options, images, stub.get(), schedule, recorder);
+    } else if (options.mode == "batch") {
+        runBatches(options, images, stub.get(), schedule, recorder);
+    } else {
+        runStreams(options, images, stub.get(), schedule, recorder);
+    }
+
+    Recorder::Summary summary = recorder.summarize();
+    if (options.json_path == "-") {
+        writeJson(std::cout, options, images.size(), summary);
+    } else {
+        printText(options, images.size(), summary);
+        if (!options.json_path.empty()) {
+            std::ofstream json(options.json_path);
+            writeJson(json, options, images.size(), summary);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,661 @@
+// In-process microbenchmarks for the server's hot primitives: Leptonica
+// PNG/JPEG decode, Tesseract SetImage + GetUTF8Text per page segmentation
+// mode, task queue push/pop throughput under 1-64 producer/consumer
+// threads, and the copies a multi-megabyte image payload takes between the
+// wire and the decoder. Fixtures come from dataset/.
+//
+//   ocr_microbench                          # everything
+//   ocr_microbench --filter=queue --json=queue.json
+//   ocr_microbench --filter=payload         # exits 1 if a payload is copied
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <leptonica/allheaders.h>
+#include <tesseract/baseapi.h>
+
+#include "ocr.pb.h"
+#include "SchedulingQueue.hpp"
+#include "ThreadSafeQueue.hpp"
+#include "server/image_payload.h"
+
+using Clock = std::chrono::steady_clock;
+
+// Every heap allocation of at least this size is counted. Copying a
+// multi-megabyte payload needs a buffer as large, so the payload group can
+// see each copy; nothing else the server does per image allocates this much.
+constexpr size_t kLargeAllocation = 1 << 20;
+std::atomic<uint64_t> g_large_allocations{0};
+
+void* operator new(std::size_t size) {
+    if (size >= kLargeAllocation) {
+        g_large_allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (void* block = std::malloc(size > 0 ? size : 1)) {
+        return block;
+    }
+    throw std::bad_alloc();
+}
+void* operator new[](std::size_t size) { return operator new(size); }
+void operator delete(void* block) noexcept { std::free(block); }
+void operator delete[](void* block) noexcept { std::free(block); }
+void operator delete(void* block, std::size_t) noexcept { std::free(block); }
+void operator delete[](void* block, std::size_t) noexcept { std::free(block); }
+
+namespace {
+
+struct Options {
+    std::string dataset = "dataset";
+    std::string filter;          // Only run benchmarks whose name contains this
+    int images = 4;              // Decode fixtures, spread from smallest to largest
+    double min_seconds = 0.5;    // Per decode/queue benchmark
+    int ocr_iterations = 3;      // OCR is slow; a fixed count keeps runs short
+    int max_threads = 64;
+    std::string json_path;
+};
+
+struct Result {
+    std::string name;
+    uint64_t iterations;
+    double ns_per_op;
+    std::string detail;
+};
+
+struct Fixture {
+    std::string name;
+    std::string png;
+    std::string jpeg;
+    int width = 0;
+    int height = 0;
+};
+
+bool matches(const Options& options, const std::string& name) {
+    return options.filter.empty() || name.find(options.filter) != std::string::npos;
+}
+
+// Runs `op` in growing batches until `min_seconds` have passed
+Result measure(const std::string& name, double min_seconds, const std::function<void()>& op) {
+    op();  // Warm-up
+    uint64_t iterations = 0;
+    uint64_t batch = 1;
+    Clock::duration elapsed{};
+    while (std::chrono::duration<double>(elapsed).count() < min_seconds) {
+        auto start = Clock::now();
+        for (uint64_t i = 0; i < batch; ++i) {
+            op();
+        }
+        elapsed += Clock::now() - start;
+        iterations += batch;
+        batch *= 2;
+    }
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+    return {name, iterations, ns / iterations, ""};
+}
+
+std::string readFile(const std::filesystem::path& path) {
+    std::ifstream file(path, std::ios::binary);
+    std::ostringstream data;
+    data << file.rdbuf();
+    return data.str();
+}
+
+// Picks `count` PNGs from `dir` spread evenly by file size and adds a
+// JPEG re-encoding of each, so both decoders see the same pixels.
+std::vector<Fixture> loadFixtures(const std::string& dir, int count) {
+    std::vector<std::filesystem::path> paths;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(dir, error)) {
+        if (entry.path().extension() == ".png") {
+            paths.push_back(entry.path());
+        }
+    }
+    std::sort(paths.begin(), paths.end(), [](const auto& a, const auto& b) {
+        return std::filesystem::file_size(a) < std::filesystem::file_size(b);
+    });
+
+    std::vector<Fixture> fixtures;
+    if (paths.empty() || count <= 0) {
+        return fixtures;
+    }
+    count = std::min<int>(count, static_cast<int>(paths.size()));
+    for (int i = 0; i < count; ++i) {
+        size_t index = count == 1 ? 0 : i * (paths.size() - 1) / (count - 1);
+        Fixture fixture;
+        fixture.name = paths[index].filename().string();
+        fixture.png = readFile(paths[index]);
+
+        PIX* pix = pixReadMemPng(reinterpret_cast<const l_uint8*>(fixture.png.data()), fixture.png.size());
+        if (!pix) {
+            continue;
+        }
+        fixture.width = pixGetWidth(pix);
+        fixture.height = pixGetHeight(pix);
+        l_uint8* jpeg = nullptr;
+        size_t jpeg_size = 0;
+        if (pixWriteMemJpeg(&jpeg, &jpeg_size, pix, 85, 0) == 0) {
+            fixture.jpeg.assign(reinterpret_cast<const char*>(jpeg), jpeg_size);
+            lept_free(jpeg);
+        }
+        pixDestroy(&pix);
+        fixtures.push_back(std::move(fixture));
+    }
+    return fixtures;
+}
+
+void benchDecode(const Options& options, const std::vector<Fixture>& fixtures,
+                 std::vector<Result>& results) {
+    for (const Fixture& fixture : fixtures) {
+        std::string size = std::to_string(fixture.width) + "x" + std::to_string(fixture.height);
+
+        if (matches(options, "decode/png/" + fixture.name)) {
+            Result png = measure("decode/png/" + fixture.name, options.min_seconds, [&fixture] {
+                PIX* pix = pixReadMemPng(reinterpret_cast<const l_uint8*>(fixture.png.data()),
+                                         fixture.png.size());
+                pixDestroy(&pix);
+            });
+            png.detail = size + ", " + std::to_string(fixture.png.size()) + " bytes";
+            results.push_back(png);
+        }
+
+        if (!fixture.jpeg.empty() && matches(options, "decode/jpeg/" + fixture.name)) {
+            Result jpeg = measure("decode/jpeg/" + fixture.name, options.min_seconds, [&fixture] {
+                PIX* pix = pixReadMemJpeg(reinterpret_cast<const l_uint8*>(fixture.jpeg.data()),
+                                          fixture.jpeg.size(), 0, 1, nullptr, 0);
+                pixDestroy(&pix);
+            });
+            jpeg.detail = size + ", " + std::to_string(fixture.jpeg.size()) + " bytes";
+            results.push_back(jpeg);
+        }
+    }
+}
+
+void benchOCR(const Options& options, const std::vector<Fixture>& fixtures,
+              std::vector<Result>& results) {
+    if (fixtures.empty()) {
+        return;
+    }
+    tesseract::TessBaseAPI api;
+    if (api.Init(nullptr, "eng")) {
+        std::cerr << "Could not initialize tesseract; skipping OCR benchmarks" << std::endl;
+        return;
+    }
+
+    // The largest fixture is the most page-like
+    const Fixture& page = fixtures.back();
+    PIX* pix = pixReadMemPng(reinterpret_cast<const l_uint8*>(page.png.data()), page.png.size());
+    if (!pix) {
+        api.End();
+        return;
+    }
+
+    const std::pair<tesseract::PageSegMode, const char*> modes[] = {
+        {tesseract::PSM_AUTO, "auto"},
+        {tesseract::PSM_SINGLE_COLUMN, "single_column"},
+        {tesseract::PSM_SINGLE_BLOCK, "single_block"},
+        {tesseract::PSM_SPARSE_TEXT, "sparse_text"},
+    };
+    for (const auto& [mode, mode_name] : modes) {
+        api.SetPageSegMode(mode);
+        std::string name = std::string("ocr/psm_") + mode_name + "/" + page.name;
+        if (!matches(options, name)) {
+            continue;
+        }
+
+        Clock::duration elapsed{};
+        for (int i = 0; i < options.ocr_iterations; ++i) {
+            auto start = Clock::now();
+            api.SetImage(pix);
+            char* text = api.GetUTF8Text();
+            delete[] text;
+            elapsed += Clock::now() - start;
+        }
+        double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+        results.push_back({name, static_cast<uint64_t>(options.ocr_iterations),
+                           ns / options.ocr_iterations,
+                           std::to_string(page.width) + "x" + std::to_string(page.height)});
+    }
+
+    pixDestroy(&pix);
+    api.End();
+}
+
+// The server's original queue, kept here as the baseline: unbounded,
+// copies items, and idle workers poll with tryPop and a 10 ms sleep.
+template<typename T>
+class PollingQueue {
+public:
+    void push(T item) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push(item);
+    }
+
+    bool tryPop(T& item) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (queue_.empty()) {
+            return false;
+        }
+        item = queue_.front();
+        queue_.pop();
+        return true;
+    }
+
+private:
+    std::queue<T> queue_;
+    std::mutex mutex_;
+};
+
+// Roughly what a queued task carries besides its payload
+struct QueueItem {
+    uint64_t seq = 0;
+    std::string image_id;
+    Clock::time_point enqueued{};
+};
+
+constexpr uint64_t kQueueItems = 200000;
+
+// The server's scheduling queue behind the plain push/pop interface,
+// spreading items over its three lanes and eight clients
+class ScheduledQueue {
+public:
+    explicit ScheduledQueue(size_t capacity) : queue_(capacity, {16, 4, 1}) {}
+
+    bool push(QueueItem item) {
+        ScheduleTicket ticket{item.seq % 3, item.seq % 8};
+        return queue_.push(std::move(item), ticket);
+    }
+    bool pop(QueueItem& item) { return queue_.pop(item); }
+    void set_finished() { queue_.set_finished(); }
+
+private:
+    SchedulingQueue<QueueItem> queue_;
+};
+
+// `threads` producers and `threads` consumers move kQueueItems through
+// a blocking queue; returns wall time in ns.
+template<typename Queue>
+double runBlockingQueue(int threads, size_t capacity) {
+    Queue queue(capacity);
+    std::vector<std::thread> producers, consumers;
+    auto start = Clock::now();
+    for (int c = 0; c < threads; ++c) {
+        consumers.emplace_back([&queue] {
+            QueueItem item;
+            while (queue.pop(item)) {
+            }
+        });
+    }
+    for (int p = 0; p < threads; ++p) {
+        producers.emplace_back([&queue, p, threads] {
+            for (uint64_t i = p; i < kQueueItems; i += threads) {
+                queue.push(QueueItem{i, "image-" + std::to_string(i % 1000)});
+            }
+        });
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    queue.set_finished();
+    for (auto& consumer : consumers) {
+        consumer.join();
+    }
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+double runPollingQueue(int threads) {
+    PollingQueue<QueueItem> queue;
+    std::atomic<uint64_t> consumed{0};
+    std::vector<std::thread> producers, consumers;
+    auto start = Clock::now();
+    for (int c = 0; c < threads; ++c) {
+        consumers.emplace_back([&queue, &consumed] {
+            QueueItem item;
+            while (consumed.load(std::memory_order_relaxed) < kQueueItems) {
+                if (queue.tryPop(item)) {
+                    consumed.fetch_add(1, std::memory_order_relaxed);
+                } else {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                }
+            }
+        });
+    }
+    for (int p = 0; p < threads; ++p) {
+        producers.emplace_back([&queue, p, threads] {
+            for (uint64_t i = p; i < kQueueItems; i += threads) {
+                queue.push(QueueItem{i, "image-" + std::to_string(i % 1000)});
+            }
+        });
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    for (auto& consumer : consumers) {
+        consumer.join();
+    }
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+// Handoff latency when work arrives sparsely (one item per millisecond)
+// and `consumers` workers sit idle, which is the server's usual state.
+// Saturated throughput above says nothing about this case.
+constexpr int kLatencyItems = 300;
+
+template<typename Queue, typename Pop>
+std::vector<double> measureHandoff(Queue& queue, int consumers, Pop pop, const std::function<void()>& finish) {
+    std::mutex mutex;
+    std::vector<double> latencies;
+    std::vector<std::thread> threads;
+    for (int c = 0; c < consumers; ++c) {
+        threads.emplace_back([&] {
+            QueueItem item;
+            while (pop(item)) {
+                double ns = std::chrono::duration<double, std::nano>(Clock::now() - item.enqueued).count();
+                std::lock_guard<std::mutex> lock(mutex);
+                latencies.push_back(ns);
+            }
+        });
+    }
+    for (int i = 0; i < kLatencyItems; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        QueueItem item{static_cast<uint64_t>(i), "image", Clock::now()};
+        queue.push(std::move(item));
+    }
+    finish();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    std::sort(latencies.begin(), latencies.end());
+    return latencies;
+}
+
+void benchHandoff(const Options& options, std::vector<Result>& results) {
+    const int consumers = 4;
+    auto report = [&results](const std::string& name, const std::vector<double>& latencies) {
+        if (latencies.empty()) {
+            return;
+        }
+        double p99 = latencies[(latencies.size() - 1) * 99 / 100];
+        std::ostringstream detail;
+        detail << std::fixed << std::setprecision(1) << "p50 handoff, p99 " << p99 / 1e3 << " us";
+        results.push_back({name, latencies.size(), latencies[latencies.size() / 2], detail.str()});
+    };
+
+    std::string name = "queue/blocking/handoff_" + std::to_string(consumers) + "c";
+    if (matches(options, name)) {
+        ThreadSafeQueue<QueueItem> queue(consumers * 16);
+        report(name, measureHandoff(queue, consumers,
+                                    [&queue](QueueItem& item) { return queue.pop(item); },
+                                    [&queue] { queue.set_finished(); }));
+    }
+
+    name = "queue/scheduled/handoff_" + std::to_string(consumers) + "c";
+    if (matches(options, name)) {
+        ScheduledQueue queue(consumers * 16);
+        report(name, measureHandoff(queue, consumers,
+                                    [&queue](QueueItem& item) { return queue.pop(item); },
+                                    [&queue] { queue.set_finished(); }));
+    }
+
+    name = "queue/polling/handoff_" + std::to_string(consumers) + "c";
+    if (matches(options, name)) {
+        PollingQueue<QueueItem> queue;
+        std::atomic<bool> done{false};
+        report(name, measureHandoff(queue, consumers,
+                                    [&queue, &done](QueueItem& item) {
+                                        while (!queue.tryPop(item)) {
+                                            if (done.load()) {
+                                                return false;
+                                            }
+                                            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                                        }
+                                        return true;
+                                    },
+                                    [&done] { done = true; }));
+    }
+}
+
+void benchQueues(const Options& options, std::vector<Result>& results) {
+    benchHandoff(options, results);
+
+    for (int threads = 1; threads <= options.max_threads; threads *= 2) {
+        struct Variant {
+            std::string name;
+            std::function<double()> run;
+        };
+        const Variant variants[] = {
+            // Same bound the server uses: 16 slots per worker
+            {"blocking", [threads] { return runBlockingQueue<ThreadSafeQueue<QueueItem>>(threads, threads * 16); }},
+            {"scheduled", [threads] { return runBlockingQueue<ScheduledQueue>(threads, threads * 16); }},
+            {"polling", [threads] { return runPollingQueue(threads); }},
+        };
+        for (const Variant& variant : variants) {
+            std::string name = "queue/" + variant.name + "/" + std::to_string(threads) + "x" +
+                               std::to_string(threads);
+            if (!matches(options, name)) {
+                continue;
+            }
+            // Each run moves kQueueItems; repeat until min_seconds
+            double ns = 0;
+            uint64_t runs = 0;
+            while (runs == 0 || ns < options.min_seconds * 1e9) {
+                ns += variant.run();
+                ++runs;
+            }
+            double per_item = ns / (runs * kQueueItems);
+            std::ostringstream detail;
+            detail << std::fixed << std::setprecision(2) << 1e3 / per_item << " M items/s";
+            results.push_back({name, runs * kQueueItems, per_item, detail.str()});
+        }
+    }
+}
+
+// What a queued task carries along with its payload
+struct PayloadTask {
+    std::string image_id;
+    ImagePayload image_data;
+};
+
+constexpr size_t kPayloadBytes = 8 << 20;
+constexpr int kBatchImages = 4;
+
+// Follows one multi-megabyte image from the wire to what a decoder reads,
+// the way the server handles it: parse the request (gRPC's one copy out of
+// the receive buffer), adopt the image bytes into a payload, queue the task
+// and pop it, and take the payload's view. A batch does the same with one
+// packed buffer sliced into images. Past the parse, no step may allocate a
+// buffer the size of an image or hand on bytes at another address; returns
+// false if one does.
+bool benchPayload(const Options& options, std::vector<Result>& results) {
+    bool zero_copy = true;
+    auto report = [&](Result result, uint64_t runs, uint64_t at_parse, uint64_t after_parse, uint64_t moved) {
+        std::ostringstream detail;
+        detail << kPayloadBytes / (1 << 20) << " MB, image-size buffers per op: "
+               << static_cast<double>(at_parse) / runs << " at parse, "
+               << static_cast<double>(after_parse) / runs << " after";
+        if (after_parse > 0 || moved > 0) {
+            detail << ", " << moved << " payloads moved to another address";
+            std::cerr << result.name << ": image bytes were copied after parsing" << std::endl;
+            zero_copy = false;
+        }
+        result.detail = detail.str();
+        results.push_back(result);
+    };
+    SchedulingQueue<PayloadTask> queue(16, {16, 4, 1});
+    ScheduleTicket ticket{0, 0};
+
+    std::string name = "payload/stream";
+    if (matches(options, name)) {
+        ocr::ImageRequest request;
+        request.set_image_id("scan");
+        request.set_image_format("png");
+        request.mutable_image_data()->assign(kPayloadBytes, '\x5a');
+        const std::string wire = request.SerializeAsString();
+
+        uint64_t runs = 0, at_parse = 0, after_parse = 0, moved = 0;
+        Result result = measure(name, options.min_seconds, [&] {
+            uint64_t start = g_large_allocations.load(std::memory_order_relaxed);
+            ocr::ImageRequest received;
+            received.ParseFromString(wire);
+            const char* bytes = received.image_data().data();
+            uint64_t parsed = g_large_allocations.load(std::memory_order_relaxed);
+
+            queue.push(PayloadTask{received.image_id(), ImagePayload(std::move(*received.mutable_image_data()))},
+                       ticket);
+            PayloadTask task;
+            queue.pop(task);
+            std::string_view decoded = task.image_data.view();
+
+            ++runs;
+            at_parse += parsed - start;
+            after_parse += g_large_allocations.load(std::memory_order_relaxed) - parsed;
+            moved += decoded.data() != bytes || decoded.size() != kPayloadBytes;
+        });
+        report(result, runs, at_parse, after_parse, moved);
+    }
+
+    name = "payload/batch";
+    if (matches(options, name)) {
+        ocr::BatchRequest batch;
+        for (int i = 0; i < kBatchImages; ++i) {
+            batch.add_image_ids("page-" + std::to_string(i));
+            batch.add_sizes(kPayloadBytes / kBatchImages);
+        }
+        batch.mutable_packed()->assign(kPayloadBytes, '\x5a');
+        const std::string wire = batch.SerializeAsString();
+
+        uint64_t runs = 0, at_parse = 0, after_parse = 0, moved = 0;
+        Result result = measure(name, options.min_seconds, [&] {
+            uint64_t start = g_large_allocations.load(std::memory_order_relaxed);
+            ocr::BatchRequest received;
+            received.ParseFromString(wire);
+            uint64_t parsed = g_large_allocations.load(std::memory_order_relaxed);
+
+            auto packed = std::make_shared<const std::string>(std::move(*received.mutable_packed()));
+            size_t offset = 0;
+            for (int i = 0; i < kBatchImages; ++i) {
+                size_t size = received.sizes(i);
+                queue.push(PayloadTask{received.image_ids(i), ImagePayload(packed, offset, size)}, ticket);
+                PayloadTask task;
+                queue.pop(task);
+                std::string_view decoded = task.image_data.view();
+                moved += decoded.data() != packed->data() + offset || decoded.size() != size;
+                offset += size;
+            }
+
+            ++runs;
+            at_parse += parsed - start;
+            after_parse += g_large_allocations.load(std::memory_order_relaxed) - parsed;
+        });
+        report(result, runs, at_parse, after_parse, moved);
+    }
+    return zero_copy;
+}
+
+void printResults(const std::vector<Result>& results) {
+    size_t width = 10;
+    for (const Result& result : results) {
+        width = std::max(width, result.name.size());
+    }
+    std::cout << std::left << std::setw(static_cast<int>(width) + 2) << "benchmark"
+              << std::right << std::setw(14) << "ns/op" << std::setw(12) << "iters" << "  detail\n";
+    for (const Result& result : results) {
+        std::cout << std::left << std::setw(static_cast<int>(width) + 2) << result.name
+                  << std::right << std::fixed << std::setprecision(1) << std::setw(14) << result.ns_per_op
+                  << std::setw(12) << result.iterations << "  " << result.detail << "\n";
+    }
+    std::cout << std::flush;
+}
+
+void writeJson(const std::string& path, const std::vector<Result>& results) {
+    std::ofstream out(path);
+    out << std::fixed << std::setprecision(1) << "[\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& result = results[i];
+        out << "  {\"name\": \"" << result.name << "\", \"iterations\": " << result.iterations
+            << ", \"ns_per_op\": " << result.ns_per_op << ", \"detail\": \"" << result.detail << "\"}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "]\n";
+}
+
+// Skips a whole group (and its setup) only when the filter names another one
+bool selected(const Options& options, const std::string& group) {
+    for (const char* other : {"decode", "ocr", "queue", "payload"}) {
+        if (group != other && options.filter.rfind(other, 0) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--dataset=", 0) == 0) {
+            options.dataset = arg.substr(10);
+        } else if (arg.rfind("--filter=", 0) == 0) {
+            options.filter = arg.substr(9);
+        } else if (arg.rfind("--images=", 0) == 0) {
+            options.images = std::stoi(arg.substr(9));
+        } else if (arg.rfind("--min-time=", 0) == 0) {
+            options.min_seconds = std::stod(arg.substr(11));
+        } else if (arg.rfind("--ocr-iterations=", 0) == 0) {
+            options.ocr_iterations = std::max(1, std::stoi(arg.substr(17)));
+        } else if (arg.rfind("--max-threads=", 0) == 0) {
+            options.max_threads = std::stoi(arg.substr(14));
+        } else if (arg.rfind("--json=", 0) == 0) {
+            options.json_path = arg.substr(7);
+        } else {
+            std::cerr << "Usage: ocr_microbench [--filter=decode|ocr|queue|payload|NAME] [--dataset=DIR] [--images=N]\n"
+                         "                      [--min-time=S] [--ocr-iterations=N] [--max-threads=N] [--json=PATH]"
+                      << std::endl;
+            return 2;
+        }
+    }
+
+    std::vector<Result> results;
+    bool want_decode = selected(options, "decode");
+    bool want_ocr = selected(options, "ocr");
+    std::vector<Fixture> fixtures;
+    if (want_decode || want_ocr) {
+        fixtures = loadFixtures(options.dataset, options.images);
+        if (fixtures.empty()) {
+            std::cerr << "No PNG fixtures in " << options.dataset << std::endl;
+        }
+    }
+    if (want_decode) {
+        benchDecode(options, fixtures, results);
+    }
+    if (want_ocr) {
+        benchOCR(options, fixtures, results);
+    }
+    if (selected(options, "queue")) {
+        benchQueues(options, results);
+    }
+    bool zero_copy = true;
+    if (selected(options, "payload")) {
+        zero_copy = benchPayload(options, results);
+    }
+
+    printResults(results);
+    if (!options.json_path.empty()) {
+        writeJson(options.json_path, results);
+    }
+    return zero_copy ? 0 : 1;
+}
@@ -18,10 +18,13 @@ cmake --build . --config Release
 echo Build complete!
 echo.
 echo To run the server:
-echo   build\Release\ocr_server.exe [address] [num_workers]
+echo   build\Release\ocr_server.exe [address] [num_workers] [unary_engines] [admission_wait_ms] [--async] [--io-threads=N] [--cache-mb=N] [--cache-file=PATH] [--preprocess=STEPS] [--target-dpi=N] [--assumed-dpi=N] [--full-decode] [--metrics-port=N] [--split-height=N] [--split-bands=N] [--coordinator] [--join=ADDR] [--advertise=ADDR] [--upload-memory-mb=N] [--max-upload-mb=N] [--lang=LANGS] [--preload-langs=LANGS,...] [--engine-idle-s=N]
 echo.
 echo To run the client:
 echo   build\Release\ocr_client.exe
+echo.
+echo To benchmark a running server:
+echo   build\Release\ocr_bench.exe [--server=ADDR] [--mode=unary^|stream^|batch] [--batch-size=N] [--concurrency=N] [--rate=RPS] [--duration=S] [--json[=PATH]]
 
 pause
 
@@ -24,8 +24,11 @@ cmake --build . -j$(nproc)
 echo "Build complete!"
 echo ""
 echo "To run the server:"
-echo "  ./build/ocr_server [address] [num_workers]"
+echo "  ./build/ocr_server [address] [num_workers] [unary_engines] [admission_wait_ms] [--async] [--io-threads=N] [--cache-mb=N] [--cache-file=PATH] [--preprocess=STEPS] [--target-dpi=N] [--assumed-dpi=N] [--full-decode] [--metrics-port=N] [--split-height=N] [--split-bands=N] [--coordinator] [--join=ADDR] [--advertise=ADDR] [--upload-memory-mb=N] [--max-upload-mb=N] [--lang=LANGS] [--preload-langs=LANGS,...] [--engine-idle-s=N]"
 echo ""
 echo "To run the client:"
 echo "  ./build/ocr_client"
+echo ""
+echo "To benchmark a running server:"
+echo "  ./build/ocr_bench [--server=ADDR] [--mode=unary|stream|batch] [--batch-size=N] [--concurrency=N] [--rate=RPS] [--duration=S] [--json[=PATH]]"
 
@@ -4,8 +4,17 @@
 int main(int argc, char *argv[])
 {
     QApplication app(argc, argv);
-    MainWindow window;
+
+    // ocr_client [host:port ...]; each argument may also be a comma-separated list
+    QStringList servers;
+    for (const QString& arg : app.arguments().mid(1)) {
+        servers += arg.split(',', Qt::SkipEmptyParts);
+    }
+    if (servers.isEmpty()) {
+        servers << "localhost:50051";
+    }
+
+    MainWindow window(servers);
     window.show();
     return app.exec(); //test
 }
-
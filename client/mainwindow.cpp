@@ -16,6 +16,7 @@
 #include <QWaitCondition>
 #include <algorithm>
 #include <QMutexLocker>
+#include <QStandardPaths>
 #include <iostream>
 
 ResultCard::ResultCard(const QString& imageId, QWidget* parent)
@@ -92,11 +93,17 @@ void ResultCard::setResult(const QString& text) {
 void ResultCard::setInProgress() {
     mainTextLabel_->setText("In progress");
     detailLabel_->setText("");
+    pagesDone_.clear();
+}
+
+void ResultCard::setPageDone(int pageIndex, int pageCount) {
+    pagesDone_.insert(pageIndex);
+    detailLabel_->setText(QString("%1 of %2 pages done").arg(pagesDone_.size()).arg(pageCount));
 }
 
 // OCR Worker Thread Implementation
 OCRWorkerThread::OCRWorkerThread(QObject* parent)
-    : QThread(parent), shouldStop_(false)
+    : QThread(parent), window_(16), shouldStop_(false), activeStream_(nullptr)
 {
 }
 
@@ -104,9 +111,32 @@ void OCRWorkerThread::setClient(std::shared_ptr<OCRClient> client) {
     client_ = client;
 }
 
+void OCRWorkerThread::setCache(std::shared_ptr<OCRResultCache> cache) {
+    cache_ = cache;
+}
+
+void OCRWorkerThread::deliverResult(const QString& imageId, const QString& text, bool success, const QString& error) {
+    emit resultReady(imageId, text, success, error);
+    if (cache_) {
+        // Duplicates of this image that were waiting on it
+        const QStringList joined = cache_->finish(imageId, text, success);
+        for (const QString& joinedId : joined) {
+            emit resultReady(joinedId, text, success, error);
+        }
+    }
+}
+
+void OCRWorkerThread::setWindow(int window) {
+    window_ = window;
+}
+
 void OCRWorkerThread::stop() {
     QMutexLocker locker(&queueMutex_);
     shouldStop_ = true;
+    taskQueue_.clear();
+    if (activeStream_) {
+        activeStream_->cancel();
+    }
     condition_.wakeAll();
 }
 
@@ -119,7 +149,17 @@ void OCRWorkerThread::processImage(const QString& imagePath, const QString& imag
     condition_.wakeOne();
 }
 
+void OCRWorkerThread::finishBatch() {
+    QMutexLocker locker(&queueMutex_);
+    Task task;
+    task.endOfBatch = true;
+    taskQueue_.enqueue(task);
+    condition_.wakeOne();
+}
+
 void OCRWorkerThread::run() {
+    std::unique_ptr<OCRClient::ImageStream> stream;
+
     while (true) {
         Task task;
         
@@ -139,69 +179,161 @@ void OCRWorkerThread::run() {
             }
         }
 
+        // Close the batch's stream once all of its results are in
+        if (task.endOfBatch) {
+            if (stream) {
+                stream->finish();
+                QMutexLocker locker(&queueMutex_);
+                activeStream_ = nullptr;
+                stream.reset();
+            }
+            continue;
+        }
+
         if (!client_ || task.imagePath.isEmpty()) {
             continue;
         }
 
-        QString text;
-        bool success = false;
-        QString error;
-        
-        // Read image file
+        // Map the image file instead of reading it into a buffer; fall back
+        // to readAll() for files that cannot be mapped
         QFile file(task.imagePath);
-        if (file.open(QIODevice::ReadOnly)) {
-            QByteArray imageData = file.readAll();
-            QString format = QFileInfo(task.imagePath).suffix().toLower();
-            
-            // Process image through gRPC
-            std::string extractedText;
-            success = client_->processImage(task.imageId.toStdString(), 
-                                            std::string(imageData.constData(), imageData.size()), 
-                                            format.toStdString(),
-                                            extractedText);
-            text = QString::fromStdString(extractedText);
-            
-            if (!success) {
-                error = text.isEmpty() ? "Processing failed" : text;
-            }
+        if (!file.open(QIODevice::ReadOnly)) {
+            emit resultReady(task.imageId, QString(), false, "Could not read image file");
+            continue;
+        }
+        QByteArray fallbackData;
+        const char* imageData = nullptr;
+        size_t imageSize = 0;
+        uchar* mapped = file.size() > 0 ? file.map(0, file.size()) : nullptr;
+        if (mapped) {
+            imageData = reinterpret_cast<const char*>(mapped);
+            imageSize = static_cast<size_t>(file.size());
         } else {
-            error = "Could not read image file";
+            fallbackData = file.readAll();
+            imageData = fallbackData.constData();
+            imageSize = static_cast<size_t>(fallbackData.size());
         }
+        QString format = QFileInfo(task.imagePath).suffix().toLower();
+
+        // Answer repeated content from the cache, or let it ride on an
+        // identical image that is already in flight
+        if (cache_) {
+            QString cachedText;
+            OCRResultCache::Lookup lookup = cache_->begin(
+                OCRResultCache::makeKey(imageData, static_cast<qint64>(imageSize)),
+                task.imageId, &cachedText);
+            if (lookup != OCRResultCache::Lookup::Leader) {
+                if (mapped) {
+                    file.unmap(mapped);
+                }
+                if (lookup == OCRResultCache::Lookup::Hit) {
+                    emit resultReady(task.imageId, cachedText, true, QString());
+                }
+                continue;
+            }
+        }
+
+        // Too large for one message: upload it in chunks instead. This holds
+        // up the rest of the queue until it is answered, which is rare
+        // enough (multi-megabyte scans) not to need its own thread.
+        if (imageSize > OCRClient::kUploadThreshold) {
+            std::string text;
+            bool success = client_->uploadImage(task.imageId.toStdString(), imageData, imageSize,
+                                                format.toStdString(), text);
+            if (mapped) {
+                file.unmap(mapped);
+            }
+            QString message = success ? QString() : QString::fromStdString(text);
+            if (!success && message.isEmpty()) {
+                message = "Processing failed";
+            }
+            deliverResult(task.imageId, QString::fromStdString(text), success, message);
+            continue;
+        }
+
+        // Open one stream per batch; results arrive on the stream's reader
+        // thread as soon as the server finishes each image
+        if (!stream) {
+            stream = client_->openStream(window_,
+                [this](const std::string& imageId, const std::string& text,
+                       bool success, const std::string& error) {
+                    QString message = QString::fromStdString(error);
+                    if (!success && message.isEmpty()) {
+                        message = "Processing failed";
+                    }
+                    deliverResult(QString::fromStdString(imageId),
+                                  QString::fromStdString(text), success, message);
+                },
+                [this](const std::string& imageId, uint32_t pageIndex, uint32_t pageCount, bool) {
+                    emit pageReady(QString::fromStdString(imageId), static_cast<int>(pageIndex),
+                                   static_cast<int>(pageCount));
+                });
+            QMutexLocker locker(&queueMutex_);
+            activeStream_ = stream.get();
+        }
+
+        // Blocks while the window is full; the mapping is only needed until
+        // send() returns
+        bool sent = stream->send(task.imageId.toStdString(), imageData, imageSize,
+                                 format.toStdString());
+        if (mapped) {
+            file.unmap(mapped);
+        }
+        if (!sent) {
+            // No server took the image (it was already reported as failed);
+            // start a fresh stream for the rest of the batch
+            stream->finish();
+            QMutexLocker locker(&queueMutex_);
+            activeStream_ = nullptr;
+            stream.reset();
+        }
+    }
 
-        emit resultReady(task.imageId, text, success, error);
+    if (stream) {
+        stream->finish();
+        QMutexLocker locker(&queueMutex_);
+        activeStream_ = nullptr;
     }
 }
 
 // MainWindow Implementation
-MainWindow::MainWindow(QWidget *parent)
+MainWindow::MainWindow(const QStringList& servers, QWidget *parent)
     : QMainWindow(parent)
     , totalImages_(0)
     , currentBatchStart_(0)
-    , serverAddress_("localhost:50051")
+    , streamWindow_(16)
+    , serverAddresses_(servers)
 {
     setupUI();
     
     // Initialize gRPC client
-    ocrClient_ = std::make_shared<OCRClient>(serverAddress_.toStdString());
-    
-    // Create worker threads
-    for (int i = 0; i < 4; ++i) {
-        OCRWorkerThread* thread = new OCRWorkerThread(this);
-        thread->setClient(ocrClient_);
-        connect(thread, &OCRWorkerThread::resultReady, this, &MainWindow::onResultReady, Qt::QueuedConnection);
-        workerThreads_.append(thread);
-        thread->start();
+    std::vector<std::string> addresses;
+    for (const QString& address : serverAddresses_) {
+        addresses.push_back(address.toStdString());
     }
+    ocrClient_ = std::make_shared<OCRClient>(addresses);
+
+    // Remember results across batches: 8 MB in memory, 64 MB on disk
+    resultCache_ = std::make_shared<OCRResultCache>(
+        QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/ocr-results",
+        64 * 1024 * 1024, 8 * 1024 * 1024);
+    
+    // Create the streaming worker thread
+    workerThread_ = new OCRWorkerThread(this);
+    workerThread_->setClient(ocrClient_);
+    workerThread_->setCache(resultCache_);
+    workerThread_->setWindow(streamWindow_);
+    connect(workerThread_, &OCRWorkerThread::resultReady, this, &MainWindow::onResultReady, Qt::QueuedConnection);
+    connect(workerThread_, &OCRWorkerThread::pageReady, this, &MainWindow::onPageReady, Qt::QueuedConnection);
+    workerThread_->start();
 }
 
 MainWindow::~MainWindow()
 {
-    // Cleanup worker threads
-    for (auto* thread : workerThreads_) {
-        thread->stop();
-        thread->wait();
-        delete thread;
-    }
+    // Cleanup worker thread
+    workerThread_->stop();
+    workerThread_->wait();
+    delete workerThread_;
 }
 
 void MainWindow::setupUI() {
@@ -283,7 +415,7 @@ void MainWindow::onUploadButtonClicked() {
         this,
         "Select Images",
         QDir::homePath(),
-        "Image Files (*.png *.jpg *.jpeg *.bmp *.tiff)"
+        "Image Files (*.png *.jpg *.jpeg *.bmp *.tif *.tiff *.webp *.pbm *.pgm *.ppm *.pnm)"
     );
 
     if (files.isEmpty()) {
@@ -306,11 +438,8 @@ void MainWindow::onUploadButtonClicked() {
         // Create card
         addImageCard(imageId, filePath);
 
-        // Add to any worker thread's queue (round-robin or first available)
-        // Workers will process from their queues
-        static int threadIndex = 0;
-        workerThreads_[threadIndex % workerThreads_.size()]->processImage(filePath, imageId);
-        threadIndex++;
+        // Push onto the batch's stream as soon as it is selected
+        workerThread_->processImage(filePath, imageId);
     }
 
     updateProgressBar();
@@ -335,7 +464,10 @@ ResultCard* MainWindow::getOrCreateCard(const QString& imageId) {
 }
 
 void MainWindow::onResultReady(const QString& imageId, const QString& text, bool success, const QString& error) {
-    pendingImages_.remove(imageId);
+    // Ignore late results for images from a cleared batch
+    if (!pendingImages_.remove(imageId)) {
+        return;
+    }
     completedImages_.insert(imageId);
 
     ResultCard* card = getOrCreateCard(imageId);
@@ -350,6 +482,16 @@ void MainWindow::onResultReady(const QString& imageId, const QString& text, bool
     updateProgressBar();
 }
 
+void MainWindow::onPageReady(const QString& imageId, int pageIndex, int pageCount) {
+    if (!pendingImages_.contains(imageId)) {
+        return;
+    }
+    ResultCard* card = getOrCreateCard(imageId);
+    if (card) {
+        card->setPageDone(pageIndex, pageCount);
+    }
+}
+
 void MainWindow::updateProgressBar() {
     if (totalImages_ == 0) {
         progressBar_->setValue(0);
@@ -367,8 +509,11 @@ void MainWindow::updateProgressBar() {
 }
 
 void MainWindow::onBatchComplete() {
-    // Batch complete - next upload will start new batch
+    // Batch complete - close its stream; next upload will start new batch
     // Results will be cleared on next upload
+    if (pendingImages_.empty()) {
+        workerThread_->finishBatch();
+    }
 }
 
 void MainWindow::startNewBatch() {
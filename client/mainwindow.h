@@ -13,9 +13,14 @@
 #include <QTimer>
 #include <QThread>
 #include <QMap>
+#include <QSet>
+#include <QQueue>
+#include <QMutex>
+#include <QWaitCondition>
 #include <memory>
 
 #include "ocr_client.h"
+#include "ocr_result_cache.h"
 
 
 // Card widget to display OCR result
@@ -26,39 +31,53 @@ public:
     explicit ResultCard(const QString& imageId, QWidget* parent = nullptr);
     void setResult(const QString& text);
     void setInProgress();
+    // Progress through a multi-page document
+    void setPageDone(int pageIndex, int pageCount);
 
 private:
     QLabel* mainTextLabel_;
     QLabel* detailLabel_;
     QString imageId_;
+    QSet<int> pagesDone_;  // A page may be reported twice if it is retried
 };
 
-// Worker thread for handling gRPC communication
+// Worker thread for handling gRPC communication. Feeds every image of a
+// batch into one ProcessImageStream call; the number of images in flight is
+// bounded by the stream window rather than by a thread count.
 class OCRWorkerThread : public QThread {
     Q_OBJECT
 
 public:
     OCRWorkerThread(QObject* parent = nullptr);
     void processImage(const QString& imagePath, const QString& imageId);
+    void finishBatch();
     void setClient(std::shared_ptr<OCRClient> client);
+    void setCache(std::shared_ptr<OCRResultCache> cache);
+    void setWindow(int window);
     void stop();
 
 signals:
     void resultReady(const QString& imageId, const QString& text, bool success, const QString& error);
+    void pageReady(const QString& imageId, int pageIndex, int pageCount);
 
 private:
     void run() override;
+    void deliverResult(const QString& imageId, const QString& text, bool success, const QString& error);
     std::shared_ptr<OCRClient> client_;
+    std::shared_ptr<OCRResultCache> cache_;
+    int window_;
     
     struct Task {
         QString imagePath;
         QString imageId;
+        bool endOfBatch = false;
     };
     
     QQueue<Task> taskQueue_;
     QMutex queueMutex_;
     QWaitCondition condition_;
     bool shouldStop_;
+    OCRClient::ImageStream* activeStream_;  // Guarded by queueMutex_
 };
 
 class MainWindow : public QMainWindow
@@ -66,12 +85,14 @@ class MainWindow : public QMainWindow
     Q_OBJECT
 
 public:
-    MainWindow(QWidget *parent = nullptr);
+    // `servers` are host:port addresses; requests are balanced across them
+    explicit MainWindow(const QStringList& servers, QWidget *parent = nullptr);
     ~MainWindow();
 
 private slots:
     void onUploadButtonClicked();
     void onResultReady(const QString& imageId, const QString& text, bool success, const QString& error);
+    void onPageReady(const QString& imageId, int pageIndex, int pageCount);
     void onBatchComplete();
     void startNewBatch();
 
@@ -97,12 +118,14 @@ private:
     int totalImages_;
     int currentBatchStart_;
     
-    // gRPC client and worker threads
+    // gRPC client, result memo and streaming worker thread
     std::shared_ptr<OCRClient> ocrClient_;
-    QList<OCRWorkerThread*> workerThreads_;
+    std::shared_ptr<OCRResultCache> resultCache_;
+    OCRWorkerThread* workerThread_;
+    int streamWindow_;
     
     // Server connection settings
-    QString serverAddress_;
+    QStringList serverAddresses_;
 };
 
 #endif // MAINWINDOW_H
@@ -1,82 +1,508 @@
+
 #include "ocr_client.h"
+#include <algorithm>
 #include <iostream>
+#include <random>
+#include <sstream>
+
+namespace {
+
+// Tries per image, each on a different server, before it is reported as failed
+constexpr int kMaxAttempts = 3;
+// Consecutive failed requests before a server is ejected
+constexpr int kEjectAfterFailures = 2;
+constexpr std::chrono::milliseconds kFirstEjection(5000);
+constexpr std::chrono::milliseconds kMaxEjection(60000);
+constexpr auto kHealthInterval = std::chrono::seconds(2);
+constexpr auto kHealthTimeout = std::chrono::seconds(1);
+constexpr auto kRequestTimeout = std::chrono::seconds(60);
+// Upload chunk size; well under the default 4 MB message limit
+constexpr size_t kUploadChunkSize = 1024 * 1024;
+
+std::vector<std::string> splitAddresses(const std::string& list) {
+    std::vector<std::string> addresses;
+    std::stringstream stream(list);
+    std::string address;
+    while (std::getline(stream, address, ',')) {
+        address.erase(0, address.find_first_not_of(" \t"));
+        address.erase(address.find_last_not_of(" \t") + 1);
+        if (!address.empty()) {
+            addresses.push_back(address);
+        }
+    }
+    return addresses;
+}
+
+// Failures that say nothing about the image, so another server may succeed
+bool retryable(const grpc::Status& status) {
+    return status.error_code() == grpc::StatusCode::UNAVAILABLE ||
+           status.error_code() == grpc::StatusCode::RESOURCE_EXHAUSTED;
+}
+
+// Likewise for a server that answered but could not take the image
+bool retryable(ocr::ErrorCode error) {
+    return error == ocr::ERROR_UNAVAILABLE || error == ocr::ERROR_OVERLOADED;
+}
+
+std::mt19937& randomEngine() {
+    thread_local std::mt19937 generator(std::random_device{}());
+    return generator;
+}
+
+} // namespace
 
 OCRClient::OCRClient(const std::string& server_address)
-    : server_address_(server_address), connected_(false)
+    : OCRClient(splitAddresses(server_address))
 {
-    reconnect(); // sdad
 }
 
-OCRClient::~OCRClient() {
+OCRClient::OCRClient(const std::vector<std::string>& server_addresses)
+    : stopping_(false)
+{
+    for (const std::string& address : server_addresses) {
+        auto backend = std::make_unique<Backend>();
+        backend->address = address;
+        backend->channel = grpc::CreateChannel(address, grpc::InsecureChannelCredentials());
+        backend->stub = ocr::OCRService::NewStub(backend->channel);
+        backend->health = grpc::health::v1::Health::NewStub(backend->channel);
+        backend->channel->GetState(true);  // Start connecting now
+        std::cout << "Using OCR server " << address << std::endl;
+        backends_.push_back(std::move(backend));
+    }
+    if (backends_.empty()) {
+        std::cerr << "No OCR server address given" << std::endl;
+    }
+    health_thread_ = std::thread(&OCRClient::healthLoop, this);
 }
 
-void OCRClient::reconnect() {
-    try {
-        channel_ = grpc::CreateChannel(server_address_, grpc::InsecureChannelCredentials());
-        stub_ = ocr::OCRService::NewStub(channel_);
-        
-        // Check connection state
-        grpc::ConnectivityState state = channel_->GetState(true);
-        connected_ = (state != GRPC_CHANNEL_SHUTDOWN);
-        
-        if (connected_) {
-            std::cout << "Connected to server at " << server_address_ << std::endl;
-        } else {
-            std::cerr << "Failed to connect to server at " << server_address_ << std::endl;
-        }
-    } catch (const std::exception& e) {
-        std::cerr << "Error creating gRPC channel: " << e.what() << std::endl;
-        connected_ = false;
+OCRClient::~OCRClient() {
+    {
+        std::lock_guard<std::mutex> lock(health_mutex_);
+        stopping_ = true;
     }
+    health_cv_.notify_all();
+    health_thread_.join();
 }
 
 bool OCRClient::isConnected() const {
-    if (channel_) {
-        grpc::ConnectivityState state = channel_->GetState(false);
-        return (state == GRPC_CHANNEL_READY || state == GRPC_CHANNEL_IDLE);
+    for (const auto& backend : backends_) {
+        grpc_connectivity_state state = backend->channel->GetState(false);
+        if (state == GRPC_CHANNEL_READY || state == GRPC_CHANNEL_IDLE) {
+            return true;
+        }
     }
     return false;
 }
 
+bool OCRClient::usable(const Backend* backend, std::chrono::steady_clock::time_point now) const {
+    return backend->healthy.load() && now >= backend->ejected_until;
+}
+
+OCRClient::Backend* OCRClient::pickBackend(const Backend* avoid) {
+    std::vector<Backend*> candidates;
+    {
+        std::lock_guard<std::mutex> lock(backend_mutex_);
+        auto now = std::chrono::steady_clock::now();
+        for (const auto& backend : backends_) {
+            if (backend.get() != avoid && usable(backend.get(), now)) {
+                candidates.push_back(backend.get());
+            }
+        }
+        if (candidates.empty()) {
+            // Nothing looks healthy; trying anyway beats failing outright
+            for (const auto& backend : backends_) {
+                if (backend.get() != avoid) {
+                    candidates.push_back(backend.get());
+                }
+            }
+        }
+    }
+    if (candidates.size() <= 1) {
+        return candidates.empty() ? nullptr : candidates[0];
+    }
+
+    // Two distinct random servers; the one with fewer requests in flight wins
+    std::uniform_int_distribution<size_t> pick(0, candidates.size() - 1);
+    size_t first = pick(randomEngine());
+    size_t second = pick(randomEngine());
+    if (second == first) {
+        second = (first + 1) % candidates.size();
+    }
+    Backend* a = candidates[first];
+    Backend* b = candidates[second];
+    return b->outstanding.load() < a->outstanding.load() ? b : a;
+}
+
+void OCRClient::reportSuccess(Backend* backend) {
+    std::lock_guard<std::mutex> lock(backend_mutex_);
+    backend->failures = 0;
+    backend->ejection = std::chrono::milliseconds(0);
+}
+
+void OCRClient::reportFailure(Backend* backend) {
+    std::lock_guard<std::mutex> lock(backend_mutex_);
+    if (++backend->failures < kEjectAfterFailures) {
+        return;
+    }
+    backend->failures = 0;
+    backend->ejection = backend->ejection.count() == 0
+        ? kFirstEjection
+        : std::min(backend->ejection * 2, kMaxEjection);
+    backend->ejected_until = std::chrono::steady_clock::now() + backend->ejection;
+    std::cerr << "Ejecting OCR server " << backend->address << " for "
+              << backend->ejection.count() / 1000 << " s" << std::endl;
+}
+
+void OCRClient::healthLoop() {
+    std::unique_lock<std::mutex> lock(health_mutex_);
+    while (!stopping_) {
+        lock.unlock();
+        for (const auto& backend : backends_) {
+            grpc::ClientContext context;
+            context.set_deadline(std::chrono::system_clock::now() + kHealthTimeout);
+            grpc::health::v1::HealthCheckRequest request;
+            grpc::health::v1::HealthCheckResponse response;
+            grpc::Status status = backend->health->Check(&context, request, &response);
+
+            // A server without the health service is up if it answered at all
+            bool healthy = status.ok()
+                ? response.status() == grpc::health::v1::HealthCheckResponse::SERVING
+                : status.error_code() == grpc::StatusCode::UNIMPLEMENTED;
+            if (backend->healthy.exchange(healthy) != healthy) {
+                std::cerr << "OCR server " << backend->address
+                          << (healthy ? " is healthy again" : " failed its health check") << std::endl;
+            }
+        }
+        lock.lock();
+        health_cv_.wait_for(lock, kHealthInterval, [this] { return stopping_; });
+    }
+}
+
 bool OCRClient::processImage(const std::string& image_id,
                             const std::string& image_data,
                             const std::string& image_format,
                             std::string& extracted_text) {
-    // Check connection and reconnect if necessary
-    if (!isConnected()) {
-        reconnect();
-        if (!isConnected()) {
-            extracted_text = "Error: Cannot connect to server";
-            return false;
-        }
-    }
-
     ocr::ImageRequest request;
     request.set_image_id(image_id);
     request.set_image_data(image_data);
     request.set_image_format(image_format);
 
-    ocr::ImageResponse response;
-    grpc::ClientContext context;
+    // One deadline across every attempt
+    std::chrono::system_clock::time_point deadline =
+        std::chrono::system_clock::now() + kRequestTimeout;
 
-    // Set timeout
-    std::chrono::system_clock::time_point deadline = 
-        std::chrono::system_clock::now() + std::chrono::seconds(60);
-    context.set_deadline(deadline);
+    grpc::Status status(grpc::StatusCode::UNAVAILABLE, "No OCR server available");
+    const Backend* previous = nullptr;
+    for (int attempt = 0; attempt < kMaxAttempts; ++attempt) {
+        Backend* backend = pickBackend(previous);
+        if (!backend) {
+            break;
+        }
 
-    grpc::Status status = stub_->ProcessImage(&context, request, &response);
+        ocr::ImageResponse response;
+        grpc::ClientContext context;
+        context.set_deadline(deadline);
+        backend->outstanding.fetch_add(1);
+        status = backend->stub->ProcessImage(&context, request, &response);
+        backend->outstanding.fetch_sub(1);
 
-    if (status.ok()) {
-        extracted_text = response.extracted_text();
-        return response.success();
-    } else {
-        // Handle connection errors - attempt reconnect
-        if (status.error_code() == grpc::StatusCode::UNAVAILABLE ||
-            status.error_code() == grpc::StatusCode::DEADLINE_EXCEEDED) {
-            reconnect();
+        if (status.ok() && !retryable(response.error_code())) {
+            reportSuccess(backend);
+            extracted_text = response.success() ? response.extracted_text() : response.error_message();
+            return response.success();
+        }
+        if (status.ok()) {
+            status = grpc::Status(grpc::StatusCode::UNAVAILABLE, response.error_message());
+        } else if (status.error_code() == grpc::StatusCode::UNAVAILABLE) {
+            reportFailure(backend);
+        }
+        if (!retryable(status)) {
+            break;
+        }
+        previous = backend;
+    }
+
+    extracted_text = status.error_message();
+    return false;
+}
+
+bool OCRClient::uploadImage(const std::string& image_id,
+                            const char* image_data,
+                            size_t image_size,
+                            const std::string& image_format,
+                            std::string& extracted_text) {
+    ocr::UploadChunk header;
+    header.mutable_header()->set_image_id(image_id);
+    header.mutable_header()->set_image_format(image_format);
+    header.mutable_header()->set_total_size(image_size);
+    ocr::UploadChunk end;
+    end.mutable_end()->set_total_size(image_size);
+
+    // One deadline across every attempt
+    std::chrono::system_clock::time_point deadline =
+        std::chrono::system_clock::now() + kRequestTimeout;
+
+    grpc::Status status(grpc::StatusCode::UNAVAILABLE, "No OCR server available");
+    const Backend* previous = nullptr;
+    for (int attempt = 0; attempt < kMaxAttempts; ++attempt) {
+        Backend* backend = pickBackend(previous);
+        if (!backend) {
+            break;
+        }
+
+        ocr::ImageResponse response;
+        grpc::ClientContext context;
+        context.set_deadline(deadline);
+        backend->outstanding.fetch_add(1);
+        auto writer = backend->stub->ProcessImageUpload(&context, &response);
+        // A failed write ends the call; Finish reports why
+        bool open = writer->Write(header);
+        ocr::UploadChunk data;
+        for (size_t offset = 0; open && offset < image_size; offset += kUploadChunkSize) {
+            data.set_data(image_data + offset, std::min(kUploadChunkSize, image_size - offset));
+            open = writer->Write(data);
+        }
+        if (open && writer->Write(end)) {
+            writer->WritesDone();
         }
-        extracted_text = "Error: " + status.error_message();
+        status = writer->Finish();
+        backend->outstanding.fetch_sub(1);
+
+        if (status.ok() && !retryable(response.error_code())) {
+            reportSuccess(backend);
+            extracted_text = response.success() ? response.extracted_text() : response.error_message();
+            return response.success();
+        }
+        if (status.ok()) {
+            status = grpc::Status(grpc::StatusCode::UNAVAILABLE, response.error_message());
+        } else if (status.error_code() == grpc::StatusCode::UNAVAILABLE) {
+            reportFailure(backend);
+        }
+        if (!retryable(status)) {
+            break;
+        }
+        previous = backend;
+    }
+
+    extracted_text = status.error_message();
+    return false;
+}
+
+std::unique_ptr<OCRClient::ImageStream> OCRClient::openStream(size_t window, ResultCallback callback,
+                                                              PageCallback page_callback) {
+    return std::make_unique<ImageStream>(this, window, std::move(callback), std::move(page_callback));
+}
+
+OCRClient::ImageStream::ImageStream(OCRClient* client, size_t window, ResultCallback callback,
+                                    PageCallback page_callback)
+    : client_(client), callback_(std::move(callback)), page_callback_(std::move(page_callback)),
+      window_(window > 0 ? window : 1),
+      finished_(false), cancelled_(false)
+{
+}
+
+OCRClient::ImageStream::~ImageStream() {
+    finish();
+}
+
+bool OCRClient::ImageStream::send(const std::string& image_id,
+                                  const char* image_data,
+                                  size_t image_size,
+                                  const std::string& image_format) {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        window_cv_.wait(lock, [this] { return pending_.size() < window_ || cancelled_; });
+        if (cancelled_ || finished_) {
+            lock.unlock();
+            fail(image_id, "Stream to server is closed");
+            return false;
+        }
+    }
+
+    // The only copy of the bytes on the client: straight from the caller's
+    // buffer into the request message, which is kept until the image is
+    // answered in case it has to be resent to another server
+    auto request = std::make_shared<ocr::ImageRequest>();
+    request->set_image_id(image_id);
+    request->set_image_data(image_data, image_size);
+    request->set_image_format(image_format);
+
+    Backend* backend = client_->pickBackend();
+    Leg* leg = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (backend && !cancelled_) {
+            leg = legFor(backend);
+            pending_[image_id] = Pending{request, leg, 1};
+            backend->outstanding.fetch_add(1);
+        }
+    }
+    if (!leg) {
+        fail(image_id, backend ? "Stream to server is closed" : "No OCR server available");
         return false;
     }
+
+    write(leg, request);
+    return true;
+}
+
+OCRClient::ImageStream::Leg* OCRClient::ImageStream::legFor(Backend* backend) {
+    for (const auto& leg : legs_) {
+        if (leg->backend == backend && !leg->broken) {
+            return leg.get();
+        }
+    }
+    auto leg = std::make_unique<Leg>();
+    leg->backend = backend;
+    leg->stream = backend->stub->ProcessImageStream(&leg->context);
+    Leg* started = leg.get();
+    legs_.push_back(std::move(leg));
+    started->reader = std::thread(&ImageStream::readLoop, this, started);
+    return started;
+}
+
+void OCRClient::ImageStream::write(Leg* leg, const std::shared_ptr<const ocr::ImageRequest>& request) {
+    // A failed write means the call is broken; its reader then resends or
+    // fails everything that was pending on it
+    std::lock_guard<std::mutex> lock(leg->write_mutex);
+    if (!leg->closed) {
+        leg->stream->Write(*request);
+    }
 }
 
+void OCRClient::ImageStream::finish() {
+    std::vector<Leg*> legs;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (finished_) {
+            return;
+        }
+        finished_ = true;
+        // Resends need their calls open, so wait for every result first
+        window_cv_.wait(lock, [this] { return pending_.empty(); });
+        for (const auto& leg : legs_) {
+            legs.push_back(leg.get());
+        }
+    }
+    for (Leg* leg : legs) {
+        {
+            std::lock_guard<std::mutex> lock(leg->write_mutex);
+            if (!leg->closed) {
+                leg->stream->WritesDone();
+            }
+        }
+        if (leg->reader.joinable()) {
+            leg->reader.join();
+        }
+    }
+}
+
+void OCRClient::ImageStream::cancel() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cancelled_ = true;
+    for (const auto& leg : legs_) {
+        leg->context.TryCancel();
+    }
+    window_cv_.notify_all();
+}
+
+void OCRClient::ImageStream::readLoop(Leg* leg) {
+    ocr::ImageResponse response;
+    while (leg->stream->Read(&response)) {
+        Leg* retry = nullptr;
+        std::shared_ptr<const ocr::ImageRequest> request;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = pending_.find(response.image_id());
+            if (it == pending_.end() || it->second.leg != leg) {
+                continue;
+            }
+            if (!response.partial()) {
+                // The server could not take the image; another may
+                Backend* other = retryable(response.error_code()) && !cancelled_ &&
+                                 it->second.attempts < kMaxAttempts
+                    ? client_->pickBackend(leg->backend) : nullptr;
+                if (other) {
+                    it->second.leg = retry = legFor(other);
+                    ++it->second.attempts;
+                    other->outstanding.fetch_add(1);
+                    request = it->second.request;
+                } else {
+                    pending_.erase(it);
+                }
+            }
+        }
+        if (response.partial()) {
+            // A page of a document; the image is still in flight
+            if (page_callback_) {
+                page_callback_(response.image_id(), response.page_index(),
+                               response.page_count(), response.success());
+            }
+            continue;
+        }
+        leg->backend->outstanding.fetch_sub(1);
+        window_cv_.notify_all();
+        if (retry) {
+            write(retry, request);
+            continue;
+        }
+        client_->reportSuccess(leg->backend);
+        callback_(response.image_id(), response.extracted_text(),
+                  response.success(), response.error_message());
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(leg->write_mutex);
+        leg->closed = true;
+    }
+    grpc::Status status = leg->stream->Finish();
+
+    // Whatever was still pending on this call was lost with it: resend it
+    // to another server, or fail it once out of attempts
+    std::vector<std::pair<Leg*, std::shared_ptr<const ocr::ImageRequest>>> resend;
+    std::vector<std::string> failed;
+    bool lost = false;
+    bool cancelled = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        leg->broken = true;
+        cancelled = cancelled_;
+        for (auto& [image_id, pending] : pending_) {
+            if (pending.leg != leg) {
+                continue;
+            }
+            lost = true;
+            leg->backend->outstanding.fetch_sub(1);
+            Backend* other = cancelled || pending.attempts >= kMaxAttempts
+                ? nullptr : client_->pickBackend(leg->backend);
+            if (!other) {
+                failed.push_back(image_id);
+                continue;
+            }
+            pending.leg = legFor(other);
+            ++pending.attempts;
+            other->outstanding.fetch_add(1);
+            resend.emplace_back(pending.leg, pending.request);
+        }
+        for (const std::string& image_id : failed) {
+            pending_.erase(image_id);
+        }
+    }
+
+    if (!cancelled && (lost || !status.ok())) {
+        client_->reportFailure(leg->backend);
+    }
+    for (const auto& [target, request] : resend) {
+        write(target, request);
+    }
+    window_cv_.notify_all();
+
+    const std::string error = status.ok() ? "Server closed the stream" : status.error_message();
+    for (const std::string& image_id : failed) {
+        fail(image_id, error);
+    }
+}
+
+void OCRClient::ImageStream::fail(const std::string& image_id, const std::string& error) {
+    callback_(image_id, "", false, error);
+}
@@ -1,33 +1,179 @@
 #ifndef OCR_CLIENT_H
 #define OCR_CLIENT_H
 
+#include <atomic>
+#include <chrono>
 #include <string>
 #include <memory>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 #include <grpcpp/grpcpp.h>
 #include "ocr.grpc.pb.h"
+#include "health.grpc.pb.h"
 
+// Client for one or more OCR servers. Every request goes to the less busy
+// of two randomly chosen healthy servers (power of two choices on
+// outstanding requests). A background thread probes each server with the
+// gRPC health check; servers that fail it, or fail requests repeatedly,
+// are skipped until they recover, and requests they lose are retried on
+// another server.
 class OCRClient {
 public:
-    OCRClient(const std::string& server_address);
+    // Called from a stream reader thread for every result.
+    using ResultCallback = std::function<void(const std::string& image_id,
+                                              const std::string& extracted_text,
+                                              bool success,
+                                              const std::string& error)>;
+
+    // Called from a stream reader thread as each page of a multi-page
+    // document finishes, before the document's own result.
+    using PageCallback = std::function<void(const std::string& image_id,
+                                            uint32_t page_index,
+                                            uint32_t page_count,
+                                            bool success)>;
+
+    // Routing state for one server
+    struct Backend {
+        std::string address;
+        std::shared_ptr<grpc::Channel> channel;
+        std::unique_ptr<ocr::OCRService::Stub> stub;
+        std::unique_ptr<grpc::health::v1::Health::Stub> health;
+        std::atomic<int> outstanding{0};  // Requests sent and not yet answered
+        std::atomic<bool> healthy{true};  // Last health check passed
+        // Guarded by OCRClient::backend_mutex_
+        int failures = 0;                 // Consecutive failed requests
+        std::chrono::steady_clock::time_point ejected_until{};
+        std::chrono::milliseconds ejection{0};
+    };
+
+    // One batch of images streamed to the servers. Each server used gets
+    // its own ProcessImageStream call, opened when the first image is
+    // routed to it. send() blocks while `window` images are awaiting
+    // results; results arrive on background threads in completion order.
+    // send() must only be called from one thread.
+    class ImageStream {
+    public:
+        ImageStream(OCRClient* client, size_t window, ResultCallback callback,
+                    PageCallback page_callback = nullptr);
+        ~ImageStream();
+
+        ImageStream(const ImageStream&) = delete;
+        ImageStream& operator=(const ImageStream&) = delete;
+
+        // Returns false if the image could not be sent to any server; it
+        // is then reported through the callback as failed. `image_data`
+        // only needs to stay valid for the duration of the call (e.g. a
+        // mapped file). Images lost with a failed server are resent to
+        // another one.
+        bool send(const std::string& image_id,
+                  const char* image_data,
+                  size_t image_size,
+                  const std::string& image_format);
+
+        // Blocks until every result has arrived, then closes the calls.
+        void finish();
+
+        // Aborts every call; pending images are reported as failed. Safe
+        // to call from any thread.
+        void cancel();
+
+    private:
+        // One ProcessImageStream call to one server
+        struct Leg {
+            Backend* backend = nullptr;
+            grpc::ClientContext context;
+            std::unique_ptr<grpc::ClientReaderWriter<ocr::ImageRequest, ocr::ImageResponse>> stream;
+            std::mutex write_mutex;  // The sender and rerouting readers both write
+            bool closed = false;     // Guarded by write_mutex; no more writes once set
+            bool broken = false;     // Guarded by ImageStream::mutex_
+            std::thread reader;
+        };
+
+        struct Pending {
+            std::shared_ptr<const ocr::ImageRequest> request;  // Kept for resending
+            Leg* leg = nullptr;
+            int attempts = 1;
+        };
+
+        // Requires mutex_. The open call to `backend`, starting one if needed.
+        Leg* legFor(Backend* backend);
+        // Writes outside mutex_; a failed write shows up in the leg's reader.
+        void write(Leg* leg, const std::shared_ptr<const ocr::ImageRequest>& request);
+        void readLoop(Leg* leg);
+        void fail(const std::string& image_id, const std::string& error);
+
+        OCRClient* client_;
+        ResultCallback callback_;
+        PageCallback page_callback_;
+        size_t window_;
+
+        std::mutex mutex_;
+        std::condition_variable window_cv_;
+        std::unordered_map<std::string, Pending> pending_;
+        std::vector<std::unique_ptr<Leg>> legs_;
+        bool finished_;
+        bool cancelled_;
+    };
+
+    // `server_address` may list several servers separated by commas
+    explicit OCRClient(const std::string& server_address);
+    explicit OCRClient(const std::vector<std::string>& server_addresses);
     ~OCRClient();
 
-    // Process a single image (blocking)
+    OCRClient(const OCRClient&) = delete;
+    OCRClient& operator=(const OCRClient&) = delete;
+
+    // Process a single image (blocking), retrying on another server if
+    // the chosen one is down or overloaded. On failure `extracted_text`
+    // holds the reason instead.
     bool processImage(const std::string& image_id,
                      const std::string& image_data,
                      const std::string& image_format,
                      std::string& extracted_text);
 
-    // Check if client is connected
+    // Images above this size do not fit in one message under gRPC's
+    // default 4 MB limit and must be sent with uploadImage()
+    static constexpr size_t kUploadThreshold = 3 * 1024 * 1024;
+
+    // Process one image of any size (blocking), sent in chunks with
+    // ProcessImageUpload so neither side needs one message for all of it.
+    // `image_data` must stay valid until the call returns; it is resent
+    // from the start if another server has to be tried.
+    bool uploadImage(const std::string& image_id,
+                     const char* image_data,
+                     size_t image_size,
+                     const std::string& image_format,
+                     std::string& extracted_text);
+
+    // Open a streaming session with at most `window` images in flight.
+    // `page_callback`, if set, reports progress through multi-page images.
+    std::unique_ptr<ImageStream> openStream(size_t window, ResultCallback callback,
+                                            PageCallback page_callback = nullptr);
+
+    // Check if any server is reachable
     bool isConnected() const;
 
 private:
-    std::unique_ptr<ocr::OCRService::Stub> stub_;
-    std::shared_ptr<grpc::Channel> channel_;
-    std::string server_address_;
-    bool connected_;
+    // Power of two choices among usable servers other than `avoid`. Falls
+    // back to every server when none is usable; nullptr if there is none.
+    Backend* pickBackend(const Backend* avoid = nullptr);
+    void reportSuccess(Backend* backend);
+    // Ejects the server after repeated failures, for longer each time
+    void reportFailure(Backend* backend);
+    bool usable(const Backend* backend, std::chrono::steady_clock::time_point now) const;
+    void healthLoop();
 
-    void reconnect();
+    std::vector<std::unique_ptr<Backend>> backends_;
+    mutable std::mutex backend_mutex_;
+
+    std::mutex health_mutex_;
+    std::condition_variable health_cv_;
+    bool stopping_;
+    std::thread health_thread_;
 };
 
 #endif // OCR_CLIENT_H
-
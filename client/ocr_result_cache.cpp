@@ -0,0 +1,120 @@
+#include "ocr_result_cache.h"
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+
+OCRResultCache::OCRResultCache(const QString& directory, qint64 maxDiskBytes, qint64 maxMemoryBytes)
+    : memory_(maxMemoryBytes)
+    , directory_(directory)
+    , maxDiskBytes_(maxDiskBytes)
+    , diskBytes_(0)
+{
+    if (directory_.isEmpty()) {
+        return;
+    }
+    QDir().mkpath(directory_);
+    const QFileInfoList entries = QDir(directory_).entryInfoList(QDir::Files);
+    for (const QFileInfo& entry : entries) {
+        diskBytes_ += entry.size();
+    }
+    trimDisk();
+}
+
+QByteArray OCRResultCache::makeKey(const char* data, qint64 size) {
+    // The format name is left out: the server goes by the bytes, so a.png
+    // and a copy named a.PNG get the same result
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(QByteArray::fromRawData(data, static_cast<qsizetype>(size)));
+    return hash.result().toHex();
+}
+
+OCRResultCache::Lookup OCRResultCache::begin(const QByteArray& key, const QString& imageId, QString* text) {
+    QMutexLocker locker(&mutex_);
+
+    if (QString* cached = memory_.object(key)) {
+        *text = *cached;
+        return Lookup::Hit;
+    }
+    if (loadFromDisk(key, text)) {
+        memory_.insert(key, new QString(*text), text->size() * 2);
+        return Lookup::Hit;
+    }
+
+    auto pending = inFlight_.find(key);
+    if (pending != inFlight_.end()) {
+        pending->append(imageId);
+        return Lookup::Joined;
+    }
+
+    inFlight_.insert(key, QStringList());
+    leaders_.insert(imageId, key);
+    return Lookup::Leader;
+}
+
+QStringList OCRResultCache::finish(const QString& imageId, const QString& text, bool success) {
+    QMutexLocker locker(&mutex_);
+
+    auto leader = leaders_.find(imageId);
+    if (leader == leaders_.end()) {
+        return QStringList();
+    }
+    QByteArray key = leader.value();
+    leaders_.erase(leader);
+    QStringList joined = inFlight_.take(key);
+
+    if (success) {
+        memory_.insert(key, new QString(text), text.size() * 2);
+        store(key, text);
+    }
+    return joined;
+}
+
+bool OCRResultCache::loadFromDisk(const QByteArray& key, QString* text) {
+    if (directory_.isEmpty()) {
+        return false;
+    }
+    QFile file(directory_ + "/" + QString::fromLatin1(key));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    *text = QString::fromUtf8(file.readAll());
+    // Touch the entry so trimDisk() evicts least recently used results first
+    file.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+    return true;
+}
+
+void OCRResultCache::store(const QByteArray& key, const QString& text) {
+    if (directory_.isEmpty()) {
+        return;
+    }
+    QFile file(directory_ + "/" + QString::fromLatin1(key));
+    qint64 previous = file.exists() ? file.size() : 0;
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return;
+    }
+    QByteArray utf8 = text.toUtf8();
+    file.write(utf8);
+    file.close();
+    diskBytes_ += utf8.size() - previous;
+    trimDisk();
+}
+
+void OCRResultCache::trimDisk() {
+    if (diskBytes_ <= maxDiskBytes_) {
+        return;
+    }
+    // Oldest first
+    const QFileInfoList entries = QDir(directory_).entryInfoList(
+        QDir::Files, QDir::Time | QDir::Reversed);
+    for (const QFileInfo& entry : entries) {
+        if (diskBytes_ <= maxDiskBytes_) {
+            break;
+        }
+        if (QFile::remove(entry.absoluteFilePath())) {
+            diskBytes_ -= entry.size();
+        }
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef OCR_RESULT_CACHE_H
+#define OCR_RESULT_CACHE_H
+
+#include <QByteArray>
+#include <QCache>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+
+// Client-side memo of OCR results keyed by a hash of the file content.
+// Repeated uploads are answered without touching the network, both within
+// a batch (duplicates join the first copy still in flight) and across
+// batches (results stay in memory and in a size-bounded on-disk store).
+// Thread-safe: used from the worker thread and the stream's reader thread.
+class OCRResultCache {
+public:
+    enum class Lookup {
+        Hit,     // Text returned immediately
+        Joined,  // Same content in flight; answered by finish()
+        Leader,  // Caller must send the image and call finish()
+    };
+
+    // `directory` holds one file per result; an empty path disables the
+    // on-disk store.
+    OCRResultCache(const QString& directory, qint64 maxDiskBytes, qint64 maxMemoryBytes);
+
+    static QByteArray makeKey(const char* data, qint64 size);
+
+    Lookup begin(const QByteArray& key, const QString& imageId, QString* text);
+
+    // Completes the in-flight image `imageId`. Returns the ids of images
+    // that joined it, which receive the same result. Only successful
+    // results are remembered.
+    QStringList finish(const QString& imageId, const QString& text, bool success);
+
+private:
+    void store(const QByteArray& key, const QString& text);
+    bool loadFromDisk(const QByteArray& key, QString* text);
+    void trimDisk();
+
+    QMutex mutex_;
+    QCache<QByteArray, QString> memory_;       // Cost is text size in bytes
+    QHash<QByteArray, QStringList> inFlight_;  // key -> joined image ids
+    QHash<QString, QByteArray> leaders_;       // leader image id -> key
+    QString directory_;
+    qint64 maxDiskBytes_;
+    qint64 diskBytes_;
+};
+
+#endif // OCR_RESULT_CACHE_H
@@ -0,0 +1,741 @@
+#include "async_server.h"
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <grpcpp/alarm.h>
+
+#include "batch.h"
+#include "metrics.h"
+#include "scheduling.h"
+#include "stream_session.h"
+
+using grpc::ServerAsyncReader;
+using grpc::ServerAsyncReaderWriter;
+using grpc::ServerAsyncResponseWriter;
+using grpc::ServerAsyncWriter;
+using grpc::ServerCompletionQueue;
+using grpc::ServerContext;
+using grpc::Status;
+using ocr::ImageRequest;
+using ocr::ImageResponse;
+
+namespace {
+
+// Outstanding accepts per method and completion queue
+constexpr int kCallsPerQueue = 4;
+// How long a streamed image waits before retrying a full compute queue
+constexpr auto kQueueFullRetry = std::chrono::milliseconds(5);
+
+class AsyncCall;
+
+// Completion-queue tag: which call an event belongs to and which of its
+// operations finished.
+struct CallTag {
+    enum Event { kConnect, kRead, kWrite, kFinish, kRetry, kDone };
+    AsyncCall* call;
+    Event event;
+};
+
+class AsyncCall {
+public:
+    virtual ~AsyncCall() = default;
+    virtual void proceed(CallTag::Event event, bool ok) = 0;
+};
+
+// Images a written response finishes: none for a single page of a
+// document, whose image stays in flight until its final response
+size_t answered(const ImageResponse& response) {
+    return response.partial() ? 0 : 1;
+}
+
+ProcessingTask takeTask(ImageRequest& request, const ServerContext& context) {
+    ProcessingTask task;
+    applySchedule(task, request, context);
+    task.image_id = std::move(*request.mutable_image_id());
+    task.image_data = ImagePayload(std::move(*request.mutable_image_data()));
+    task.image_format = std::move(*request.mutable_image_format());
+    task.output = request.output();
+    task.config = request.config();
+    return task;
+}
+
+// Unary ProcessImage: accept, hand the image to the compute pool, and
+// finish from the worker thread. A full queue is rejected immediately so
+// the I/O thread never blocks. If the client cancels or disconnects first,
+// the done notification marks the task so the worker drops or interrupts it.
+class UnaryCall final : public AsyncCall, public std::enable_shared_from_this<UnaryCall> {
+public:
+    static void start(ocr::OCRService::AsyncService* service, ServerCompletionQueue* cq,
+                      OCRDispatcher* dispatcher) {
+        std::shared_ptr<UnaryCall> call(new UnaryCall(service, cq, dispatcher));
+        call->self_ = call;
+        call->ctx_.AsyncNotifyWhenDone(&call->done_tag_);
+        service->RequestProcessImage(&call->ctx_, &call->request_, &call->responder_,
+                                     cq, cq, &call->connect_tag_);
+    }
+
+    void proceed(CallTag::Event event, bool ok) override {
+        switch (event) {
+        case CallTag::kConnect:
+            if (!ok) {
+                // Shutting down; a call that never started gets no done event
+                std::shared_ptr<UnaryCall> keep = std::move(self_);
+                return;
+            }
+            // Replace ourselves as the pending accept before doing any work
+            start(service_, cq_, dispatcher_);
+            submit();
+            return;
+        case CallTag::kDone:
+            // IsCancelled() is only safe once this event has arrived
+            cancelled_ = ctx_.IsCancelled();
+            done_ = true;
+            break;
+        default:
+            finished_ = true;
+            break;
+        }
+
+        // Both the Finish and the done event hold a reference to this call
+        if (done_ && finished_) {
+            std::shared_ptr<UnaryCall> keep = std::move(self_);
+        }
+    }
+
+private:
+    UnaryCall(ocr::OCRService::AsyncService* service, ServerCompletionQueue* cq,
+              OCRDispatcher* dispatcher)
+        : service_(service), cq_(cq), dispatcher_(dispatcher), responder_(&ctx_),
+          connect_tag_{this, CallTag::kConnect}, finish_tag_{this, CallTag::kFinish},
+          done_tag_{this, CallTag::kDone} {}
+
+    void submit() {
+        ProcessingTask task = takeTask(request_, ctx_);
+        std::shared_ptr<UnaryCall> self = shared_from_this();
+        task.on_complete = [self](ImageResponse response) {
+            self->response_ = std::move(response);
+            self->responder_.Finish(self->response_, Status::OK, &self->finish_tag_);
+        };
+        task.is_cancelled = [self] { return self->cancelled_.load(std::memory_order_relaxed); };
+        if (!dispatcher_->trySubmit(task)) {
+            responder_.FinishWithError(
+                Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "OCR queue is full"),
+                &finish_tag_);
+        }
+    }
+
+    ocr::OCRService::AsyncService* service_;
+    ServerCompletionQueue* cq_;
+    OCRDispatcher* dispatcher_;
+    ServerContext ctx_;
+    ImageRequest request_;
+    ImageResponse response_;
+    ServerAsyncResponseWriter<ImageResponse> responder_;
+    CallTag connect_tag_;
+    CallTag finish_tag_;
+    CallTag done_tag_;
+    std::atomic<bool> cancelled_{false};  // Read by workers
+    bool finished_ = false;
+    bool done_ = false;
+    std::shared_ptr<UnaryCall> self_;  // Held while gRPC owns a tag
+};
+
+// Unary GetStats: answered on the I/O thread, since collecting a snapshot
+// only reads counters.
+class StatsCall final : public AsyncCall {
+public:
+    static void start(ocr::OCRService::AsyncService* service, ServerCompletionQueue* cq,
+                      OCRDispatcher* dispatcher) {
+        StatsCall* call = new StatsCall(service, cq, dispatcher);
+        service->RequestGetStats(&call->ctx_, &call->request_, &call->responder_, cq, cq,
+                                 &call->connect_tag_);
+    }
+
+    void proceed(CallTag::Event event, bool ok) override {
+        if (event == CallTag::kConnect && ok) {
+            start(service_, cq_, dispatcher_);
+            response_ = collectStats(*dispatcher_);
+            responder_.Finish(response_, Status::OK, &finish_tag_);
+            return;
+        }
+        delete this;
+    }
+
+private:
+    StatsCall(ocr::OCRService::AsyncService* service, ServerCompletionQueue* cq,
+              OCRDispatcher* dispatcher)
+        : service_(service), cq_(cq), dispatcher_(dispatcher), responder_(&ctx_),
+          connect_tag_{this, CallTag::kConnect}, finish_tag_{this, CallTag::kFinish} {}
+
+    ocr::OCRService::AsyncService* service_;
+    ServerCompletionQueue* cq_;
+    OCRDispatcher* dispatcher_;
+    ServerContext ctx_;
+    ocr::StatsRequest request_;
+    ocr::StatsResponse response_;
+    ServerAsyncResponseWriter<ocr::StatsResponse> responder_;
+    CallTag connect_tag_;
+    CallTag finish_tag_;
+};
+
+// Bidirectional ProcessImageStream. One Read and one Write are outstanding
+// at most; reads stop while the stream's window is full, and the call is
+// finished only after every image read has been written back. Once the
+// client is gone (failed write or cancelled call) its queued images are
+// dropped and running ones interrupted.
+class StreamCall final : public AsyncCall, public std::enable_shared_from_this<StreamCall> {
+public:
+    static void start(ocr::OCRService::AsyncService* service, ServerCompletionQueue* cq,
+                      OCRDispatcher* dispatcher) {
+        std::shared_ptr<StreamCall> call(new StreamCall(service, cq, dispatcher));
+        call->self_ = call;
+        call->ctx_.AsyncNotifyWhenDone(&call->done_tag_);
+        service->RequestProcessImageStream(&call->ctx_, &call->stream_, cq, cq,
+                                           &call->connect_tag_);
+    }
+
+    void proceed(CallTag::Event event, bool ok) override {
+        std::unique_lock<std::mutex> lock(mutex_);
+        switch (event) {
+        case CallTag::kConnect:
+            if (!ok) {
+                lock.unlock();
+                std::shared_ptr<StreamCall> keep = std::move(self_);
+                return;
+            }
+            start(service_, cq_, dispatcher_);
+            serverMetrics().active_streams.fetch_add(1);
+            break;
+        case CallTag::kRead:
+            reading_ = false;
+            if (!ok) {
+                reads_done_ = true;
+                break;
+            }
+            serverMetrics().record(ServerMetrics::kReceive, nanosSince(read_started_));
+            ++in_flight_;
+            pending_ = takeTask(request_, ctx_);
+            pending_.page_results = true;
+            has_pending_ = true;
+            submitPending();
+            break;
+        case CallTag::kRetry:
+            retrying_ = false;
+            if (!ok || cancelled_) {
+                // Alarm cancelled by shutdown, or the client is gone; drop the image
+                has_pending_ = false;
+                pending_ = ProcessingTask();
+                --in_flight_;
+                reads_done_ = true;
+                break;
+            }
+            submitPending();
+            break;
+        case CallTag::kWrite:
+            serverMetrics().record(ServerMetrics::kWrite, nanosSince(write_started_));
+            writing_ = false;
+            in_flight_ -= answered(current_write_);
+            if (!ok) {
+                write_failed_ = true;
+                cancelled_ = true;
+            }
+            break;
+        case CallTag::kFinish:
+            serverMetrics().active_streams.fetch_sub(1);
+            finished_ = true;
+            break;
+        case CallTag::kDone:
+            // IsCancelled() is only safe once this event has arrived
+            if (ctx_.IsCancelled()) {
+                cancelled_ = true;
+            }
+            done_ = true;
+            break;
+        }
+
+        // Both the Finish and the done event hold a reference to this call
+        if (finished_ && done_) {
+            lock.unlock();
+            std::shared_ptr<StreamCall> keep = std::move(self_);
+            return;
+        }
+        advance();
+    }
+
+    // Called on a worker thread; only queues the response and, if the
+    // stream is idle, starts the async write.
+    void onResult(ImageResponse response) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        outbox_.push_back(std::move(response));
+        advance();
+    }
+
+private:
+    StreamCall(ocr::OCRService::AsyncService* service, ServerCompletionQueue* cq,
+               OCRDispatcher* dispatcher)
+        : service_(service), cq_(cq), dispatcher_(dispatcher), stream_(&ctx_),
+          connect_tag_{this, CallTag::kConnect}, read_tag_{this, CallTag::kRead},
+          write_tag_{this, CallTag::kWrite}, finish_tag_{this, CallTag::kFinish},
+          retry_tag_{this, CallTag::kRetry}, done_tag_{this, CallTag::kDone} {}
+
+    // Requires mutex_. Tries to queue the image just read; if the compute
+    // queue is full, retries on an alarm instead of blocking the I/O thread.
+    void submitPending() {
+        std::shared_ptr<StreamCall> self = shared_from_this();
+        pending_.on_complete = [self](ImageResponse response) {
+            self->onResult(std::move(response));
+        };
+        pending_.is_cancelled = [self] { return self->cancelled_.load(std::memory_order_relaxed); };
+        if (dispatcher_->trySubmit(pending_)) {
+            has_pending_ = false;
+            return;
+        }
+        retrying_ = true;
+        retry_alarm_.Set(cq_, std::chrono::system_clock::now() + kQueueFullRetry, &retry_tag_);
+    }
+
+    // Requires mutex_. Starts whichever operations the current state allows.
+    void advance() {
+        if (!writing_ && !outbox_.empty()) {
+            if (write_failed_) {
+                // Client is gone; drop results so the call can finish
+                for (const ImageResponse& response : outbox_) {
+                    in_flight_ -= answered(response);
+                }
+                outbox_.clear();
+            } else {
+                writing_ = true;
+                current_write_ = std::move(outbox_.front());
+                outbox_.pop_front();
+                write_started_ = std::chrono::steady_clock::now();
+                stream_.Write(current_write_, &write_tag_);
+            }
+        }
+
+        if (!reads_done_ && !reading_ && !has_pending_ && in_flight_ < kDefaultStreamWindow) {
+            reading_ = true;
+            read_started_ = std::chrono::steady_clock::now();
+            stream_.Read(&request_, &read_tag_);
+        }
+
+        if (reads_done_ && !reading_ && !writing_ && in_flight_ == 0 && !finishing_) {
+            finishing_ = true;
+            stream_.Finish(Status::OK, &finish_tag_);
+        }
+    }
+
+    ocr::OCRService::AsyncService* service_;
+    ServerCompletionQueue* cq_;
+    OCRDispatcher* dispatcher_;
+    ServerContext ctx_;
+    ServerAsyncReaderWriter<ImageResponse, ImageRequest> stream_;
+    CallTag connect_tag_;
+    CallTag read_tag_;
+    CallTag write_tag_;
+    CallTag finish_tag_;
+    CallTag retry_tag_;
+    CallTag done_tag_;
+    grpc::Alarm retry_alarm_;
+
+    std::mutex mutex_;
+    ImageRequest request_;
+    ProcessingTask pending_;             // Read but not yet accepted by the dispatcher
+    std::deque<ImageResponse> outbox_;   // Finished, waiting for the writer
+    ImageResponse current_write_;
+    std::chrono::steady_clock::time_point read_started_;
+    std::chrono::steady_clock::time_point write_started_;
+    size_t in_flight_ = 0;               // Images read but not yet written
+    bool reading_ = false;
+    bool reads_done_ = false;
+    bool has_pending_ = false;
+    bool retrying_ = false;
+    bool writing_ = false;
+    bool write_failed_ = false;
+    bool finishing_ = false;
+    bool finished_ = false;
+    bool done_ = false;
+    std::atomic<bool> cancelled_{false};  // Read by workers
+    std::shared_ptr<StreamCall> self_;  // Held until Finish and the done event arrive
+};
+
+// Server-streaming ProcessBatch. The request arrives whole; its images are
+// queued from one shared copy of the packed buffer as the window allows,
+// and each write carries every result finished since the previous one.
+class BatchCall final : public AsyncCall, public std::enable_shared_from_this<BatchCall> {
+public:
+    static void start(ocr::OCRService::AsyncService* service, ServerCompletionQueue* cq,
+                      OCRDispatcher* dispatcher) {
+        std::shared_ptr<BatchCall> call(new BatchCall(service, cq, dispatcher));
+        call->self_ = call;
+        call->ctx_.AsyncNotifyWhenDone(&call->done_tag_);
+        service->RequestProcessBatch(&call->ctx_, &call->request_, &call->writer_, cq, cq,
+                                     &call->connect_tag_);
+    }
+
+    void proceed(CallTag::Event event, bool ok) override {
+        std::unique_lock<std::mutex> lock(mutex_);
+        switch (event) {
+        case CallTag::kConnect:
+            if (!ok) {
+                lock.unlock();
+                std::shared_ptr<BatchCall> keep = std::move(self_);
+                return;
+            }
+            start(service_, cq_, dispatcher_);
+            accept();
+            break;
+        case CallTag::kRetry:
+            retrying_ = false;
+            if (!ok || cancelled_) {
+                // Alarm cancelled by shutdown, or the client is gone; queue nothing more
+                has_pending_ = false;
+                pending_ = ProcessingTask();
+                next_ = offsets_.size();
+            }
+            break;
+        case CallTag::kWrite:
+            serverMetrics().record(ServerMetrics::kWrite, nanosSince(write_started_));
+            writing_ = false;
+            for (const ImageResponse& response : current_write_.results()) {
+                in_flight_ -= answered(response);
+            }
+            if (!ok) {
+                write_failed_ = true;
+                cancelled_ = true;
+            }
+            break;
+        case CallTag::kDone:
+            // IsCancelled() is only safe once this event has arrived
+            if (ctx_.IsCancelled()) {
+                cancelled_ = true;
+            }
+            done_ = true;
+            break;
+        default:
+            finished_ = true;
+            break;
+        }
+
+        // Both the Finish and the done event hold a reference to this call
+        if (finished_ && done_) {
+            lock.unlock();
+            std::shared_ptr<BatchCall> keep = std::move(self_);
+            return;
+        }
+        advance();
+    }
+
+    // Called on a worker thread; only queues the response and, if the
+    // call is idle, starts the async write.
+    void onResult(ImageResponse response) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        outbox_.push_back(std::move(response));
+        advance();
+    }
+
+private:
+    BatchCall(ocr::OCRService::AsyncService* service, ServerCompletionQueue* cq,
+              OCRDispatcher* dispatcher)
+        : service_(service), cq_(cq), dispatcher_(dispatcher), writer_(&ctx_),
+          connect_tag_{this, CallTag::kConnect}, write_tag_{this, CallTag::kWrite},
+          finish_tag_{this, CallTag::kFinish}, retry_tag_{this, CallTag::kRetry},
+          done_tag_{this, CallTag::kDone} {}
+
+    // Requires mutex_. Checks the framing and takes the packed buffer over
+    // from the request, which keeps only the per-image metadata.
+    void accept() {
+        std::string error;
+        offsets_ = batchOffsets(request_, error);
+        if (!error.empty()) {
+            finishing_ = true;
+            writer_.Finish(Status(grpc::StatusCode::INVALID_ARGUMENT, error), &finish_tag_);
+            return;
+        }
+        packed_ = std::make_shared<const std::string>(std::move(*request_.mutable_packed()));
+        schedule_.reset(new BatchSchedule(request_, ctx_));
+    }
+
+    // Requires mutex_. Queues images while the window has room; if the
+    // compute queue is full, retries on an alarm instead of blocking the
+    // I/O thread.
+    void submitMore() {
+        std::shared_ptr<BatchCall> self = shared_from_this();
+        while ((has_pending_ || next_ < offsets_.size()) && in_flight_ < kDefaultStreamWindow) {
+            if (cancelled_) {
+                has_pending_ = false;
+                pending_ = ProcessingTask();
+                next_ = offsets_.size();
+                return;
+            }
+            if (!has_pending_) {
+                pending_ = batchTask(request_, packed_, offsets_, next_++, *schedule_);
+                pending_.on_complete = [self](ImageResponse response) {
+                    self->onResult(std::move(response));
+                };
+                pending_.is_cancelled = [self] {
+                    return self->cancelled_.load(std::memory_order_relaxed);
+                };
+                has_pending_ = true;
+            }
+            if (!dispatcher_->trySubmit(pending_)) {
+                retrying_ = true;
+                retry_alarm_.Set(cq_, std::chrono::system_clock::now() + kQueueFullRetry,
+                                 &retry_tag_);
+                return;
+            }
+            has_pending_ = false;
+            ++in_flight_;
+        }
+    }
+
+    // Requires mutex_. Starts whichever operations the current state allows.
+    void advance() {
+        if (finishing_) {
+            return;
+        }
+
+        if (!writing_ && !outbox_.empty()) {
+            if (write_failed_) {
+                // Client is gone; drop results so the call can finish
+                for (const ImageResponse& response : outbox_) {
+                    in_flight_ -= answered(response);
+                }
+                outbox_.clear();
+            } else {
+                writing_ = true;
+                current_write_.Clear();
+                while (!outbox_.empty() &&
+                       static_cast<size_t>(current_write_.results_size()) < kMaxBatchResults) {
+                    *current_write_.add_results() = std::move(outbox_.front());
+                    outbox_.pop_front();
+                }
+                write_started_ = std::chrono::steady_clock::now();
+                writer_.Write(current_write_, &write_tag_);
+            }
+        }
+
+        if (!retrying_) {
+            submitMore();
+        }
+
+        bool submitted = !has_pending_ && next_ == offsets_.size();
+        if (submitted && !retrying_ && !writing_ && in_flight_ == 0) {
+            finishing_ = true;
+            writer_.Finish(Status::OK, &finish_tag_);
+        }
+    }
+
+    ocr::OCRService::AsyncService* service_;
+    ServerCompletionQueue* cq_;
+    OCRDispatcher* dispatcher_;
+    ServerContext ctx_;
+    ocr::BatchRequest request_;  // Metadata only once the packed buffer is taken
+    ServerAsyncWriter<ocr::BatchResponse> writer_;
+    CallTag connect_tag_;
+    CallTag write_tag_;
+    CallTag finish_tag_;
+    CallTag retry_tag_;
+    CallTag done_tag_;
+    grpc::Alarm retry_alarm_;
+
+    std::mutex mutex_;
+    std::shared_ptr<const std::string> packed_;  // Shared by every queued image
+    std::vector<size_t> offsets_;
+    std::unique_ptr<BatchSchedule> schedule_;
+    size_t next_ = 0;                    // Next image to queue
+    ProcessingTask pending_;             // Built but not yet accepted by the dispatcher
+    std::deque<ImageResponse> outbox_;   // Finished, waiting for the writer
+    ocr::BatchResponse current_write_;
+    std::chrono::steady_clock::time_point write_started_;
+    size_t in_flight_ = 0;               // Images queued but not yet written
+    bool has_pending_ = false;
+    bool retrying_ = false;
+    bool writing_ = false;
+    bool write_failed_ = false;
+    bool finishing_ = false;
+    bool finished_ = false;
+    bool done_ = false;
+    std::atomic<bool> cancelled_{false};  // Read by workers
+    std::shared_ptr<BatchCall> self_;  // Held until Finish and the done event arrive
+};
+
+// Client-streaming ProcessImageUpload. Chunks are read one at a time into
+// an UploadSpool (spooling to disk happens on the I/O thread); once the end
+// marker arrives the image is queued like a unary call, retrying a full
+// queue on an alarm, and the call finishes from the worker thread.
+class UploadCall final : public AsyncCall, public std::enable_shared_from_this<UploadCall> {
+public:
+    static void start(ocr::OCRService::AsyncService* service, ServerCompletionQueue* cq,
+                      OCRDispatcher* dispatcher, const UploadLimits* limits) {
+        std::shared_ptr<UploadCall> call(new UploadCall(service, cq, dispatcher, limits));
+        call->self_ = call;
+        call->ctx_.AsyncNotifyWhenDone(&call->done_tag_);
+        service->RequestProcessImageUpload(&call->ctx_, &call->reader_, cq, cq,
+                                           &call->connect_tag_);
+    }
+
+    void proceed(CallTag::Event event, bool ok) override {
+        switch (event) {
+        case CallTag::kConnect:
+            if (!ok) {
+                std::shared_ptr<UploadCall> keep = std::move(self_);
+                return;
+            }
+            start(service_, cq_, dispatcher_, limits_);
+            reader_.Read(&chunk_, &read_tag_);
+            return;
+        case CallTag::kRead:
+            read(ok);
+            return;
+        case CallTag::kRetry:
+            if (!ok || cancelled_) {
+                reader_.FinishWithError(Status(grpc::StatusCode::CANCELLED, "Request cancelled"),
+                                        &finish_tag_);
+            } else {
+                submit();
+            }
+            return;
+        case CallTag::kDone:
+            // IsCancelled() is only safe once this event has arrived
+            cancelled_ = ctx_.IsCancelled();
+            done_ = true;
+            break;
+        default:
+            finished_ = true;
+            break;
+        }
+
+        // Both the Finish and the done event hold a reference to this call
+        if (done_ && finished_) {
+            std::shared_ptr<UploadCall> keep = std::move(self_);
+        }
+    }
+
+private:
+    UploadCall(ocr::OCRService::AsyncService* service, ServerCompletionQueue* cq,
+               OCRDispatcher* dispatcher, const UploadLimits* limits)
+        : service_(service), cq_(cq), dispatcher_(dispatcher), limits_(limits),
+          spool_(*limits), reader_(&ctx_),
+          connect_tag_{this, CallTag::kConnect}, read_tag_{this, CallTag::kRead},
+          finish_tag_{this, CallTag::kFinish}, retry_tag_{this, CallTag::kRetry},
+          done_tag_{this, CallTag::kDone} {}
+
+    void read(bool ok) {
+        std::string error;
+        if (!ok) {
+            reader_.FinishWithError(
+                Status(grpc::StatusCode::INVALID_ARGUMENT, "Upload ended without an end marker"),
+                &finish_tag_);
+        } else if (!spool_.add(chunk_, error)) {
+            reader_.FinishWithError(Status(grpc::StatusCode::INVALID_ARGUMENT, error), &finish_tag_);
+        } else if (!spool_.complete()) {
+            reader_.Read(&chunk_, &read_tag_);
+        } else {
+            task_ = uploadTask(spool_, ctx_, error);
+            if (!error.empty()) {
+                reader_.FinishWithError(Status(grpc::StatusCode::INTERNAL, error), &finish_tag_);
+                return;
+            }
+            std::shared_ptr<UploadCall> self = shared_from_this();
+            task_.on_complete = [self](ImageResponse response) {
+                self->response_ = std::move(response);
+                self->reader_.Finish(self->response_, Status::OK, &self->finish_tag_);
+            };
+            task_.is_cancelled = [self] { return self->cancelled_.load(std::memory_order_relaxed); };
+            submit();
+        }
+    }
+
+    void submit() {
+        if (!dispatcher_->trySubmit(task_)) {
+            retry_alarm_.Set(cq_, std::chrono::system_clock::now() + kQueueFullRetry, &retry_tag_);
+        }
+    }
+
+    ocr::OCRService::AsyncService* service_;
+    ServerCompletionQueue* cq_;
+    OCRDispatcher* dispatcher_;
+    const UploadLimits* limits_;
+    ServerContext ctx_;
+    ocr::UploadChunk chunk_;
+    UploadSpool spool_;
+    ProcessingTask task_;  // Built once the upload is complete
+    ImageResponse response_;
+    ServerAsyncReader<ImageResponse, ocr::UploadChunk> reader_;
+    CallTag connect_tag_;
+    CallTag read_tag_;
+    CallTag finish_tag_;
+    CallTag retry_tag_;
+    CallTag done_tag_;
+    grpc::Alarm retry_alarm_;
+    std::atomic<bool> cancelled_{false};  // Read by workers
+    bool finished_ = false;
+    bool done_ = false;
+    std::shared_ptr<UploadCall> self_;  // Held while gRPC owns a tag
+};
+
+} // namespace
+
+AsyncOCRServer::AsyncOCRServer(OCRDispatcher& dispatcher, int io_threads,
+                               const UploadLimits& upload_limits)
+    : dispatcher_(dispatcher), io_threads_(io_threads > 0 ? io_threads : 1),
+      upload_limits_(upload_limits) {}
+
+AsyncOCRServer::~AsyncOCRServer() {
+    shutdown();
+    for (auto& thread : threads_) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+}
+
+void AsyncOCRServer::run(const std::string& server_address) {
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
+    builder.RegisterService(&service_);
+    for (int i = 0; i < io_threads_; ++i) {
+        cqs_.push_back(builder.AddCompletionQueue());
+    }
+    server_ = builder.BuildAndStart();
+    if (!server_) {
+        std::cerr << "Failed to start async server on " << server_address << std::endl;
+        return;
+    }
+
+    for (auto& cq : cqs_) {
+        for (int i = 0; i < kCallsPerQueue; ++i) {
+            UnaryCall::start(&service_, cq.get(), &dispatcher_);
+            StreamCall::start(&service_, cq.get(), &dispatcher_);
+            BatchCall::start(&service_, cq.get(), &dispatcher_);
+            UploadCall::start(&service_, cq.get(), &dispatcher_, &upload_limits_);
+        }
+        StatsCall::start(&service_, cq.get(), &dispatcher_);
+        threads_.emplace_back(&AsyncOCRServer::ioThread, this, cq.get());
+    }
+
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+void AsyncOCRServer::shutdown() {
+    if (server_) {
+        server_->Shutdown();
+        for (auto& cq : cqs_) {
+            cq->Shutdown();
+        }
+        server_.reset();
+    }
+}
+
+void AsyncOCRServer::ioThread(grpc::ServerCompletionQueue* cq) {
+    void* tag = nullptr;
+    bool ok = false;
+    while (cq->Next(&tag, &ok)) {
+        CallTag* call_tag = static_cast<CallTag*>(tag);
+        call_tag->call->proceed(call_tag->event, ok);
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef ASYNC_SERVER_H
+#define ASYNC_SERVER_H
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <grpcpp/grpcpp.h>
+
+#include "ocr.grpc.pb.h"
+#include "ocr_dispatcher.h"
+#include "upload_spool.h"
+
+// Completion-queue based server engine. A small, fixed set of I/O threads
+// drives every RPC as a state machine and never runs OCR itself: decode and
+// recognition are handed to the shared OCRDispatcher, whose workers post
+// results back by starting the next async write. Selected with --async.
+class AsyncOCRServer {
+public:
+    AsyncOCRServer(OCRDispatcher& dispatcher, int io_threads,
+                   const UploadLimits& upload_limits = UploadLimits());
+    ~AsyncOCRServer();
+
+    AsyncOCRServer(const AsyncOCRServer&) = delete;
+    AsyncOCRServer& operator=(const AsyncOCRServer&) = delete;
+
+    // Starts listening and blocks until the server shuts down.
+    void run(const std::string& server_address);
+
+    // Stops accepting calls and lets the I/O threads drain their queues.
+    void shutdown();
+
+private:
+    void ioThread(grpc::ServerCompletionQueue* cq);
+
+    OCRDispatcher& dispatcher_;
+    int io_threads_;
+    UploadLimits upload_limits_;
+    ocr::OCRService::AsyncService service_;
+    std::unique_ptr<grpc::Server> server_;
+    std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> cqs_;
+    std::vector<std::thread> threads_;
+};
+
+#endif // ASYNC_SERVER_H
@@ -0,0 +1,102 @@
+#include "band_splitter.h"
+#include <algorithm>
+#include <opencv2/imgproc.hpp>
+
+namespace {
+
+// Ink per row: the sum of (255 - gray) across the row
+std::vector<double> rowInk(const cv::Mat& image) {
+    cv::Mat gray = image;
+    if (image.channels() == 3) {
+        cv::cvtColor(image, gray, cv::COLOR_RGB2GRAY);
+    }
+    cv::Mat inverted;
+    cv::bitwise_not(gray, inverted);
+    cv::Mat sums;
+    cv::reduce(inverted, sums, 1, cv::REDUCE_SUM, CV_64F);
+
+    std::vector<double> ink(sums.rows);
+    for (int y = 0; y < sums.rows; ++y) {
+        ink[y] = sums.at<double>(y, 0);
+    }
+    return ink;
+}
+
+// Middle of the longest run of near-blank rows in [from, to), or -1 if
+// the window has no blank rows at all: any cut there would go through a
+// text line.
+int bestCut(const std::vector<double>& ink, int from, int to, double blank_level) {
+    int best_start = -1;
+    int best_length = 0;
+    int run_start = -1;
+    for (int y = from; y < to; ++y) {
+        if (ink[y] <= blank_level) {
+            if (run_start < 0) {
+                run_start = y;
+            }
+            if (y - run_start + 1 > best_length) {
+                best_length = y - run_start + 1;
+                best_start = run_start;
+            }
+        } else {
+            run_start = -1;
+        }
+    }
+    return best_start >= 0 ? best_start + best_length / 2 : -1;
+}
+
+} // namespace
+
+std::vector<cv::Range> splitIntoBands(const cv::Mat& image, const BandOptions& options) {
+    std::vector<cv::Range> bands;
+    int height = image.rows;
+    int count = options.enabled() ? std::min(options.max_bands, height / options.min_band_height) : 1;
+    if (count < 2) {
+        bands.emplace_back(0, height);
+        return bands;
+    }
+
+    std::vector<double> ink = rowInk(image);
+    auto [lightest, darkest] = std::minmax_element(ink.begin(), ink.end());
+    double blank_level = *lightest + 0.01 * (*darkest - *lightest);
+
+    // Look for each cut within a quarter band of its even split point
+    int band = height / count;
+    int slack = band / 4;
+    int top = 0;
+    for (int i = 1; i < count; ++i) {
+        int target = i * height / count;
+        int from = std::max(top + options.min_band_height / 2, target - slack);
+        int to = std::min(height - options.min_band_height / 2, target + slack);
+        if (from >= to) {
+            continue;
+        }
+        // Without a gap between lines here, this band runs on into the next
+        int cut = bestCut(ink, from, to, blank_level);
+        if (cut < 0) {
+            continue;
+        }
+        bands.emplace_back(top, cut);
+        top = cut;
+    }
+    bands.emplace_back(top, height);
+    return bands;
+}
+
+std::string stitchBands(const std::vector<std::string>& texts) {
+    std::string text;
+    for (const std::string& band : texts) {
+        size_t end = band.find_last_not_of("\n ");
+        if (end == std::string::npos) {
+            continue;  // Blank band
+        }
+        if (!text.empty()) {
+            text += '\n';
+        }
+        text.append(band, 0, end + 1);
+    }
+    if (!text.empty()) {
+        text += '\n';
+    }
+    return text;
+}
@@ -0,0 +1,29 @@
+#ifndef BAND_SPLITTER_H
+#define BAND_SPLITTER_H
+
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+
+// When and how finely a tall image is cut into horizontal bands that are
+// OCRed in parallel. Off unless min_band_height is set.
+struct BandOptions {
+    int min_band_height = 0;  // Pixels; images shorter than twice this are not split
+    int max_bands = 4;
+
+    bool enabled() const { return min_band_height > 0 && max_bands > 1; }
+};
+
+// Splits `image` (8-bit gray or RGB) into top-to-bottom row ranges for
+// separate recognition. Cuts are placed in the emptiest stretch of rows
+// near each evenly spaced target, found from the row ink profile, so they
+// fall between text lines rather than through them; where no blank row is
+// near a target, that cut is left out and the bands on either side stay
+// one. Returns a single range covering the image when it is too small to
+// split or has no gaps to cut at.
+std::vector<cv::Range> splitIntoBands(const cv::Mat& image, const BandOptions& options);
+
+// Joins band texts in reading (top-to-bottom) order.
+std::string stitchBands(const std::vector<std::string>& texts);
+
+#endif // BAND_SPLITTER_H
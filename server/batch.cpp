@@ -0,0 +1,55 @@
+#include "batch.h"
+
+#include "scheduling.h"
+
+std::vector<size_t> batchOffsets(const ocr::BatchRequest& batch, std::string& error) {
+    std::vector<size_t> offsets;
+    if (batch.image_ids_size() != 0 && batch.image_ids_size() != batch.sizes_size()) {
+        error = "Batch has " + std::to_string(batch.image_ids_size()) + " ids for " +
+                std::to_string(batch.sizes_size()) + " images";
+        return offsets;
+    }
+
+    offsets.reserve(batch.sizes_size());
+    size_t offset = 0;
+    for (uint32_t size : batch.sizes()) {
+        offsets.push_back(offset);
+        offset += size;
+    }
+    if (offset != batch.packed().size()) {
+        error = "Batch image sizes add up to " + std::to_string(offset) + " bytes, packed data has " +
+                std::to_string(batch.packed().size());
+        offsets.clear();
+    }
+    return offsets;
+}
+
+std::string batchImageId(const ocr::BatchRequest& batch, size_t index) {
+    return batch.image_ids_size() > 0 ? batch.image_ids(static_cast<int>(index)) : std::to_string(index);
+}
+
+BatchSchedule::BatchSchedule(const ocr::BatchRequest& batch, const grpc::ServerContext& context)
+    : received_at(std::chrono::steady_clock::now()),
+      lane(laneFor(batch.priority())),
+      client(clientKey(context)),
+      deadline(requestDeadline(batch.deadline_ms(), context, received_at))
+{
+}
+
+ProcessingTask batchTask(const ocr::BatchRequest& batch,
+                         const std::shared_ptr<const std::string>& packed,
+                         const std::vector<size_t>& offsets, size_t index,
+                         const BatchSchedule& schedule) {
+    ProcessingTask task;
+    task.received_at = schedule.received_at;
+    task.lane = schedule.lane;
+    task.client = schedule.client;
+    task.deadline = schedule.deadline;
+    task.image_id = batchImageId(batch, index);
+    task.image_data = ImagePayload(packed, offsets[index], batch.sizes(static_cast<int>(index)));
+    task.image_format = batch.image_format();
+    task.output = batch.output();
+    task.config = batch.config();
+    task.page_results = true;
+    return task;
+}
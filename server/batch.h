@@ -0,0 +1,41 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <grpcpp/server_context.h>
+
+#include "ocr.pb.h"
+#include "ocr_dispatcher.h"
+
+// Results per BatchResponse message at most; a writer sends whatever has
+// finished since its last write, up to this many
+constexpr size_t kMaxBatchResults = 64;
+
+// Where each image of `batch` starts in its packed buffer. Empty, with
+// `error` set, if the sizes do not add up to the buffer or ids are given
+// for only some of the images.
+std::vector<size_t> batchOffsets(const ocr::BatchRequest& batch, std::string& error);
+
+// The id of image `index`: its own, or the index when the batch has none
+std::string batchImageId(const ocr::BatchRequest& batch, size_t index);
+
+// Scheduling shared by every image of a batch, worked out once per call
+struct BatchSchedule {
+    BatchSchedule(const ocr::BatchRequest& batch, const grpc::ServerContext& context);
+
+    std::chrono::steady_clock::time_point received_at;
+    size_t lane;
+    uint64_t client;
+    std::chrono::steady_clock::time_point deadline;
+};
+
+// Task for image `index`, aliasing its bytes in `packed` (which must hold
+// batch.packed()) instead of copying them
+ProcessingTask batchTask(const ocr::BatchRequest& batch,
+                         const std::shared_ptr<const std::string>& packed,
+                         const std::vector<size_t>& offsets, size_t index,
+                         const BatchSchedule& schedule);
+
+#endif // BATCH_H
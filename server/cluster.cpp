@@ -0,0 +1,283 @@
+#include "cluster.h"
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "ocr_dispatcher.h"
+
+namespace {
+
+// Heartbeats a worker may miss before it is dropped
+constexpr int kMissedHeartbeats = 3;
+// How often a waiting acquire() checks whether its caller went away
+constexpr std::chrono::milliseconds kCancelPoll(100);
+// Deadline of the worker's Register and Heartbeat calls
+constexpr std::chrono::seconds kClusterCallTimeout(2);
+
+} // namespace
+
+WorkerRegistry::WorkerRegistry(std::chrono::milliseconds heartbeat_interval)
+    : heartbeat_interval_(heartbeat_interval)
+{
+    reaper_ = std::thread(&WorkerRegistry::reapLoop, this);
+}
+
+WorkerRegistry::~WorkerRegistry() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    stop_cv_.notify_all();
+    reaper_.join();
+}
+
+uint64_t WorkerRegistry::add(const std::string& address, int engines, size_t queue_capacity) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto now = std::chrono::steady_clock::now();
+    for (const auto& [id, worker] : workers_) {
+        if (worker->address == address) {
+            worker->engines = std::max(engines, 1);
+            worker->queue_capacity = queue_capacity;
+            worker->last_seen = now;
+            room_cv_.notify_all();
+            return id;
+        }
+    }
+
+    auto worker = std::make_shared<Worker>();
+    worker->id = next_id_++;
+    worker->address = address;
+    worker->engines = std::max(engines, 1);
+    worker->queue_capacity = queue_capacity;
+    worker->stub = ocr::OCRService::NewStub(
+        grpc::CreateChannel(address, grpc::InsecureChannelCredentials()));
+    worker->last_seen = now;
+    workers_[worker->id] = worker;
+    room_cv_.notify_all();
+
+    std::cout << "Worker " << worker->id << " registered: " << address << " with "
+              << worker->engines << " engines" << std::endl;
+    return worker->id;
+}
+
+bool WorkerRegistry::heartbeat(uint64_t id, int queue_depth, int workers_busy) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = workers_.find(id);
+    if (it == workers_.end()) {
+        return false;
+    }
+    Worker& worker = *it->second;
+    worker.queue_depth = queue_depth;
+    worker.workers_busy = workers_busy;
+    worker.last_seen = std::chrono::steady_clock::now();
+    room_cv_.notify_all();
+    return true;
+}
+
+bool WorkerRegistry::hasRoom(const Worker& worker) const {
+    return worker.in_flight < worker.engines * kSlotsPerEngine &&
+           (worker.queue_capacity == 0 || worker.queue_depth < static_cast<int>(worker.queue_capacity));
+}
+
+WorkerRegistry::WorkerPtr WorkerRegistry::acquire(uint64_t avoid_id,
+                                                  std::chrono::steady_clock::time_point deadline,
+                                                  const std::function<bool()>& cancelled) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        // The avoided worker is only used when it is the only one left
+        bool only_avoided = workers_.size() == 1 && workers_.count(avoid_id) == 1;
+
+        WorkerPtr best;
+        double best_load = 0;
+        for (const auto& [id, worker] : workers_) {
+            if ((id == avoid_id && !only_avoided) || !hasRoom(*worker)) {
+                continue;
+            }
+            // Work from other callers counts too, as of the last heartbeat
+            int load = std::max(worker->in_flight, worker->queue_depth + worker->workers_busy);
+            double per_engine = static_cast<double>(load) / worker->engines;
+            if (!best || per_engine < best_load) {
+                best = worker;
+                best_load = per_engine;
+            }
+        }
+        if (best) {
+            ++best->in_flight;
+            return best;
+        }
+
+        if (cancelled && cancelled()) {
+            return nullptr;
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+            return nullptr;
+        }
+        room_cv_.wait_until(lock, std::min(deadline, now + kCancelPoll));
+    }
+}
+
+void WorkerRegistry::release(const WorkerPtr& worker) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    --worker->in_flight;
+    room_cv_.notify_all();
+}
+
+bool WorkerRegistry::watch(const WorkerPtr& worker, grpc::ClientContext* context) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!worker->alive) {
+        return false;
+    }
+    worker->calls.insert(context);
+    return true;
+}
+
+void WorkerRegistry::unwatch(const WorkerPtr& worker, grpc::ClientContext* context) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    worker->calls.erase(context);
+}
+
+void WorkerRegistry::drop(const WorkerPtr& worker, const std::string& reason) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (worker->alive) {
+        dropLocked(worker, reason);
+    }
+}
+
+void WorkerRegistry::dropLocked(const WorkerPtr& worker, const std::string& reason) {
+    worker->alive = false;
+    for (grpc::ClientContext* context : worker->calls) {
+        context->TryCancel();
+    }
+    worker->calls.clear();
+    workers_.erase(worker->id);
+    room_cv_.notify_all();
+
+    std::cerr << "Dropping worker " << worker->id << " (" << worker->address << "): "
+              << reason << std::endl;
+}
+
+void WorkerRegistry::reapLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_cv_.wait_for(lock, heartbeat_interval_, [this] { return stopping_; })) {
+        auto silent_since = std::chrono::steady_clock::now() - kMissedHeartbeats * heartbeat_interval_;
+        std::vector<WorkerPtr> silent;
+        for (const auto& [id, worker] : workers_) {
+            if (worker->last_seen < silent_since) {
+                silent.push_back(worker);
+            }
+        }
+        for (const WorkerPtr& worker : silent) {
+            dropLocked(worker, "missed heartbeats");
+        }
+    }
+}
+
+void WorkerRegistry::fillStats(ocr::StatsResponse& stats) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint32_t engines = 0;
+    uint32_t busy = 0;
+    uint32_t queued = 0;
+    uint32_t capacity = 0;
+    for (const auto& [id, worker] : workers_) {
+        engines += worker->engines;
+        busy += worker->workers_busy;
+        queued += worker->queue_depth;
+        capacity += static_cast<uint32_t>(worker->queue_capacity);
+    }
+    stats.set_cluster_workers(static_cast<uint32_t>(workers_.size()));
+    stats.set_workers(engines);
+    stats.set_workers_busy(busy);
+    stats.set_queue_depth(queued);
+    stats.set_queue_capacity(capacity);
+}
+
+grpc::Status ClusterServiceImpl::Register(grpc::ServerContext* context,
+                                          const ocr::RegisterRequest* request,
+                                          ocr::RegisterResponse* response) {
+    if (request->address().empty()) {
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "Worker address missing");
+    }
+    uint64_t id = registry_.add(request->address(), static_cast<int>(request->engines()),
+                                request->queue_capacity());
+    response->set_worker_id(id);
+    response->set_heartbeat_interval_ms(
+        static_cast<uint32_t>(registry_.heartbeatInterval().count()));
+    return grpc::Status::OK;
+}
+
+grpc::Status ClusterServiceImpl::Heartbeat(grpc::ServerContext* context,
+                                           const ocr::HeartbeatRequest* request,
+                                           ocr::HeartbeatResponse* response) {
+    response->set_registered(registry_.heartbeat(request->worker_id(),
+                                                 static_cast<int>(request->queue_depth()),
+                                                 static_cast<int>(request->workers_busy())));
+    return grpc::Status::OK;
+}
+
+ClusterMember::ClusterMember(const std::string& coordinator, const std::string& advertise,
+                             const OCRDispatcher& dispatcher)
+    : coordinator_(coordinator), advertise_(advertise), dispatcher_(dispatcher),
+      stub_(ocr::ClusterService::NewStub(
+          grpc::CreateChannel(coordinator, grpc::InsecureChannelCredentials())))
+{
+    thread_ = std::thread(&ClusterMember::run, this);
+}
+
+ClusterMember::~ClusterMember() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    stop_cv_.notify_all();
+    thread_.join();
+}
+
+void ClusterMember::run() {
+    uint64_t id = 0;
+    std::chrono::milliseconds interval(1000);
+    bool warned = false;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+        lock.unlock();
+        grpc::ClientContext context;
+        context.set_deadline(std::chrono::system_clock::now() + kClusterCallTimeout);
+
+        if (id == 0) {
+            ocr::RegisterRequest request;
+            request.set_address(advertise_);
+            request.set_engines(static_cast<uint32_t>(dispatcher_.numWorkers()));
+            request.set_queue_capacity(static_cast<uint32_t>(dispatcher_.queueCapacity()));
+            ocr::RegisterResponse response;
+            grpc::Status status = stub_->Register(&context, request, &response);
+            if (status.ok()) {
+                id = response.worker_id();
+                if (response.heartbeat_interval_ms() > 0) {
+                    interval = std::chrono::milliseconds(response.heartbeat_interval_ms());
+                }
+                warned = false;
+                std::cout << "Joined coordinator " << coordinator_ << " as worker " << id
+                          << " (" << advertise_ << ")" << std::endl;
+            } else if (!warned) {
+                warned = true;
+                std::cerr << "Could not register with coordinator " << coordinator_ << ": "
+                          << status.error_message() << "; retrying" << std::endl;
+            }
+        } else {
+            ocr::HeartbeatRequest request;
+            request.set_worker_id(id);
+            request.set_queue_depth(static_cast<uint32_t>(dispatcher_.queueDepth()));
+            request.set_workers_busy(static_cast<uint32_t>(dispatcher_.busyWorkers()));
+            ocr::HeartbeatResponse response;
+            grpc::Status status = stub_->Heartbeat(&context, request, &response);
+            if (!status.ok() || !response.registered()) {
+                std::cerr << "Lost coordinator " << coordinator_ << "; registering again" << std::endl;
+                id = 0;
+            }
+        }
+
+        lock.lock();
+        stop_cv_.wait_for(lock, interval, [this] { return stopping_; });
+    }
+}
@@ -0,0 +1,140 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <grpcpp/grpcpp.h>
+
+#include "ocr.grpc.pb.h"
+
+class OCRDispatcher;
+
+// Coordinator's view of the worker servers in the cluster. Workers register
+// with their address and engine count, then heartbeat their load. A worker
+// that misses three heartbeats, or whose calls fail as unavailable, is
+// dropped and every call forwarded to it is cancelled, so its images get
+// sent elsewhere.
+class WorkerRegistry {
+public:
+    struct Worker {
+        uint64_t id = 0;
+        std::string address;
+        int engines = 1;
+        size_t queue_capacity = 0;
+        std::unique_ptr<ocr::OCRService::Stub> stub;
+
+        // Guarded by the registry's mutex
+        int in_flight = 0;      // Images forwarded by this coordinator and not yet answered
+        int queue_depth = 0;    // At the last heartbeat, counting every caller's work
+        int workers_busy = 0;
+        std::chrono::steady_clock::time_point last_seen;
+        bool alive = true;
+        std::unordered_set<grpc::ClientContext*> calls;  // Cancelled if the worker is dropped
+    };
+    using WorkerPtr = std::shared_ptr<Worker>;
+
+    explicit WorkerRegistry(std::chrono::milliseconds heartbeat_interval);
+    ~WorkerRegistry();
+
+    WorkerRegistry(const WorkerRegistry&) = delete;
+    WorkerRegistry& operator=(const WorkerRegistry&) = delete;
+
+    // A worker registering again under a known address keeps its id
+    uint64_t add(const std::string& address, int engines, size_t queue_capacity);
+    // False if `id` is not (or no longer) registered
+    bool heartbeat(uint64_t id, int queue_depth, int workers_busy);
+
+    // Reserves a slot on the least loaded live worker with room, preferring
+    // any other worker to `avoid_id`. Waits for room; returns nullptr at
+    // `deadline` or once `cancelled` returns true.
+    WorkerPtr acquire(uint64_t avoid_id, std::chrono::steady_clock::time_point deadline,
+                      const std::function<bool()>& cancelled);
+    // Frees the slot taken by acquire()
+    void release(const WorkerPtr& worker);
+
+    // Ties a forwarded call to the worker; false if it was already dropped
+    bool watch(const WorkerPtr& worker, grpc::ClientContext* context);
+    void unwatch(const WorkerPtr& worker, grpc::ClientContext* context);
+
+    // Drops a worker that could not be reached. If it is actually up, its
+    // next heartbeat is refused and it registers again.
+    void drop(const WorkerPtr& worker, const std::string& reason);
+
+    std::chrono::milliseconds heartbeatInterval() const { return heartbeat_interval_; }
+
+    // Cluster totals for GetStats: live workers, their engines, queued
+    // and busy counts as last reported
+    void fillStats(ocr::StatsResponse& stats) const;
+
+private:
+    // Images forwarded per engine before a worker counts as full: one
+    // running and one queued behind it, so the rest wait here, where they
+    // can still go to whichever worker frees up first
+    static constexpr int kSlotsPerEngine = 2;
+
+    bool hasRoom(const Worker& worker) const;
+    void dropLocked(const WorkerPtr& worker, const std::string& reason);
+    void reapLoop();
+
+    const std::chrono::milliseconds heartbeat_interval_;
+    mutable std::mutex mutex_;
+    std::condition_variable room_cv_;
+    std::map<uint64_t, WorkerPtr> workers_;
+    uint64_t next_id_ = 1;
+
+    bool stopping_ = false;
+    std::condition_variable stop_cv_;
+    std::thread reaper_;
+};
+
+// ClusterService on the coordinator: registration and heartbeats
+class ClusterServiceImpl final : public ocr::ClusterService::Service {
+public:
+    explicit ClusterServiceImpl(WorkerRegistry& registry) : registry_(registry) {}
+
+    grpc::Status Register(grpc::ServerContext* context, const ocr::RegisterRequest* request,
+                          ocr::RegisterResponse* response) override;
+    grpc::Status Heartbeat(grpc::ServerContext* context, const ocr::HeartbeatRequest* request,
+                           ocr::HeartbeatResponse* response) override;
+
+private:
+    WorkerRegistry& registry_;
+};
+
+// Worker side of cluster mode: registers this server with a coordinator
+// and reports the dispatcher's load until destroyed, registering again
+// whenever the coordinator loses track of it (restart, missed heartbeats).
+class ClusterMember {
+public:
+    // `advertise` is the address the coordinator should use to reach this
+    // server's OCRService
+    ClusterMember(const std::string& coordinator, const std::string& advertise,
+                  const OCRDispatcher& dispatcher);
+    ~ClusterMember();
+
+    ClusterMember(const ClusterMember&) = delete;
+    ClusterMember& operator=(const ClusterMember&) = delete;
+
+private:
+    void run();
+
+    const std::string coordinator_;
+    const std::string advertise_;
+    const OCRDispatcher& dispatcher_;
+    std::unique_ptr<ocr::ClusterService::Stub> stub_;
+
+    std::mutex mutex_;
+    std::condition_variable stop_cv_;
+    bool stopping_ = false;
+    std::thread thread_;
+};
+
+#endif // CLUSTER_H
@@ -0,0 +1,506 @@
+#include "coordinator.h"
+#include <algorithm>
+#include <cstdlib>
+#include <deque>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "batch.h"
+#include "metrics.h"
+#include "ocr_dispatcher.h"
+#include "ocr_worker.h"
+#include "scheduling.h"
+#include "stream_session.h"
+
+namespace {
+
+// Workers tried per image before it is answered as failed
+constexpr int kMaxAttempts = 3;
+constexpr const char* kNoWorkerError = "No OCR worker available";
+
+// Failures that another worker may not have
+bool retryable(ocr::ErrorCode error) {
+    return error == ocr::ERROR_UNAVAILABLE || error == ocr::ERROR_OVERLOADED;
+}
+
+// Call to a worker on behalf of `client`: inherits the client call's
+// deadline and cancellation, and keeps the client's identity for the
+// worker's fair scheduling
+std::unique_ptr<grpc::ClientContext> forwardedContext(const grpc::ServerContext& client) {
+    std::unique_ptr<grpc::ClientContext> context = grpc::ClientContext::FromServerContext(client);
+    context->AddMetadata("x-client-id", clientName(client));
+    return context;
+}
+
+// The images of one client stream that are out on workers. Each worker
+// used gets one ProcessImageStream call, opened on first use; images are
+// renamed to a sequence number on the way out so duplicate client ids
+// cannot be confused. When a worker call ends with images still on it,
+// they are sent to another worker.
+class ForwardingSession {
+public:
+    ForwardingSession(WorkerRegistry& registry, grpc::ServerContext& client, StreamSession& out)
+        : registry_(registry), client_(client), out_(out) {}
+
+    ~ForwardingSession() { finish(); }
+
+    ForwardingSession(const ForwardingSession&) = delete;
+    ForwardingSession& operator=(const ForwardingSession&) = delete;
+
+    // Waits for a worker with room, then forwards the image. Every image
+    // is answered through `out` exactly once.
+    void forward(ocr::ImageRequest request) {
+        Pending pending;
+        pending.received_at = std::chrono::steady_clock::now();
+        pending.deadline = requestDeadline(request, client_, pending.received_at);
+        pending.image_id = std::move(*request.mutable_image_id());
+        auto forwarded = std::make_shared<ocr::ImageRequest>(std::move(request));
+
+        uint64_t seq;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            seq = next_seq_++;
+            ++unanswered_;
+        }
+        forwarded->set_image_id(std::to_string(seq));
+        pending.request = std::move(forwarded);
+        dispatch(seq, std::move(pending), 0);
+    }
+
+    // Waits until every image has been answered, then closes the worker calls
+    void finish() {
+        std::vector<Leg*> legs;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (finished_) {
+                return;
+            }
+            finished_ = true;
+            drained_cv_.wait(lock, [this] { return unanswered_ == 0; });
+            // Nothing is left to resend
+            closing_ = true;
+            retry_cv_.notify_all();
+            for (const auto& leg : legs_) {
+                legs.push_back(leg.get());
+            }
+        }
+        if (redispatcher_.joinable()) {
+            redispatcher_.join();
+        }
+        for (Leg* leg : legs) {
+            {
+                std::lock_guard<std::mutex> lock(leg->write_mutex);
+                if (!leg->closed) {
+                    leg->stream->WritesDone();
+                }
+            }
+            leg->reader.join();
+        }
+    }
+
+private:
+    // One ProcessImageStream call to one worker
+    struct Leg {
+        WorkerRegistry::WorkerPtr worker;
+        std::unique_ptr<grpc::ClientContext> context;
+        std::unique_ptr<grpc::ClientReaderWriter<ocr::ImageRequest, ocr::ImageResponse>> stream;
+        std::mutex write_mutex;  // The client reader and the redispatcher both write
+        bool closed = false;     // Guarded by write_mutex; no more writes once set
+        bool broken = false;     // Guarded by ForwardingSession::mutex_
+        std::thread reader;
+    };
+
+    struct Pending {
+        std::shared_ptr<ocr::ImageRequest> request;  // Kept for resending
+        std::string image_id;                        // The client's id
+        std::chrono::steady_clock::time_point received_at;
+        std::chrono::steady_clock::time_point deadline;
+        Leg* leg = nullptr;
+        int attempts = 0;
+    };
+
+    // An image waiting to be sent to another worker
+    struct Retry {
+        uint64_t seq;
+        Pending pending;
+        uint64_t avoid_id;
+    };
+
+    // Sends an image to a worker, preferring one other than `avoid_id`
+    void dispatch(uint64_t seq, Pending pending, uint64_t avoid_id) {
+        auto wait_started = std::chrono::steady_clock::now();
+        WorkerRegistry::WorkerPtr worker = registry_.acquire(
+            avoid_id, pending.deadline, [this] { return client_.IsCancelled(); });
+        serverMetrics().record(ServerMetrics::kQueueWait, nanosSince(wait_started));
+        if (!worker) {
+            answer(pending, client_.IsCancelled()
+                            ? OCRResult::failure(ocr::ERROR_CANCELLED, "Request cancelled")
+                            : pending.deadline <= std::chrono::steady_clock::now()
+                            ? OCRResult::failure(ocr::ERROR_TIMEOUT, "Deadline exceeded before processing")
+                            : OCRResult::failure(ocr::ERROR_UNAVAILABLE, kNoWorkerError));
+            return;
+        }
+
+        std::shared_ptr<ocr::ImageRequest> request = pending.request;
+        Leg* leg;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            leg = legFor(worker);
+            pending.leg = leg;
+            ++pending.attempts;
+            pending_[seq] = std::move(pending);
+        }
+
+        // A failed write means the call is broken; its reader then deals
+        // with everything that was pending on it
+        std::lock_guard<std::mutex> lock(leg->write_mutex);
+        if (!leg->closed) {
+            leg->stream->Write(*request);
+        }
+    }
+
+    // Requires mutex_. The open call to `worker`, starting one if needed.
+    Leg* legFor(const WorkerRegistry::WorkerPtr& worker) {
+        for (const auto& leg : legs_) {
+            if (leg->worker == worker && !leg->broken) {
+                return leg.get();
+            }
+        }
+        auto leg = std::make_unique<Leg>();
+        leg->worker = worker;
+        leg->context = forwardedContext(client_);
+        if (!registry_.watch(worker, leg->context.get())) {
+            leg->context->TryCancel();  // Dropped meanwhile; let the reader re-dispatch
+        }
+        leg->stream = worker->stub->ProcessImageStream(leg->context.get());
+        Leg* started = leg.get();
+        legs_.push_back(std::move(leg));
+        started->reader = std::thread(&ForwardingSession::readLoop, this, started);
+        return started;
+    }
+
+    void readLoop(Leg* leg) {
+        ocr::ImageResponse response;
+        while (leg->stream->Read(&response)) {
+            uint64_t seq = std::strtoull(response.image_id().c_str(), nullptr, 10);
+            Pending done;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                auto it = pending_.find(seq);
+                if (it == pending_.end() || it->second.leg != leg) {
+                    continue;
+                }
+                if (response.partial()) {
+                    // One page of a document; the image stays on the worker.
+                    // Pages may be sent again if the image is redispatched.
+                    response.set_image_id(it->second.image_id);
+                } else {
+                    done = std::move(it->second);
+                    pending_.erase(it);
+                }
+            }
+            if (response.partial()) {
+                out_.complete(std::move(response));
+                continue;
+            }
+            registry_.release(leg->worker);
+            if (retryable(response.error_code()) && done.attempts < kMaxAttempts &&
+                !client_.IsCancelled()) {
+                // This worker could not take it; another may
+                redispatch(seq, std::move(done), leg->worker->id);
+                continue;
+            }
+            response.set_image_id(done.image_id);
+            serverMetrics().record(ServerMetrics::kTotal, nanosSince(done.received_at));
+            out_.complete(std::move(response));
+            answered();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(leg->write_mutex);
+            leg->closed = true;
+        }
+        grpc::Status status = leg->stream->Finish();
+        registry_.unwatch(leg->worker, leg->context.get());
+        if (status.error_code() == grpc::StatusCode::UNAVAILABLE) {
+            registry_.drop(leg->worker, status.error_message());
+        }
+
+        // Images still on this call were lost with it
+        std::vector<std::pair<uint64_t, Pending>> lost;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            leg->broken = true;
+            for (auto it = pending_.begin(); it != pending_.end();) {
+                if (it->second.leg == leg) {
+                    lost.emplace_back(it->first, std::move(it->second));
+                    it = pending_.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        for (auto& [seq, pending] : lost) {
+            registry_.release(leg->worker);
+            if (client_.IsCancelled()) {
+                answer(pending, OCRResult::failure(ocr::ERROR_CANCELLED, "Request cancelled"));
+            } else if (pending.attempts >= kMaxAttempts) {
+                answer(pending, OCRResult::failure(ocr::ERROR_UNAVAILABLE,
+                                                   status.ok() ? std::string("Worker closed the stream")
+                                                               : status.error_message()));
+            } else {
+                redispatch(seq, std::move(pending), leg->worker->id);
+            }
+        }
+    }
+
+    // Hands an image to the redispatcher thread to send again. Leg readers
+    // must never wait for a worker themselves: the slot they would wait for
+    // may be one that only their own reading can free.
+    void redispatch(uint64_t seq, Pending pending, uint64_t avoid_id) {
+        serverMetrics().redispatched.fetch_add(1, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(mutex_);
+        retries_.push_back(Retry{seq, std::move(pending), avoid_id});
+        // Started on first use; most streams never need it
+        if (!redispatcher_.joinable()) {
+            redispatcher_ = std::thread(&ForwardingSession::redispatchLoop, this);
+        }
+        retry_cv_.notify_one();
+    }
+
+    void redispatchLoop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            retry_cv_.wait(lock, [this] { return !retries_.empty() || closing_; });
+            if (retries_.empty()) {
+                return;
+            }
+            Retry retry = std::move(retries_.front());
+            retries_.pop_front();
+            lock.unlock();
+            dispatch(retry.seq, std::move(retry.pending), retry.avoid_id);
+            lock.lock();
+        }
+    }
+
+    void answer(const Pending& pending, const OCRResult& result) {
+        out_.complete(buildResponse(pending.image_id, result));
+        answered();
+    }
+
+    void answered() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--unanswered_ == 0) {
+            drained_cv_.notify_all();
+        }
+    }
+
+    WorkerRegistry& registry_;
+    grpc::ServerContext& client_;
+    StreamSession& out_;
+
+    std::mutex mutex_;
+    std::condition_variable drained_cv_;
+    std::condition_variable retry_cv_;
+    std::unordered_map<uint64_t, Pending> pending_;
+    std::vector<std::unique_ptr<Leg>> legs_;
+    std::deque<Retry> retries_;
+    std::thread redispatcher_;  // Sends retries_ on; waits for workers in the readers' stead
+    uint64_t next_seq_ = 0;
+    size_t unanswered_ = 0;  // Forwarded and not yet answered, including re-dispatches in progress
+    bool finished_ = false;
+    bool closing_ = false;   // Everything answered; the redispatcher may exit
+};
+
+} // namespace
+
+grpc::Status CoordinatorServiceImpl::ProcessImageStream(
+    grpc::ServerContext* context,
+    grpc::ServerReaderWriter<ocr::ImageResponse, ocr::ImageRequest>* stream) {
+    auto session = std::make_shared<StreamSession>(kDefaultStreamWindow);
+    ServerMetrics& metrics = serverMetrics();
+    metrics.active_streams.fetch_add(1);
+
+    // As on a worker, only this thread writes to the client
+    std::thread writer([session, stream] {
+        ocr::ImageResponse response;
+        bool open = true;
+        while (session->nextResponse(response)) {
+            if (open) {
+                StageTimer timer(ServerMetrics::kWrite);
+                open = stream->Write(response);
+            }
+            session->responseWritten(response);
+        }
+    });
+
+    {
+        ForwardingSession forwarding(registry_, *context, *session);
+        ocr::ImageRequest request;
+        auto read_started = std::chrono::steady_clock::now();
+        while (stream->Read(&request)) {
+            metrics.record(ServerMetrics::kReceive, nanosSince(read_started));
+            session->acquireSlot();
+            forwarding.forward(std::move(request));
+            read_started = std::chrono::steady_clock::now();
+        }
+        forwarding.finish();
+    }
+
+    session->close();
+    writer.join();
+    metrics.active_streams.fetch_sub(1);
+    return grpc::Status::OK;
+}
+
+grpc::Status CoordinatorServiceImpl::ProcessBatch(grpc::ServerContext* context,
+                                                  const ocr::BatchRequest* batch,
+                                                  grpc::ServerWriter<ocr::BatchResponse>* writer) {
+    std::string error;
+    std::vector<size_t> offsets = batchOffsets(*batch, error);
+    if (!error.empty()) {
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, error);
+    }
+
+    auto received_at = std::chrono::steady_clock::now();
+    auto session = std::make_shared<StreamSession>(kDefaultStreamWindow);
+    std::thread results([session, writer] {
+        ocr::BatchResponse response;
+        bool open = true;
+        while (session->nextResponses(response, kMaxBatchResults)) {
+            if (open) {
+                StageTimer timer(ServerMetrics::kWrite);
+                open = writer->Write(response);
+            }
+            session->responseWritten(response);
+        }
+    });
+
+    // Workers are fed over the same per-worker streams as a client stream,
+    // so each image is copied out of the packed buffer into its own request
+    {
+        ForwardingSession forwarding(registry_, *context, *session);
+        for (size_t i = 0; i < offsets.size(); ++i) {
+            ocr::ImageRequest request;
+            request.set_image_id(batchImageId(*batch, i));
+            request.set_image_data(batch->packed().data() + offsets[i], batch->sizes(static_cast<int>(i)));
+            request.set_image_format(batch->image_format());
+            request.set_priority(batch->priority());
+            *request.mutable_output() = batch->output();
+            *request.mutable_config() = batch->config();
+            if (batch->deadline_ms() > 0) {
+                // Still counted from the batch's arrival, not this image's turn
+                auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - received_at).count();
+                request.set_deadline_ms(static_cast<uint32_t>(
+                    std::max<int64_t>(1, batch->deadline_ms() - elapsed)));
+            }
+            session->acquireSlot();
+            forwarding.forward(std::move(request));
+        }
+        forwarding.finish();
+    }
+
+    session->close();
+    results.join();
+    return grpc::Status::OK;
+}
+
+grpc::Status CoordinatorServiceImpl::ProcessImage(grpc::ServerContext* context,
+                                                  const ocr::ImageRequest* request,
+                                                  ocr::ImageResponse* response) {
+    auto received_at = std::chrono::steady_clock::now();
+    auto deadline = requestDeadline(*request, *context, received_at);
+
+    grpc::Status status(grpc::StatusCode::UNAVAILABLE, "No OCR worker available");
+    uint64_t avoid_id = 0;
+    for (int attempt = 0; attempt < kMaxAttempts; ++attempt) {
+        auto wait_started = std::chrono::steady_clock::now();
+        WorkerRegistry::WorkerPtr worker = registry_.acquire(
+            avoid_id, deadline, [context] { return context->IsCancelled(); });
+        serverMetrics().record(ServerMetrics::kQueueWait, nanosSince(wait_started));
+        if (!worker) {
+            if (context->IsCancelled()) {
+                status = grpc::Status(grpc::StatusCode::CANCELLED, "Request cancelled");
+            } else if (deadline <= std::chrono::steady_clock::now()) {
+                status = grpc::Status(grpc::StatusCode::DEADLINE_EXCEEDED,
+                                      "Deadline exceeded before processing");
+            }
+            break;
+        }
+
+        std::unique_ptr<grpc::ClientContext> forwarded = forwardedContext(*context);
+        status = registry_.watch(worker, forwarded.get())
+            ? worker->stub->ProcessImage(forwarded.get(), *request, response)
+            : grpc::Status(grpc::StatusCode::UNAVAILABLE, "Worker left the cluster");
+        registry_.unwatch(worker, forwarded.get());
+        registry_.release(worker);
+
+        // Unreachable workers are dropped; overloaded ones are just skipped
+        if (status.error_code() == grpc::StatusCode::UNAVAILABLE) {
+            registry_.drop(worker, status.error_message());
+        } else if (status.error_code() != grpc::StatusCode::RESOURCE_EXHAUSTED) {
+            break;
+        }
+        if (attempt + 1 < kMaxAttempts) {
+            serverMetrics().redispatched.fetch_add(1, std::memory_order_relaxed);
+        }
+        avoid_id = worker->id;
+    }
+
+    serverMetrics().record(ServerMetrics::kTotal, nanosSince(received_at));
+    return status;
+}
+
+grpc::Status CoordinatorServiceImpl::ProcessImageUpload(grpc::ServerContext* context,
+                                                        grpc::ServerReader<ocr::UploadChunk>* reader,
+                                                        ocr::ImageResponse* response) {
+    auto received_at = std::chrono::steady_clock::now();
+    ocr::UploadChunk chunk;
+    if (!reader->Read(&chunk) || !chunk.has_header()) {
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "Upload must start with a header");
+    }
+
+    auto deadline = requestDeadline(0, *context, received_at);
+    auto wait_started = std::chrono::steady_clock::now();
+    WorkerRegistry::WorkerPtr worker = registry_.acquire(
+        0, deadline, [context] { return context->IsCancelled(); });
+    serverMetrics().record(ServerMetrics::kQueueWait, nanosSince(wait_started));
+    if (!worker) {
+        return context->IsCancelled()
+            ? grpc::Status(grpc::StatusCode::CANCELLED, "Request cancelled")
+            : grpc::Status(grpc::StatusCode::UNAVAILABLE, "No OCR worker available");
+    }
+
+    std::unique_ptr<grpc::ClientContext> forwarded = forwardedContext(*context);
+    grpc::Status status(grpc::StatusCode::UNAVAILABLE, "Worker left the cluster");
+    if (registry_.watch(worker, forwarded.get())) {
+        auto writer = worker->stub->ProcessImageUpload(forwarded.get(), response);
+        // A failed write means the worker call is over; Finish says why
+        bool open = writer->Write(chunk);
+        while (open && reader->Read(&chunk)) {
+            open = writer->Write(chunk);
+        }
+        if (open) {
+            writer->WritesDone();
+        }
+        status = writer->Finish();
+    }
+    registry_.unwatch(worker, forwarded.get());
+    registry_.release(worker);
+    if (status.error_code() == grpc::StatusCode::UNAVAILABLE) {
+        registry_.drop(worker, status.error_message());
+    }
+
+    serverMetrics().record(ServerMetrics::kTotal, nanosSince(received_at));
+    return status;
+}
+
+grpc::Status CoordinatorServiceImpl::GetStats(grpc::ServerContext* context,
+                                              const ocr::StatsRequest* request,
+                                              ocr::StatsResponse* response) {
+    *response = collectProcessStats();
+    registry_.fillStats(*response);
+    return grpc::Status::OK;
+}
@@ -0,0 +1,42 @@
+#ifndef COORDINATOR_H
+#define COORDINATOR_H
+
+#include <grpcpp/grpcpp.h>
+
+#include "ocr.grpc.pb.h"
+#include "cluster.h"
+
+// OCRService front end for a cluster (ocr_server --coordinator). It runs
+// no OCR itself: every image is forwarded to the least loaded registered
+// worker with room, and images lost with a worker are sent to another
+// one, so clients see a single endpoint however many workers there are.
+class CoordinatorServiceImpl final : public ocr::OCRService::Service {
+public:
+    explicit CoordinatorServiceImpl(WorkerRegistry& registry) : registry_(registry) {}
+
+    grpc::Status ProcessImageStream(
+        grpc::ServerContext* context,
+        grpc::ServerReaderWriter<ocr::ImageResponse, ocr::ImageRequest>* stream) override;
+
+    grpc::Status ProcessBatch(grpc::ServerContext* context, const ocr::BatchRequest* batch,
+                              grpc::ServerWriter<ocr::BatchResponse>* writer) override;
+
+    grpc::Status ProcessImage(grpc::ServerContext* context, const ocr::ImageRequest* request,
+                              ocr::ImageResponse* response) override;
+
+    // Relayed chunk by chunk to one worker, so the coordinator holds at
+    // most one chunk per upload; an upload is not re-dispatched if that
+    // worker fails
+    grpc::Status ProcessImageUpload(grpc::ServerContext* context,
+                                    grpc::ServerReader<ocr::UploadChunk>* reader,
+                                    ocr::ImageResponse* response) override;
+
+    // The coordinator's own stage timings plus cluster-wide worker totals
+    grpc::Status GetStats(grpc::ServerContext* context, const ocr::StatsRequest* request,
+                          ocr::StatsResponse* response) override;
+
+private:
+    WorkerRegistry& registry_;
+};
+
+#endif // COORDINATOR_H
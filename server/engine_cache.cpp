@@ -0,0 +1,289 @@
+#include "engine_cache.h"
+#include <algorithm>
+#include <iostream>
+
+EngineCache::Lease::Lease(EngineCache* cache, std::unique_ptr<OCRWorker> worker)
+    : cache_(cache), worker_(std::move(worker)) {}
+
+EngineCache::Lease::Lease(Lease&& other) noexcept
+    : cache_(other.cache_), worker_(std::move(other.worker_)) {
+    other.cache_ = nullptr;
+}
+
+EngineCache::Lease& EngineCache::Lease::operator=(Lease&& other) noexcept {
+    if (this != &other) {
+        reset();
+        cache_ = other.cache_;
+        worker_ = std::move(other.worker_);
+        other.cache_ = nullptr;
+    }
+    return *this;
+}
+
+EngineCache::Lease::~Lease() {
+    reset();
+}
+
+void EngineCache::Lease::reset() {
+    if (cache_ && worker_) {
+        cache_->release(std::move(worker_));
+    }
+    cache_ = nullptr;
+}
+
+namespace {
+
+// How long a configuration whose engine failed to initialize is refused
+// before Init() is tried again, e.g. after its traineddata is installed
+constexpr std::chrono::seconds kRetryFailedAfter(60);
+// How often a waiting acquire() checks whether its caller went away
+constexpr std::chrono::milliseconds kCancelPoll(100);
+
+} // namespace
+
+EngineCache::EngineCache(const EngineConfig& defaults, const Preprocessor* preprocessor,
+                         size_t max_per_config, std::chrono::seconds idle_timeout)
+    : defaults_(defaults), preprocessor_(preprocessor),
+      max_per_config_(std::max<size_t>(max_per_config, 1)), idle_timeout_(idle_timeout) {
+    maintainer_ = std::thread(&EngineCache::maintain, this);
+}
+
+EngineCache::~EngineCache() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    returned_.notify_all();
+    maintainer_.join();
+}
+
+bool EngineCache::preload(const std::vector<EngineConfig>& configs) {
+    bool ok = true;
+    for (const EngineConfig& config : configs) {
+        auto worker = validLanguage(config.language)
+            ? std::make_unique<OCRWorker>(preprocessor_, config) : nullptr;
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!worker || !worker->isInitialized()) {
+            std::cerr << "Could not preload engine for " << config.name() << std::endl;
+            failed_[config.name()] = std::chrono::steady_clock::now() + kRetryFailedAfter;
+            ok = false;
+            continue;
+        }
+        Shelf& shelf = shelves_[config.name()];
+        shelf.pinned = true;
+        shelf.idle.emplace_back(std::move(worker), std::chrono::steady_clock::now());
+        ++shelf.engines;
+    }
+    return ok;
+}
+
+EngineCache::Lease EngineCache::acquire(const EngineConfig& config, std::chrono::steady_clock::time_point deadline,
+                                        const CancelCheck& cancelled, ocr::ErrorCode* refused) {
+    auto refuse = [refused](ocr::ErrorCode error) {
+        if (refused) {
+            *refused = error;
+        }
+        return Lease();
+    };
+    if (!validLanguage(config.language)) {
+        return refuse(ocr::ERROR_INVALID_CONFIG);
+    }
+    const std::string name = config.name();
+    std::unique_lock<std::mutex> lock(mutex_);
+    bool waited = false;
+    bool loading = false;
+    for (;;) {
+        if (stopping_) {
+            return refuse(ocr::ERROR_UNAVAILABLE);
+        }
+        if (failedLocked(name)) {
+            return refuse(ocr::ERROR_INVALID_CONFIG);
+        }
+        // Looked up again after every wait: the shelf may have been
+        // dropped and recreated meanwhile
+        Shelf& shelf = shelves_[name];
+        if (!shelf.idle.empty()) {
+            std::unique_ptr<OCRWorker> worker = std::move(shelf.idle.back().first);
+            shelf.idle.pop_back();
+            // Every engine is now busy; have one more ready for the next
+            // request rather than making it wait for Init()
+            if (shelf.idle.empty() && shelf.engines < max_per_config_) {
+                warmLocked(config, shelf);
+            }
+            return Lease(this, std::move(worker));
+        }
+        if (shelf.engines < max_per_config_ && shelf.warming == 0) {
+            // Nothing warm or on its way: this request waits for Init()
+            if (!loading) {
+                cold_starts_.fetch_add(1, std::memory_order_relaxed);
+                loading = true;
+            }
+            warmLocked(config, shelf);
+        } else if (!waited && !loading) {
+            // As many engines as can ever be busy at once already exist or
+            // are loading; wait for one rather than load its models again
+            lease_waits_.fetch_add(1, std::memory_order_relaxed);
+        }
+        waited = true;
+
+        // Checked without the lock: it may take the result cache's
+        if (cancelled) {
+            lock.unlock();
+            bool gone = cancelled();
+            lock.lock();
+            if (gone) {
+                return refuse(ocr::ERROR_CANCELLED);
+            }
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+            return refuse(ocr::ERROR_TIMEOUT);
+        }
+        returned_.wait_until(lock, std::min(deadline, now + kCancelPoll));
+    }
+}
+
+void EngineCache::warmLocked(const EngineConfig& config, Shelf& shelf) {
+    ++shelf.engines;
+    ++shelf.warming;
+    to_warm_.push_back(config);
+    wake_.notify_all();
+}
+
+void EngineCache::release(std::unique_ptr<OCRWorker> worker) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        shelves_[worker->config().name()].idle.emplace_back(std::move(worker),
+                                                            std::chrono::steady_clock::now());
+    }
+    returned_.notify_all();
+}
+
+bool EngineCache::failedLocked(const std::string& name) {
+    auto failed = failed_.find(name);
+    if (failed == failed_.end()) {
+        return false;
+    }
+    if (std::chrono::steady_clock::now() < failed->second) {
+        return true;
+    }
+    failed_.erase(failed);
+    return false;
+}
+
+void EngineCache::markFailedLocked(const std::string& name) {
+    failed_[name] = std::chrono::steady_clock::now() + kRetryFailedAfter;
+    auto shelf = shelves_.find(name);
+    if (shelf != shelves_.end() && --shelf->second.engines == 0 && !shelf->second.pinned) {
+        shelves_.erase(shelf);
+    }
+    // Waiters fail now instead of waiting for an engine that will not come
+    returned_.notify_all();
+}
+
+EngineCache::Stats EngineCache::stats() const {
+    Stats stats{};
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats.configs = static_cast<uint32_t>(shelves_.size());
+    for (const auto& [name, shelf] : shelves_) {
+        stats.idle += static_cast<uint32_t>(shelf.idle.size());
+    }
+    stats.cold_starts = cold_starts_.load(std::memory_order_relaxed);
+    stats.lease_waits = lease_waits_.load(std::memory_order_relaxed);
+    stats.evictions = evictions_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void EngineCache::maintain() {
+    // Check for idle engines a few times per timeout
+    auto sweep_interval = std::max<std::chrono::steady_clock::duration>(idle_timeout_ / 4,
+                                                                        std::chrono::seconds(1));
+    auto next_sweep = std::chrono::steady_clock::now() + sweep_interval;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+        wake_.wait_until(lock, next_sweep, [this] { return stopping_ || !to_warm_.empty(); });
+        if (stopping_) {
+            break;
+        }
+
+        std::vector<EngineConfig> to_warm;
+        to_warm.swap(to_warm_);
+        std::vector<std::unique_ptr<OCRWorker>> evicted;
+        auto now = std::chrono::steady_clock::now();
+        if (now >= next_sweep) {
+            evictLocked(now - idle_timeout_, evicted);
+            next_sweep = now + sweep_interval;
+        }
+
+        // Init() and End() take a while; nobody waits on them here
+        lock.unlock();
+        evicted.clear();
+        for (const EngineConfig& config : to_warm) {
+            auto worker = std::make_unique<OCRWorker>(preprocessor_, config);
+            std::lock_guard<std::mutex> relock(mutex_);
+            // The shelf counts this engine, so it is still there
+            Shelf& shelf = shelves_[config.name()];
+            --shelf.warming;
+            if (worker->isInitialized()) {
+                shelf.idle.emplace_back(std::move(worker), std::chrono::steady_clock::now());
+                returned_.notify_all();
+            } else {
+                markFailedLocked(config.name());
+            }
+        }
+        lock.lock();
+    }
+
+    for (auto& [name, shelf] : shelves_) {
+        shelf.idle.clear();
+    }
+}
+
+void EngineCache::evictLocked(std::chrono::steady_clock::time_point cutoff,
+                              std::vector<std::unique_ptr<OCRWorker>>& evicted) {
+    for (auto it = shelves_.begin(); it != shelves_.end();) {
+        Shelf& shelf = it->second;
+        // Oldest first, leaving a preloaded configuration one engine
+        size_t keep = shelf.pinned ? 1 : 0;
+        size_t stale = 0;
+        while (stale < shelf.idle.size() && shelf.idle[stale].second < cutoff &&
+               shelf.engines - stale > keep) {
+            evicted.push_back(std::move(shelf.idle[stale].first));
+            ++stale;
+        }
+        shelf.idle.erase(shelf.idle.begin(), shelf.idle.begin() + stale);
+        shelf.engines -= stale;
+        evictions_.fetch_add(stale, std::memory_order_relaxed);
+        if (shelf.engines == 0 && !shelf.pinned) {
+            it = shelves_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    // Forget failures that would be retried anyway, so names clients make
+    // up do not pile up
+    auto now = std::chrono::steady_clock::now();
+    for (auto it = failed_.begin(); it != failed_.end();) {
+        it = now >= it->second ? failed_.erase(it) : std::next(it);
+    }
+}
+
+OCRWorker* engineFor(const ocr::OCRConfig& config, OCRWorker& own, EngineCache* cache,
+                     EngineCache::Lease& lease, std::chrono::steady_clock::time_point deadline,
+                     const CancelCheck& cancelled, ocr::ErrorCode* refused) {
+    EngineConfig wanted = engineConfig(config, own.config());
+    if (wanted == own.config()) {
+        own.configure(config);
+        return &own;
+    }
+    *refused = ocr::ERROR_INVALID_CONFIG;
+    if (cache) {
+        lease = cache->acquire(wanted, deadline, cancelled, refused);
+    }
+    if (!lease) {
+        return nullptr;
+    }
+    lease->configure(config);
+    return &*lease;
+}
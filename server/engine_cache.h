@@ -0,0 +1,145 @@
+#ifndef ENGINE_CACHE_H
+#define ENGINE_CACHE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "ocr_worker.h"
+
+// Warm OCR engines for every language set and engine mode besides the
+// server's default, whose engines the dispatcher and unary pool own. Engines
+// are initialized on a background thread: for a configuration's first
+// request unless it was preloaded, and after that whenever all of a
+// configuration's engines are checked out, so later requests rarely wait
+// for Init(). Callers never run Init() themselves, so one that gives up
+// while a model loads frees its thread at once. A configuration never has
+// more than `max_per_config` engines; past that, requests wait for one to
+// be returned. Engines idle for longer than `idle_timeout` are closed;
+// preloaded configurations keep one. A configuration whose engine fails to
+// initialize is refused for a minute rather than retried per request.
+class EngineCache {
+public:
+    // Move-only handle to a checked-out engine; returns it to the cache
+    class Lease {
+    public:
+        Lease() = default;
+        Lease(Lease&& other) noexcept;
+        Lease& operator=(Lease&& other) noexcept;
+        ~Lease();
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        explicit operator bool() const { return worker_ != nullptr; }
+        OCRWorker* operator->() const { return worker_.get(); }
+        OCRWorker& operator*() const { return *worker_; }
+
+    private:
+        friend class EngineCache;
+        Lease(EngineCache* cache, std::unique_ptr<OCRWorker> worker);
+        void reset();
+
+        EngineCache* cache_ = nullptr;
+        std::unique_ptr<OCRWorker> worker_;
+    };
+
+    struct Stats {
+        uint32_t configs;      // Configurations holding engines
+        uint32_t idle;         // Engines waiting for work
+        uint64_t cold_starts;  // Requests that waited for Init()
+        uint64_t lease_waits;  // Times a request waited for a busy engine
+        uint64_t evictions;    // Engines closed after sitting idle
+    };
+
+    EngineCache(const EngineConfig& defaults, const Preprocessor* preprocessor,
+                size_t max_per_config, std::chrono::seconds idle_timeout);
+    // Closes every idle engine; leases must have been returned
+    ~EngineCache();
+
+    EngineCache(const EngineCache&) = delete;
+    EngineCache& operator=(const EngineCache&) = delete;
+
+    // Configuration of requests that ask for no particular language or
+    // engine mode
+    const EngineConfig& defaults() const { return defaults_; }
+
+    // Initializes one engine for each of `configs` now and keeps it however
+    // long it sits idle. Returns false if any failed to initialize.
+    bool preload(const std::vector<EngineConfig>& configs);
+
+    // A warm engine for `config`, waiting for one to load or be returned
+    // if none is idle. Empty, with `refused` set, if `config` names an
+    // invalid or uninstalled language or failed to initialize recently
+    // (ERROR_INVALID_CONFIG), if `deadline` passes (ERROR_TIMEOUT) or
+    // `cancelled` returns true (ERROR_CANCELLED) first, or if the cache is
+    // shutting down (ERROR_UNAVAILABLE).
+    Lease acquire(const EngineConfig& config,
+                  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max(),
+                  const CancelCheck& cancelled = nullptr, ocr::ErrorCode* refused = nullptr);
+
+    Stats stats() const;
+
+private:
+    struct Shelf {
+        // Most recently returned last, with the time each was returned
+        std::vector<std::pair<std::unique_ptr<OCRWorker>, std::chrono::steady_clock::time_point>> idle;
+        size_t engines = 0;  // Idle, checked out or being warmed
+        size_t warming = 0;  // Of those, queued for or in Init()
+        bool pinned = false;
+    };
+
+    void release(std::unique_ptr<OCRWorker> worker);
+    // Requires mutex_. Has the background thread initialize one more
+    // engine of `config`, counted on `shelf`.
+    void warmLocked(const EngineConfig& config, Shelf& shelf);
+    // Require mutex_. Whether `name` failed to initialize recently; and
+    // recording that an engine of `name` just failed, giving back the slot
+    // it took.
+    bool failedLocked(const std::string& name);
+    void markFailedLocked(const std::string& name);
+    // Background thread: warms a spare engine for configurations that ran
+    // dry and closes engines idle past idle_timeout_
+    void maintain();
+    // Requires mutex_. Takes out the engines idle since before `cutoff`,
+    // and drops failures that have run their course.
+    void evictLocked(std::chrono::steady_clock::time_point cutoff,
+                     std::vector<std::unique_ptr<OCRWorker>>& evicted);
+
+    const EngineConfig defaults_;
+    const Preprocessor* preprocessor_;
+    const size_t max_per_config_;
+    const std::chrono::seconds idle_timeout_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable wake_;      // Maintainer: work to do or stopping
+    std::condition_variable returned_;  // Acquirers: an engine became idle or failed
+    std::unordered_map<std::string, Shelf> shelves_;  // By EngineConfig::name()
+    // Configurations whose engine failed to initialize, until when to refuse them
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> failed_;
+    std::vector<EngineConfig> to_warm_;
+    bool stopping_ = false;
+
+    std::atomic<uint64_t> cold_starts_{0};
+    std::atomic<uint64_t> lease_waits_{0};
+    std::atomic<uint64_t> evictions_{0};
+    std::thread maintainer_;
+};
+
+// The engine for a request with `config`, set up for it: `own` if it has
+// the right language and engine mode, else one leased from `cache` into
+// `lease`, waiting no later than `deadline` and only while `cancelled`
+// returns false. Null if there is none; `refused` then says why, as for
+// EngineCache::acquire().
+OCRWorker* engineFor(const ocr::OCRConfig& config, OCRWorker& own, EngineCache* cache,
+                     EngineCache::Lease& lease, std::chrono::steady_clock::time_point deadline,
+                     const CancelCheck& cancelled, ocr::ErrorCode* refused);
+
+#endif // ENGINE_CACHE_H
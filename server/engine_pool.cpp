@@ -0,0 +1,102 @@
+#include "engine_pool.h"
+#include <algorithm>
+#include <iostream>
+
+EnginePool::Lease::Lease(EnginePool* pool, std::unique_ptr<OCRWorker> worker)
+    : pool_(pool), worker_(std::move(worker)) {}
+
+EnginePool::Lease::Lease(Lease&& other) noexcept
+    : pool_(other.pool_), worker_(std::move(other.worker_)) {
+    other.pool_ = nullptr;
+}
+
+EnginePool::Lease& EnginePool::Lease::operator=(Lease&& other) noexcept {
+    if (this != &other) {
+        reset();
+        pool_ = other.pool_;
+        worker_ = std::move(other.worker_);
+        other.pool_ = nullptr;
+    }
+    return *this;
+}
+
+EnginePool::Lease::~Lease() {
+    reset();
+}
+
+void EnginePool::Lease::reset() {
+    if (pool_ && worker_) {
+        pool_->release(std::move(worker_));
+    }
+    pool_ = nullptr;
+}
+
+EnginePool::EnginePool(size_t size, std::chrono::milliseconds max_wait,
+                       const Preprocessor* preprocessor, const EngineConfig& config,
+                       const std::vector<unsigned>& lane_weights)
+    : stride_(lane_weights), waiting_(stride_.lanes()), size_(0), max_wait_(max_wait) {
+    for (size_t i = 0; i < size; ++i) {
+        auto worker = std::make_unique<OCRWorker>(preprocessor, config);
+        if (!worker->isInitialized()) {
+            std::cerr << "Skipping pooled engine " << i << ": initialization failed" << std::endl;
+            continue;
+        }
+        idle_.push_back(std::move(worker));
+    }
+    size_ = idle_.size();
+}
+
+EnginePool::Lease EnginePool::acquire(std::chrono::steady_clock::time_point deadline, size_t lane) {
+    auto wait_until = deadline;
+    auto now = std::chrono::steady_clock::now();
+    if (max_wait_ < deadline - now) {
+        wait_until = now + max_wait_;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    // A free engine is only up for grabs when nobody is queued for one
+    if (!idle_.empty() && waiters_ == 0) {
+        std::unique_ptr<OCRWorker> worker = std::move(idle_.back());
+        idle_.pop_back();
+        return Lease(this, std::move(worker));
+    }
+    if (size_ == 0 || wait_until <= now) {
+        return Lease();
+    }
+
+    lane = stride_.clamp(lane);
+    if (waiting_[lane].empty()) {
+        stride_.activate(lane);
+    }
+    Waiter self;
+    waiting_[lane].push_back(&self);
+    ++waiters_;
+    if (!self.ready.wait_until(lock, wait_until, [&self] { return self.worker != nullptr; })) {
+        // Timed out before release() chose this caller
+        auto& queue = waiting_[lane];
+        queue.erase(std::find(queue.begin(), queue.end(), &self));
+        --waiters_;
+        return Lease();
+    }
+    return Lease(this, std::move(self.worker));
+}
+
+size_t EnginePool::available() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return idle_.size();
+}
+
+void EnginePool::release(std::unique_ptr<OCRWorker> worker) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (waiters_ == 0) {
+        idle_.push_back(std::move(worker));
+        return;
+    }
+    size_t lane = stride_.next([this](size_t i) { return !waiting_[i].empty(); });
+    Waiter* waiter = waiting_[lane].front();
+    waiting_[lane].pop_front();
+    --waiters_;
+    waiter->worker = std::move(worker);
+    // Under the lock: once it is released the waiter may return and go away
+    waiter->ready.notify_one();
+}
@@ -0,0 +1,85 @@
+#ifndef ENGINE_POOL_H
+#define ENGINE_POOL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "SchedulingQueue.hpp"
+#include "ocr_worker.h"
+
+// Fixed-size pool of initialized OCR engines. Callers check an engine out
+// with acquire() and it returns to the pool when the Lease goes away, so the
+// Tesseract Init() cost is paid once at startup instead of once per request.
+class EnginePool {
+public:
+    // Move-only handle to a checked-out engine. An empty lease means no
+    // engine became available before the deadline.
+    class Lease {
+    public:
+        Lease() = default;
+        Lease(Lease&& other) noexcept;
+        Lease& operator=(Lease&& other) noexcept;
+        ~Lease();
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        explicit operator bool() const { return worker_ != nullptr; }
+        OCRWorker* operator->() const { return worker_.get(); }
+        OCRWorker& operator*() const { return *worker_; }
+
+    private:
+        friend class EnginePool;
+        Lease(EnginePool* pool, std::unique_ptr<OCRWorker> worker);
+        void reset();
+
+        EnginePool* pool_ = nullptr;
+        std::unique_ptr<OCRWorker> worker_;
+    };
+
+    // Creates up to `size` engines for `config` up front. `max_wait` bounds
+    // how long acquire() blocks when every engine is checked out; zero
+    // fails fast. `lane_weights` share freed engines between lanes of
+    // waiting callers, as SchedulingQueue shares workers.
+    EnginePool(size_t size, std::chrono::milliseconds max_wait,
+               const Preprocessor* preprocessor = nullptr,
+               const EngineConfig& config = EngineConfig(),
+               const std::vector<unsigned>& lane_weights = {1});
+
+    EnginePool(const EnginePool&) = delete;
+    EnginePool& operator=(const EnginePool&) = delete;
+
+    // Waits until an engine is free, max_wait elapses or `deadline` passes,
+    // whichever comes first. With callers waiting, each freed engine goes
+    // to the lane whose turn it is by weight, and within a lane to the
+    // longest waiting caller.
+    Lease acquire(std::chrono::steady_clock::time_point deadline =
+                      std::chrono::steady_clock::time_point::max(),
+                  size_t lane = 0);
+
+    size_t size() const { return size_; }
+    size_t available() const;
+
+private:
+    // A caller blocked in acquire(); release() hands it an engine directly
+    struct Waiter {
+        std::unique_ptr<OCRWorker> worker;
+        std::condition_variable ready;
+    };
+
+    void release(std::unique_ptr<OCRWorker> worker);
+
+    std::vector<std::unique_ptr<OCRWorker>> idle_;
+    LaneStride stride_;
+    std::vector<std::deque<Waiter*>> waiting_;  // Per lane, longest waiting first
+    size_t waiters_ = 0;
+    size_t size_;
+    std::chrono::milliseconds max_wait_;
+    mutable std::mutex mutex_;
+};
+
+#endif // ENGINE_POOL_H
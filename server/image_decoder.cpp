@@ -0,0 +1,224 @@
+#include "image_decoder.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <leptonica/allheaders.h>
+#include <opencv2/imgcodecs.hpp>
+
+namespace {
+
+const l_uint8* bytes(std::string_view imageData) {
+    return reinterpret_cast<const l_uint8*>(imageData.data());
+}
+
+bool startsWith(std::string_view imageData, std::string_view signature) {
+    return imageData.substr(0, signature.size()) == signature;
+}
+
+uint32_t readBigEndian32(const unsigned char* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+uint16_t readBigEndian16(const unsigned char* p) {
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+uint32_t readLittleEndian32(const unsigned char* p) {
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+std::vector<Pix*> readTiffPages(std::string_view imageData) {
+    std::vector<Pix*> pages;
+    PIXA* pixa = pixaReadMemMultipageTiff(bytes(imageData), imageData.size());
+    if (!pixa) {
+        return pages;
+    }
+    // Clones share the pixels, so each page is freed once its own
+    // reference is destroyed
+    for (l_int32 i = 0; i < pixaGetCount(pixa); ++i) {
+        if (PIX* page = pixaGetPix(pixa, i, L_CLONE)) {
+            pages.push_back(page);
+        }
+    }
+    pixaDestroy(&pixa);
+    return pages;
+}
+
+const ImageDecoder kDecoders[] = {
+    {ImageFormat::kPng, "png",
+     [](std::string_view data) { return startsWith(data, std::string_view("\x89PNG\r\n\x1a\n", 8)); },
+     [](std::string_view data, int) { return pixReadMemPng(bytes(data), data.size()); },
+     nullptr, false},
+    {ImageFormat::kJpeg, "jpeg",
+     [](std::string_view data) { return startsWith(data, "\xFF\xD8\xFF"); },
+     [](std::string_view data, int reduction) {
+         return pixReadMemJpeg(bytes(data), data.size(), 0, reduction, nullptr, 0);
+     },
+     nullptr, true},
+    {ImageFormat::kBmp, "bmp",
+     [](std::string_view data) { return startsWith(data, "BM"); },
+     [](std::string_view data, int) { return pixReadMemBmp(bytes(data), data.size()); },
+     nullptr, false},
+    {ImageFormat::kTiff, "tiff",
+     [](std::string_view data) {
+         return startsWith(data, std::string_view("II*\0", 4)) || startsWith(data, std::string_view("MM\0*", 4));
+     },
+     [](std::string_view data, int) { return pixReadMemTiff(bytes(data), data.size(), 0); },
+     readTiffPages, false},
+    {ImageFormat::kWebP, "webp",
+     [](std::string_view data) { return data.size() >= 12 && startsWith(data, "RIFF") && data.substr(8, 4) == "WEBP"; },
+     [](std::string_view data, int) { return pixReadMemWebP(bytes(data), data.size()); },
+     nullptr, false},
+    {ImageFormat::kPnm, "pnm",
+     // P1-P6 are PBM/PGM/PPM in text or binary, P7 is PAM; the magic
+     // number is always followed by whitespace
+     [](std::string_view data) {
+         return data.size() >= 3 && data[0] == 'P' && data[1] >= '1' && data[1] <= '7' &&
+                std::isspace(static_cast<unsigned char>(data[2]));
+     },
+     [](std::string_view data, int) { return pixReadMemPnm(bytes(data), data.size()); },
+     nullptr, false},
+};
+
+// Copies an image of any depth into an 8-bit gray Mat
+cv::Mat grayFromPix(Pix* pix) {
+    PIX* gray = pixConvertTo8(pix, 0);
+    if (!gray) {
+        return cv::Mat();
+    }
+    cv::Mat image(pixGetHeight(gray), pixGetWidth(gray), CV_8UC1);
+    const l_uint32* data = pixGetData(gray);
+    l_int32 wpl = pixGetWpl(gray);
+    for (int y = 0; y < image.rows; ++y) {
+        const l_uint32* line = data + static_cast<size_t>(y) * wpl;
+        unsigned char* row = image.ptr<unsigned char>(y);
+        for (int x = 0; x < image.cols; ++x) {
+            row[x] = static_cast<unsigned char>(GET_DATA_BYTE(line, x));
+        }
+    }
+    pixDestroy(&gray);
+    return image;
+}
+
+} // namespace
+
+const ImageDecoder* findDecoder(std::string_view imageData) {
+    for (const ImageDecoder& decoder : kDecoders) {
+        if (decoder.matches(imageData)) {
+            return &decoder;
+        }
+    }
+    return nullptr;
+}
+
+int sniffResolution(std::string_view imageData) {
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(imageData.data());
+    size_t size = imageData.size();
+
+    static const unsigned char kPngSignature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    if (size >= 8 && std::equal(kPngSignature, kPngSignature + 8, data)) {
+        size_t pos = 8;
+        while (pos + 8 <= size) {
+            uint32_t length = readBigEndian32(data + pos);
+            std::string_view type(reinterpret_cast<const char*>(data + pos + 4), 4);
+            if (type == "pHYs" && length >= 9 && pos + 8 + 9 <= size) {
+                const unsigned char* phys = data + pos + 8;
+                uint32_t pixels_per_unit = readBigEndian32(phys);
+                if (phys[8] == 1) {  // Unit is the metre
+                    return static_cast<int>(std::lround(pixels_per_unit * 0.0254));
+                }
+                return 0;
+            }
+            if (type == "IDAT" || type == "IEND") {
+                break;
+            }
+            pos += 12 + static_cast<size_t>(length);
+        }
+        return 0;
+    }
+
+    if (size >= 4 && data[0] == 0xFF && data[1] == 0xD8) {
+        size_t pos = 2;
+        while (pos + 4 <= size && data[pos] == 0xFF) {
+            unsigned char marker = data[pos + 1];
+            uint16_t length = readBigEndian16(data + pos + 2);
+            if (marker == 0xDA) {  // Start of scan: no more headers
+                break;
+            }
+            if (marker == 0xE0 && length >= 14 && pos + 2 + length <= size &&
+                std::memcmp(data + pos + 4, "JFIF\0", 5) == 0) {
+                const unsigned char* jfif = data + pos + 4;
+                unsigned char units = jfif[7];
+                uint16_t density = readBigEndian16(jfif + 8);
+                if (units == 1) {
+                    return density;
+                }
+                if (units == 2) {  // Dots per centimetre
+                    return static_cast<int>(std::lround(density * 2.54));
+                }
+                return 0;
+            }
+            pos += 2 + static_cast<size_t>(length);
+        }
+        return 0;
+    }
+
+    // BITMAPINFOHEADER (40 bytes) or later, after the 14-byte file header
+    if (size >= 14 + 40 && data[0] == 'B' && data[1] == 'M' && readLittleEndian32(data + 14) >= 40) {
+        uint32_t pixels_per_metre = readLittleEndian32(data + 14 + 24);
+        return static_cast<int>(std::lround(pixels_per_metre * 0.0254));
+    }
+    return 0;
+}
+
+int decodeReduction(const ImageDecoder& decoder, int dpi, int target_dpi) {
+    if (!decoder.reduces || dpi <= 0 || target_dpi <= 0) {
+        return 1;
+    }
+    int reduction = 1;
+    while (reduction < 8 && dpi / (reduction * 2) >= target_dpi) {
+        reduction *= 2;
+    }
+    return reduction;
+}
+
+Pix* decodePix(const ImageDecoder& decoder, std::string_view imageData, int reduction) {
+    return decoder.read(imageData, decoder.reduces ? reduction : 1);
+}
+
+cv::Mat decodeMat(const ImageDecoder& decoder, std::string_view imageData, bool gray, int reduction) {
+    if (!decoder.reduces) {
+        reduction = 1;
+    }
+    int flags = gray ? cv::IMREAD_GRAYSCALE : cv::IMREAD_COLOR;
+    switch (reduction) {
+    case 2:
+        flags = gray ? cv::IMREAD_REDUCED_GRAYSCALE_2 : cv::IMREAD_REDUCED_COLOR_2;
+        break;
+    case 4:
+        flags = gray ? cv::IMREAD_REDUCED_GRAYSCALE_4 : cv::IMREAD_REDUCED_COLOR_4;
+        break;
+    case 8:
+        flags = gray ? cv::IMREAD_REDUCED_GRAYSCALE_8 : cv::IMREAD_REDUCED_COLOR_8;
+        break;
+    }
+
+    // Wrap the payload without copying it
+    cv::Mat encoded(1, static_cast<int>(imageData.size()), CV_8UC1,
+                    const_cast<char*>(imageData.data()));
+    cv::Mat image = cv::imdecode(encoded, flags);
+    if (!image.empty()) {
+        return image;
+    }
+
+    // OpenCV is built without some codecs (WebP is optional)
+    PIX* pix = decodePix(decoder, imageData, reduction);
+    if (!pix) {
+        return image;
+    }
+    image = grayFromPix(pix);
+    pixDestroy(&pix);
+    return image;
+}
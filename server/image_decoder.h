@@ -0,0 +1,52 @@
+#ifndef IMAGE_DECODER_H
+#define IMAGE_DECODER_H
+
+#include <string_view>
+#include <vector>
+#include <opencv2/core.hpp>
+
+struct Pix;
+
+enum class ImageFormat { kPng, kJpeg, kBmp, kTiff, kWebP, kPnm };
+
+// How to read one image format. Leptonica hands Tesseract a Pix with no
+// conversion, so it reads images that go straight to OCR; images that go
+// through a cv::Mat (preprocessing, band splitting) are read with OpenCV.
+struct ImageDecoder {
+    ImageFormat format;
+    const char* name;
+    // True if the leading bytes of an image are this format's signature
+    bool (*matches)(std::string_view imageData);
+    // Leptonica reader for the first (or only) image. `reduction` is 1, 2,
+    // 4 or 8 and is only ever more than 1 for a decoder that `reduces`.
+    Pix* (*read)(std::string_view imageData, int reduction);
+    // Reader for every page, for formats that may hold several; else null
+    std::vector<Pix*> (*read_pages)(std::string_view imageData);
+    // Can decode at 1/2, 1/4 or 1/8 scale for a fraction of the full cost
+    bool reduces;
+};
+
+// Decoder for `imageData`, chosen from its leading bytes; the name a
+// client gave the format is not trusted. Null if no decoder recognizes it.
+// Adding a format means adding an entry to the table in image_decoder.cpp.
+const ImageDecoder* findDecoder(std::string_view imageData);
+
+// Reads the resolution stored in a PNG pHYs chunk, a JPEG JFIF header or a
+// BMP info header. Returns 0 when the file does not say.
+int sniffResolution(std::string_view imageData);
+
+// Scale (1, 2, 4 or 8) at which to decode an image of `dpi` so that it
+// stays at or above `target_dpi`. 1 if either is unknown (0) or the
+// decoder cannot reduce.
+int decodeReduction(const ImageDecoder& decoder, int dpi, int target_dpi);
+
+// Decodes with Leptonica at 1/`reduction` scale. Null on failure; the
+// caller owns (and must pixDestroy) the result.
+Pix* decodePix(const ImageDecoder& decoder, std::string_view imageData, int reduction = 1);
+
+// Decodes with OpenCV at 1/`reduction` scale to 8-bit gray or BGR, falling
+// back to Leptonica (gray) for a format this OpenCV build cannot read.
+// Empty on failure. The bytes are not copied.
+cv::Mat decodeMat(const ImageDecoder& decoder, std::string_view imageData, bool gray, int reduction = 1);
+
+#endif // IMAGE_DECODER_H
@@ -0,0 +1,16 @@
+#include "image_payload.h"
+
+ImagePayload::ImagePayload(std::string&& bytes) {
+    auto owner = std::make_shared<const std::string>(std::move(bytes));
+    data_ = owner->data();
+    size_ = owner->size();
+    owner_ = std::move(owner);
+}
+
+ImagePayload::ImagePayload(std::shared_ptr<const std::string> owner, size_t offset, size_t size)
+    : ImagePayload(owner, std::string_view(owner->data() + offset, size)) {}
+
+ImagePayload::ImagePayload(std::shared_ptr<const void> owner, std::string_view bytes)
+    : owner_(std::move(owner)),
+      data_(bytes.data()),
+      size_(bytes.size()) {}
@@ -0,0 +1,36 @@
+#ifndef IMAGE_PAYLOAD_H
+#define IMAGE_PAYLOAD_H
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Read-only image bytes plus whatever keeps them alive. A payload either
+// adopts a moved-in buffer (e.g. the string parsed out of an ImageRequest)
+// or aliases a slice of a larger shared buffer or mapped file, so handing
+// image bytes from the RPC layer to a worker never copies them.
+class ImagePayload {
+public:
+    ImagePayload() = default;
+
+    // Takes ownership of `bytes` without copying them.
+    explicit ImagePayload(std::string&& bytes);
+
+    // Aliases [offset, offset + size) of a shared buffer.
+    ImagePayload(std::shared_ptr<const std::string> owner, size_t offset, size_t size);
+
+    // Aliases `bytes`, which stay valid as long as `owner` lives.
+    ImagePayload(std::shared_ptr<const void> owner, std::string_view bytes);
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    std::string_view view() const { return std::string_view(data_, size_); }
+
+private:
+    std::shared_ptr<const void> owner_;
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+#endif // IMAGE_PAYLOAD_H
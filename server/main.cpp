@@ -1,15 +1,30 @@
 #include <iostream>
+#include <sstream>
 #include <thread>
 #include <vector>
-#include <queue>
-#include <mutex>
-#include <condition_variable>
+#include <string>
 #include <memory>
+#include <functional>
+#include <future>
 #include <grpcpp/grpcpp.h>
-#include <leptonica/allheaders.h>
-#include <tesseract/baseapi.h>
+#include <grpcpp/health_check_service_interface.h>
 
 #include "ocr.grpc.pb.h"
+#include "ocr_worker.h"
+#include "engine_pool.h"
+#include "engine_cache.h"
+#include "stream_session.h"
+#include "image_payload.h"
+#include "ocr_dispatcher.h"
+#include "async_server.h"
+#include "result_cache.h"
+#include "metrics.h"
+#include "metrics_endpoint.h"
+#include "scheduling.h"
+#include "batch.h"
+#include "upload_spool.h"
+#include "cluster.h"
+#include "coordinator.h"
 
 using grpc::Server;
 using grpc::ServerBuilder;
@@ -20,265 +35,569 @@ using ocr::OCRService;
 using ocr::ImageRequest;
 using ocr::ImageResponse;
 
-// Thread-safe queue for image processing tasks
-template<typename T>
-class ThreadSafeQueue {
+// Synchronous OCR Service Implementation. gRPC's own thread pool runs the
+// handlers; streamed images go to the shared dispatcher, unary calls run on
+// a pooled engine in the handler thread.
+class OCRServiceImpl final : public OCRService::Service {
 private:
-    std::queue<T> queue_;
-    mutable std::mutex mutex_;
-    std::condition_variable condition_;
+    OCRDispatcher& dispatcher_;
+    ResultCache* cache_;        // Optional; shared with the dispatcher
+    const Preprocessor* preprocessor_;
+    EngineCache* engines_;      // Other configurations; shared with the dispatcher
+    EnginePool unary_engines_;  // Shared engines for the unary ProcessImage path
+    UploadLimits upload_limits_;
 
 public:
-    void push(T item) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        queue_.push(item);
-        condition_.notify_one();
-    }
-
-    bool tryPop(T& item) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (queue_.empty()) {
-            return false;
-        }
-        item = queue_.front();
-        queue_.pop();
-        return true;
+    OCRServiceImpl(OCRDispatcher& dispatcher, ResultCache* cache, const Preprocessor* preprocessor,
+                   EngineCache* engines, int unary_engines = 4,
+                   std::chrono::milliseconds admission_wait = std::chrono::milliseconds(2000),
+                   const UploadLimits& upload_limits = UploadLimits())
+        : dispatcher_(dispatcher), cache_(cache), preprocessor_(preprocessor), engines_(engines),
+          unary_engines_(unary_engines, admission_wait, preprocessor,
+                         engines ? engines->defaults() : EngineConfig(), laneWeights()),
+          upload_limits_(upload_limits) {
     }
 
-    void waitAndPop(T& item) {
-        std::unique_lock<std::mutex> lock(mutex_);
-        condition_.wait(lock, [this] { return !queue_.empty(); });
-        item = queue_.front();
-        queue_.pop();
-    }
+    Status ProcessImageStream(
+        ServerContext* context,
+        ServerReaderWriter<ImageResponse, ImageRequest>* stream
+    ) override {
+        auto session = std::make_shared<StreamSession>(kDefaultStreamWindow);
+        ServerMetrics& metrics = serverMetrics();
+        metrics.active_streams.fetch_add(1);
+
+        // Only this thread writes to the stream, so workers never block on
+        // the socket. Failed writes (client gone) still free their slot.
+        std::thread writer([session, stream] {
+            ImageResponse response;
+            bool open = true;
+            while (session->nextResponse(response)) {
+                if (open) {
+                    StageTimer timer(ServerMetrics::kWrite);
+                    open = stream->Write(response);
+                }
+                session->responseWritten(response);
+            }
+        });
 
-    bool empty() const {
-        std::lock_guard<std::mutex> lock(mutex_);
-        return queue_.empty();
-    }
-};
+        ImageRequest request;
 
-// OCR Worker class
-class OCRWorker {
-private:
-    std::unique_ptr<tesseract::TessBaseAPI> tess_;
-    bool initialized_;
+        auto read_started = std::chrono::steady_clock::now();
+        while (stream->Read(&request)) {
+            metrics.record(ServerMetrics::kReceive, nanosSince(read_started));
 
-public:
-    OCRWorker() : initialized_(false) {
-        tess_ = std::make_unique<tesseract::TessBaseAPI>();
-        // Initialize Tesseract with English language
-        if (tess_->Init(nullptr, "eng")) {
-            std::cerr << "Could not initialize tesseract" << std::endl;
-            initialized_ = false;
-        } else {
-            initialized_ = true;
-        }
-    }
+            // Wait for room in this stream's window before queueing more
+            session->acquireSlot();
 
-    ~OCRWorker() {
-        if (initialized_) {
-            tess_->End();
+            // Create processing task, taking over the parsed request's
+            // buffers instead of copying them
+            ProcessingTask task;
+            applySchedule(task, request, *context);
+            task.image_id = std::move(*request.mutable_image_id());
+            task.image_data = ImagePayload(std::move(*request.mutable_image_data()));
+            task.image_format = std::move(*request.mutable_image_format());
+            task.output = request.output();
+            task.config = request.config();
+            task.page_results = true;
+            task.on_complete = [session](ImageResponse response) {
+                session->complete(std::move(response));
+            };
+            // Safe from any thread in the sync API; the handler outlives
+            // every task it queued
+            task.is_cancelled = [context] { return context->IsCancelled(); };
+
+            // Add to queue for processing (blocks while the queue is full)
+            if (!dispatcher_.submit(std::move(task))) {
+                session->releaseSlot();
+                break;
+            }
+            read_started = std::chrono::steady_clock::now();
         }
-    }
 
-    bool isInitialized() const {
-        return initialized_;
+        // Keep the call open until every queued image has been answered
+        session->close();
+        writer.join();
+        metrics.active_streams.fetch_sub(1);
+        return Status::OK;
     }
 
-    std::string processImage(const std::string& imageData, const std::string& format) {
-        if (!initialized_) {
-            return "Error: OCR engine not initialized";
+    Status ProcessBatch(
+        ServerContext* context,
+        const ocr::BatchRequest* batch,
+        grpc::ServerWriter<ocr::BatchResponse>* writer
+    ) override {
+        std::string error;
+        std::vector<size_t> offsets = batchOffsets(*batch, error);
+        if (!error.empty()) {
+            return Status(grpc::StatusCode::INVALID_ARGUMENT, error);
         }
 
-        try {
-            // Convert image data to PIX format
-            PIX* pix = nullptr;
-            if (format == "png") {
-                pix = pixReadMemPng(reinterpret_cast<const l_uint8*>(imageData.data()), imageData.size());
-            } else if (format == "jpg" || format == "jpeg") {
-                pix = pixReadMemJpeg(reinterpret_cast<const l_uint8*>(imageData.data()), imageData.size(), 0);
-            } else {
-                return "Error: Unsupported image format";
+        // Every task aliases the request's own buffer. Nothing needs to
+        // own it: this handler, and with it the request, outlives every
+        // task it queues.
+        std::shared_ptr<const std::string> packed(std::shared_ptr<const std::string>(), &batch->packed());
+        BatchSchedule schedule(*batch, *context);
+
+        // Same window and single writer as a stream, but each write carries
+        // every result finished since the last one
+        auto session = std::make_shared<StreamSession>(kDefaultStreamWindow);
+        std::thread results([session, writer] {
+            ocr::BatchResponse response;
+            bool open = true;
+            while (session->nextResponses(response, kMaxBatchResults)) {
+                if (open) {
+                    StageTimer timer(ServerMetrics::kWrite);
+                    open = writer->Write(response);
+                }
+                session->responseWritten(response);
             }
-
-            if (!pix) {
-                return "Error: Could not decode image";
+        });
+
+        for (size_t i = 0; i < offsets.size(); ++i) {
+            session->acquireSlot();
+            ProcessingTask task = batchTask(*batch, packed, offsets, i, schedule);
+            task.on_complete = [session](ImageResponse response) {
+                session->complete(std::move(response));
+            };
+            task.is_cancelled = [context] { return context->IsCancelled(); };
+            if (!dispatcher_.submit(std::move(task))) {
+                session->releaseSlot();
+                break;
             }
-
-            // Set image for OCR
-            tess_->SetImage(pix);
-
-            // Perform OCR
-            char* outText = tess_->GetUTF8Text();
-            std::string result = outText ? outText : "";
-            
-            // Cleanup
-            delete[] outText;
-            pixDestroy(&pix);
-
-            return result;
-        } catch (const std::exception& e) {
-            return std::string("Error: ") + e.what();
         }
-    }
-};
-
-// Task structure for worker threads
-struct ProcessingTask {
-    std::string image_id;
-    std::string image_data;
-    std::string image_format;
-    ServerReaderWriter<ImageResponse, ImageRequest>* stream;
-    std::mutex* stream_mutex;  // Mutex for thread-safe stream writes
-};
 
-// OCR Service Implementation
-class OCRServiceImpl final : public OCRService::Service {
-private:
-    ThreadSafeQueue<ProcessingTask> task_queue_;
-    std::vector<std::thread> worker_threads_;
-    std::vector<std::unique_ptr<OCRWorker>> workers_;
-    std::atomic<bool> running_;
-    int num_workers_;
-
-    void workerThread(int worker_id) {
-        while (running_) {
-            ProcessingTask task;
-            if (task_queue_.tryPop(task)) {
-                // Process the image
-                std::string extracted_text = workers_[worker_id]->processImage(
-                    task.image_data, 
-                    task.image_format
-                );
-
-                // Send response back through stream (thread-safe)
-                ImageResponse response;
-                response.set_image_id(task.image_id);
-                response.set_extracted_text(extracted_text);
-                response.set_success(!extracted_text.empty() && extracted_text.find("Error:") == std::string::npos);
-                
-                if (!response.success()) {
-                    response.set_error_message(extracted_text);
-                }
+        session->close();
+        results.join();
+        return Status::OK;
+    }
 
-                // Thread-safe write to stream
-                if (task.stream_mutex) {
-                    std::lock_guard<std::mutex> lock(*task.stream_mutex);
-                    task.stream->Write(response);
-                } else {
-                    task.stream->Write(response);
+    Status ProcessImage(
+        ServerContext* context,
+        const ImageRequest* request,
+        ImageResponse* response
+    ) override {
+        auto received_at = std::chrono::steady_clock::now();
+        auto deadline = requestDeadline(*request, *context, received_at);
+
+        // Answer repeated content from the cache, or wait for an identical
+        // image that another call is already processing. The cache holds
+        // text only, so structured output is always computed.
+        ResultCache* cache = wantsDetail(request->output()) ? nullptr : cache_;
+        ResultCache::Key key{};
+        if (cache) {
+            key = ResultCache::makeKey(request->image_data(),
+                                       ocrParams(preprocessor_, dispatcher_.engineDefaults(), request->config()));
+            std::string cached;
+            auto joined = std::make_shared<std::promise<OCRResult>>();
+            std::future<OCRResult> joined_result = joined->get_future();
+            switch (cache->begin(key, &cached, [joined](const OCRResult& result) {
+                        joined->set_value(result);
+                    })) {
+            case ResultCache::Lookup::kHit:
+                *response = buildResponse(request->image_id(), OCRResult::success(std::move(cached)));
+                return Status::OK;
+            case ResultCache::Lookup::kJoined:
+                if (joined_result.wait_until(context->deadline()) != std::future_status::ready) {
+                    return Status(grpc::StatusCode::DEADLINE_EXCEEDED, "Timed out waiting for identical image");
                 }
-            } else {
-                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                *response = buildResponse(request->image_id(), joined_result.get());
+                return Status::OK;
+            case ResultCache::Lookup::kLeader:
+                break;
             }
         }
-    }
 
-public:
-    OCRServiceImpl(int num_workers = 4) : running_(true), num_workers_(num_workers) {
-        // Initialize worker threads
-        for (int i = 0; i < num_workers_; ++i) {
-            workers_.push_back(std::make_unique<OCRWorker>());
-            worker_threads_.emplace_back(&OCRServiceImpl::workerThread, this, i);
-            std::cout << "Started worker thread " << i << std::endl;
+        // Single image processing (non-streaming) on a pooled engine.
+        // Wait for a free engine until the admission timeout or the
+        // request's deadline, then shed load instead of creating more.
+        // Freed engines are shared between priority lanes by weight, as
+        // queued tasks are.
+        auto wait_started = std::chrono::steady_clock::now();
+        EnginePool::Lease engine = unary_engines_.acquire(deadline, laneFor(request->priority()));
+        serverMetrics().record(ServerMetrics::kQueueWait, nanosSince(wait_started));
+        // A caller out of time gives its image up, unless others have
+        // joined it; once given up, the key is no longer this call's
+        bool expired = deadline <= std::chrono::steady_clock::now();
+        bool abandoned = engine && expired && (!cache || cache->abandon(key));
+        if (!engine || abandoned) {
+            Status status = unary_engines_.size() == 0
+                ? Status(grpc::StatusCode::UNAVAILABLE, "OCR engine not initialized")
+                : expired ? Status(grpc::StatusCode::DEADLINE_EXCEEDED, "Deadline exceeded before processing")
+                : Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "All OCR engines are busy");
+            if (expired) {
+                serverMetrics().expired_dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+            if (cache && !abandoned) {
+                // Release anyone who joined this key
+                ocr::ErrorCode error = unary_engines_.size() == 0 ? ocr::ERROR_UNAVAILABLE
+                    : expired ? ocr::ERROR_TIMEOUT : ocr::ERROR_OVERLOADED;
+                cache->finish(key, OCRResult::failure(error, status.error_message()));
+            }
+            return status;
         }
-    }
 
-    ~OCRServiceImpl() {
-        running_ = false;
-        for (auto& thread : worker_threads_) {
-            if (thread.joinable()) {
-                thread.join();
+        // Stop early if the caller hangs up or runs out of time, unless
+        // others have joined this image: then finish it for them
+        CancelCheck gone = [context, deadline, cache, &key, &abandoned] {
+            if (!context->IsCancelled() && std::chrono::steady_clock::now() < deadline) {
+                return false;
+            }
+            if (!abandoned) {
+                abandoned = !cache || cache->abandon(key);
             }
+            return abandoned;
+        };
+
+        // A pool slot bounds unary concurrency whichever engine runs the
+        // image; other configurations borrow one from the engine cache
+        EngineCache::Lease borrowed;
+        ocr::ErrorCode refused = ocr::ERROR_NONE;
+        OCRWorker* worker = engineFor(request->config(), *engine, engines_, borrowed, deadline, gone, &refused);
+
+        ImageResponse detail;
+        OCRResult result = worker ? worker->processImage(request->image_data(), gone, request->output(), &detail)
+                                  : noEngine(request->config(), refused);
+        // Given up while recognizing or while waiting for an engine
+        bool cancelled = result.error == ocr::ERROR_CANCELLED || result.error == ocr::ERROR_TIMEOUT;
+        if (result.error == ocr::ERROR_CANCELLED && std::chrono::steady_clock::now() >= deadline) {
+            result = OCRResult::failure(ocr::ERROR_TIMEOUT, "Deadline exceeded during processing");
         }
-    }
 
-    Status ProcessImageStream(
-        ServerContext* context,
-        ServerReaderWriter<ImageResponse, ImageRequest>* stream
-    ) override {
-        // Mutex for thread-safe writes to this stream
-        std::mutex stream_mutex;
-        
-        ImageRequest request;
-        
-        while (stream->Read(&request)) {
-            // Create processing task
-            ProcessingTask task;
-            task.image_id = request.image_id();
-            task.image_data = request.image_data();
-            task.image_format = request.image_format();
-            task.stream = stream;
-            task.stream_mutex = &stream_mutex;
-
-            // Add to queue for processing
-            task_queue_.push(task);
+        *response = buildResponse(request->image_id(), result);
+        if (response->success()) {
+            appendDetail(detail, *response);
         }
+        if (cache && !abandoned) {
+            cache->finish(key, result);
+        }
+        serverMetrics().record(ServerMetrics::kTotal, nanosSince(received_at));
 
+        if (cancelled) {
+            serverMetrics().cancelled.fetch_add(1, std::memory_order_relaxed);
+            return result.error == ocr::ERROR_TIMEOUT
+                ? Status(grpc::StatusCode::DEADLINE_EXCEEDED, result.message)
+                : Status(grpc::StatusCode::CANCELLED, result.message);
+        }
         return Status::OK;
     }
 
-    Status ProcessImage(
+    Status ProcessImageUpload(
         ServerContext* context,
-        const ImageRequest* request,
+        grpc::ServerReader<ocr::UploadChunk>* reader,
         ImageResponse* response
     ) override {
-        // Single image processing (non-streaming)
-        OCRWorker worker;
-        if (!worker.isInitialized()) {
-            response->set_success(false);
-            response->set_error_message("OCR engine not initialized");
-            return Status::OK;
+        UploadSpool spool(upload_limits_);
+        ocr::UploadChunk chunk;
+        std::string error;
+        while (!spool.complete() && reader->Read(&chunk)) {
+            if (!spool.add(chunk, error)) {
+                return Status(grpc::StatusCode::INVALID_ARGUMENT, error);
+            }
+        }
+        if (!spool.complete()) {
+            return context->IsCancelled()
+                ? Status(grpc::StatusCode::CANCELLED, "Request cancelled")
+                : Status(grpc::StatusCode::INVALID_ARGUMENT, "Upload ended without an end marker");
         }
 
-        std::string extracted_text = worker.processImage(
-            request->image_data(),
-            request->image_format()
-        );
-
-        response->set_image_id(request->image_id());
-        response->set_extracted_text(extracted_text);
-        response->set_success(!extracted_text.empty() && extracted_text.find("Error:") == std::string::npos);
-        
-        if (!response->success()) {
-            response->set_error_message(extracted_text);
+        // Large scans go through the dispatcher rather than a unary engine,
+        // so band splitting can spread them across workers
+        ProcessingTask task = uploadTask(spool, *context, error);
+        if (!error.empty()) {
+            return Status(grpc::StatusCode::INTERNAL, error);
         }
+        std::promise<ImageResponse> result;
+        std::future<ImageResponse> done = result.get_future();
+        task.on_complete = [&result](ImageResponse response) {
+            result.set_value(std::move(response));
+        };
+        task.is_cancelled = [context] { return context->IsCancelled(); };
+        if (!dispatcher_.submit(std::move(task))) {
+            return Status(grpc::StatusCode::UNAVAILABLE, "Server is shutting down");
+        }
+        *response = done.get();
+        return Status::OK;
+    }
 
+    Status GetStats(
+        ServerContext* context,
+        const ocr::StatsRequest* request,
+        ocr::StatsResponse* response
+    ) override {
+        *response = collectStats(dispatcher_);
         return Status::OK;
     }
 };
 
-void RunServer(const std::string& server_address = "0.0.0.0:50051", int num_workers = 4) {
-    OCRServiceImpl service(num_workers);
+// Queue capacity per worker; a full queue blocks (sync) or defers (async)
+// new work.
+constexpr size_t kQueueSlotsPerWorker = 16;
+
+struct ServerOptions {
+    std::string server_address = "0.0.0.0:50051";
+    int num_workers = 4;
+    int unary_engines = -1;       // Defaults to num_workers
+    int admission_wait_ms = 2000;
+    bool use_async = false;
+    int io_threads = 2;
+    size_t cache_mb = 64;         // 0 disables the result cache
+    std::string cache_file;       // Empty keeps the cache in memory only
+    PreprocessOptions preprocess; // OpenCV clean-up before OCR; off by default
+    int metrics_port = 0;         // Prometheus text endpoint on localhost; 0 disables
+    BandOptions bands;            // Splitting of tall images across workers; off by default
+    bool coordinator = false;     // Forward OCR to registered workers instead of running it
+    std::string join;             // Coordinator to register with as a worker; empty for none
+    std::string advertise;        // Address the coordinator uses to reach this worker
+    UploadLimits uploads;         // Memory and size limits for chunked uploads
+    EngineConfig engine;          // For requests that name no language or engine mode
+    std::vector<EngineConfig> preload;  // Other configurations to warm at startup
+    int engine_idle_s = 300;      // Close engines of other configurations idle this long
+};
+
+// Heartbeat interval the coordinator asks its workers for
+constexpr std::chrono::milliseconds kHeartbeatInterval(1000);
+
+// Serves the Prometheus text dump of `stats` while the server runs
+std::unique_ptr<MetricsEndpoint> StartMetricsEndpoint(const ServerOptions& options,
+                                                      std::function<ocr::StatsResponse()> stats) {
+    if (options.metrics_port <= 0) {
+        return nullptr;
+    }
+    auto endpoint = std::make_unique<MetricsEndpoint>([stats] {
+        return renderPrometheus(stats());
+    });
+    if (!endpoint->start(options.metrics_port)) {
+        std::cerr << "Could not open metrics endpoint on port " << options.metrics_port << std::endl;
+        return nullptr;
+    }
+    std::cout << "Metrics: http://127.0.0.1:" << options.metrics_port << "/metrics" << std::endl;
+    return endpoint;
+}
+
+std::unique_ptr<MetricsEndpoint> StartMetricsEndpoint(const ServerOptions& options,
+                                                      const OCRDispatcher& dispatcher) {
+    return StartMetricsEndpoint(options, [&dispatcher] { return collectStats(dispatcher); });
+}
+
+// Registers with the coordinator given by --join, if any
+std::unique_ptr<ClusterMember> JoinCluster(const ServerOptions& options, const OCRDispatcher& dispatcher) {
+    if (options.join.empty()) {
+        return nullptr;
+    }
+    std::cout << "Joining coordinator " << options.join << " as " << options.advertise << std::endl;
+    return std::make_unique<ClusterMember>(options.join, options.advertise, dispatcher);
+}
+
+void RunServer(const ServerOptions& options, ResultCache* cache, const Preprocessor* preprocessor,
+               EngineCache* engines) {
+    OCRDispatcher dispatcher(options.num_workers,
+                             static_cast<size_t>(options.num_workers) * kQueueSlotsPerWorker,
+                             cache, preprocessor, options.bands, engines);
+    OCRServiceImpl service(dispatcher, cache, preprocessor, engines, options.unary_engines,
+                           std::chrono::milliseconds(options.admission_wait_ms), options.uploads);
+    std::unique_ptr<MetricsEndpoint> metrics = StartMetricsEndpoint(options, dispatcher);
+
+    ServerBuilder builder;
+    builder.AddListeningPort(options.server_address, grpc::InsecureServerCredentials());
+    builder.RegisterService(&service);
+
+    std::unique_ptr<Server> server(builder.BuildAndStart());
+    std::cout << "Server listening on " << options.server_address << std::endl;
+    std::cout << "Press Ctrl+C to stop the server" << std::endl;
+    std::unique_ptr<ClusterMember> member = JoinCluster(options, dispatcher);
+
+    server->Wait();
+}
+
+void RunAsyncServer(const ServerOptions& options, ResultCache* cache, const Preprocessor* preprocessor,
+                    EngineCache* engines) {
+    OCRDispatcher dispatcher(options.num_workers,
+                             static_cast<size_t>(options.num_workers) * kQueueSlotsPerWorker,
+                             cache, preprocessor, options.bands, engines);
+    AsyncOCRServer server(dispatcher, options.io_threads, options.uploads);
+    std::unique_ptr<MetricsEndpoint> metrics = StartMetricsEndpoint(options, dispatcher);
+
+    std::cout << "Async server listening on " << options.server_address
+              << " with " << options.io_threads << " I/O threads" << std::endl;
+    std::cout << "Press Ctrl+C to stop the server" << std::endl;
+    // Registration takes a round trip to the coordinator, by which time
+    // run() is listening
+    std::unique_ptr<ClusterMember> member = JoinCluster(options, dispatcher);
+
+    server.run(options.server_address);
+}
+
+void RunCoordinator(const ServerOptions& options) {
+    WorkerRegistry registry(kHeartbeatInterval);
+    CoordinatorServiceImpl service(registry);
+    ClusterServiceImpl cluster(registry);
+    std::unique_ptr<MetricsEndpoint> metrics = StartMetricsEndpoint(options, [&registry] {
+        ocr::StatsResponse stats = collectProcessStats();
+        registry.fillStats(stats);
+        return stats;
+    });
 
     ServerBuilder builder;
-    builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
+    builder.AddListeningPort(options.server_address, grpc::InsecureServerCredentials());
     builder.RegisterService(&service);
+    builder.RegisterService(&cluster);
 
     std::unique_ptr<Server> server(builder.BuildAndStart());
-    std::cout << "Server listening on " << server_address << std::endl;
+    std::cout << "Coordinator listening on " << options.server_address
+              << "; waiting for workers to register" << std::endl;
     std::cout << "Press Ctrl+C to stop the server" << std::endl;
 
     server->Wait();
 }
 
+// The listening address with a wildcard host replaced by localhost, so a
+// coordinator on the same machine can reach it
+std::string defaultAdvertise(const std::string& server_address) {
+    for (const char* wildcard : {"0.0.0.0:", "[::]:"}) {
+        if (server_address.rfind(wildcard, 0) == 0) {
+            return "localhost:" + server_address.substr(std::string(wildcard).size());
+        }
+    }
+    return server_address;
+}
+
 int main(int argc, char** argv) {
-    std::string server_address = "0.0.0.0:50051";
-    int num_workers = 4;
+    ServerOptions options;
+    int split_bands = -1;  // Defaults to num_workers
+
+    // Flags may appear anywhere; everything else is positional
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--async") {
+            options.use_async = true;
+        } else if (arg.rfind("--io-threads=", 0) == 0) {
+            options.io_threads = std::stoi(arg.substr(13));
+        } else if (arg.rfind("--cache-mb=", 0) == 0) {
+            options.cache_mb = std::stoul(arg.substr(11));
+        } else if (arg.rfind("--cache-file=", 0) == 0) {
+            options.cache_file = arg.substr(13);
+        } else if (arg.rfind("--preprocess=", 0) == 0) {
+            if (!options.preprocess.parse(arg.substr(13))) {
+                std::cerr << "Unknown preprocessing step in " << arg
+                          << " (expected gray,rescale,binarize,deskew,crop,all,none)" << std::endl;
+                return 1;
+            }
+        } else if (arg.rfind("--target-dpi=", 0) == 0) {
+            options.preprocess.target_dpi = std::stoi(arg.substr(13));
+        } else if (arg.rfind("--assumed-dpi=", 0) == 0) {
+            options.preprocess.assumed_dpi = std::stoi(arg.substr(14));
+        } else if (arg == "--full-decode") {
+            options.preprocess.reduced_decode = false;
+        } else if (arg.rfind("--metrics-port=", 0) == 0) {
+            options.metrics_port = std::stoi(arg.substr(15));
+        } else if (arg.rfind("--split-height=", 0) == 0) {
+            options.bands.min_band_height = std::stoi(arg.substr(15));
+        } else if (arg.rfind("--split-bands=", 0) == 0) {
+            split_bands = std::stoi(arg.substr(14));
+        } else if (arg == "--coordinator") {
+            options.coordinator = true;
+        } else if (arg.rfind("--join=", 0) == 0) {
+            options.join = arg.substr(7);
+        } else if (arg.rfind("--advertise=", 0) == 0) {
+            options.advertise = arg.substr(12);
+        } else if (arg.rfind("--upload-memory-mb=", 0) == 0) {
+            options.uploads.memory_bytes = std::stoul(arg.substr(19)) * 1024 * 1024;
+        } else if (arg.rfind("--max-upload-mb=", 0) == 0) {
+            options.uploads.max_bytes = std::stoul(arg.substr(16)) * 1024 * 1024;
+        } else if (arg.rfind("--lang=", 0) == 0) {
+            options.engine.language = arg.substr(7);
+        } else if (arg.rfind("--preload-langs=", 0) == 0) {
+            std::stringstream langs(arg.substr(16));
+            EngineConfig config;
+            while (std::getline(langs, config.language, ',')) {
+                if (!config.language.empty()) {
+                    options.preload.push_back(config);
+                }
+            }
+        } else if (arg.rfind("--engine-idle-s=", 0) == 0) {
+            options.engine_idle_s = std::stoi(arg.substr(16));
+        } else {
+            positional.push_back(arg);
+        }
+    }
 
-    if (argc > 1) {
-        server_address = argv[1];
+    if (positional.size() > 0) {
+        options.server_address = positional[0];
+    }
+    if (positional.size() > 1) {
+        options.num_workers = std::stoi(positional[1]);
+    }
+    if (positional.size() > 2) {
+        options.unary_engines = std::stoi(positional[2]);
+    }
+    if (positional.size() > 3) {
+        options.admission_wait_ms = std::stoi(positional[3]);
     }
-    if (argc > 2) {
-        num_workers = std::stoi(argv[2]);
+    if (options.unary_engines < 0) {
+        options.unary_engines = options.num_workers;
+    }
+    options.bands.max_bands = split_bands < 0 ? options.num_workers : split_bands;
+    if (options.advertise.empty()) {
+        options.advertise = defaultAdvertise(options.server_address);
     }
 
     std::cout << "Starting OCR Server..." << std::endl;
-    std::cout << "Server address: " << server_address << std::endl;
-    std::cout << "Number of workers: " << num_workers << std::endl;
+    std::cout << "Server address: " << options.server_address << std::endl;
+
+    // Standard grpc.health.v1 service, used by clients to route around
+    // servers that are down
+    grpc::EnableDefaultHealthCheckService(true);
+
+    if (options.coordinator) {
+        // No local OCR: worker count, cache and preprocessing belong to the workers
+        std::cout << "Mode: coordinator" << std::endl;
+        RunCoordinator(options);
+        return 0;
+    }
+    std::cout << "Number of workers: " << options.num_workers << std::endl;
+
+    std::unique_ptr<ResultCache> cache;
+    if (options.cache_mb > 0) {
+        cache = std::make_unique<ResultCache>(options.cache_mb * 1024 * 1024, 16, options.cache_file);
+        std::cout << "Result cache: " << options.cache_mb << " MB"
+                  << (options.cache_file.empty() ? "" : ", persisted to " + options.cache_file)
+                  << std::endl;
+    }
+
+    Preprocessor preprocessor(options.preprocess);
+    if (options.preprocess.enabled()) {
+        std::cout << "Preprocessing: " << options.preprocess.signature() << std::endl;
+    }
+    if (options.bands.enabled()) {
+        std::cout << "Band splitting: up to " << options.bands.max_bands << " bands of at least "
+                  << options.bands.min_band_height << " px" << std::endl;
+    }
 
-    RunServer(server_address, num_workers);
+    if (!validLanguage(options.engine.language)) {
+        std::cerr << "Invalid --lang " << options.engine.language << std::endl;
+        return 1;
+    }
+    // At most every dispatcher and unary thread at once needs an engine of
+    // one configuration
+    EngineCache engines(options.engine, &preprocessor,
+                        static_cast<size_t>(options.num_workers + options.unary_engines),
+                        std::chrono::seconds(options.engine_idle_s));
+    engines.preload(options.preload);
+    std::cout << "Language: " << options.engine.language;
+    for (const EngineConfig& config : options.preload) {
+        std::cout << ", " << config.language << " (warm)";
+    }
+    std::cout << std::endl;
+
+    if (options.use_async) {
+        std::cout << "Engine: async (completion queues)" << std::endl;
+        RunAsyncServer(options, cache.get(), &preprocessor, &engines);
+    } else {
+        std::cout << "Engine: sync" << std::endl;
+        std::cout << "Unary engine pool: " << options.unary_engines
+                  << " (admission wait " << options.admission_wait_ms << " ms)" << std::endl;
+        RunServer(options, cache.get(), &preprocessor, &engines);
+    }
     return 0;
 }
-
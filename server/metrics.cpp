@@ -0,0 +1,228 @@
+#include "metrics.h"
+#include <algorithm>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+#include "ocr_dispatcher.h"
+
+namespace {
+
+constexpr uint64_t kFirstBucketNanos = 32000;  // 32 us
+
+// Spreads threads over the histogram shards round-robin
+int threadShard(int shards) {
+    static std::atomic<int> next{0};
+    thread_local int shard = next.fetch_add(1, std::memory_order_relaxed);
+    return shard % shards;
+}
+
+void raiseMax(std::atomic<uint64_t>& max, uint64_t value) {
+    uint64_t current = max.load(std::memory_order_relaxed);
+    while (value > current &&
+           !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+} // namespace
+
+uint64_t LatencyHistogram::bucketBound(int i) {
+    return kFirstBucketNanos << i;
+}
+
+void LatencyHistogram::record(int64_t nanos) {
+    uint64_t value = nanos > 0 ? static_cast<uint64_t>(nanos) : 0;
+    int bucket = 0;
+    while (bucket < kBuckets && value > bucketBound(bucket)) {
+        ++bucket;
+    }
+
+    Shard& shard = shards_[threadShard(kShards)];
+    shard.counts[bucket].fetch_add(1, std::memory_order_relaxed);
+    shard.sum_nanos.fetch_add(value, std::memory_order_relaxed);
+    raiseMax(shard.max_nanos, value);
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const {
+    Snapshot snap;
+    for (const Shard& shard : shards_) {
+        for (int i = 0; i <= kBuckets; ++i) {
+            uint64_t n = shard.counts[i].load(std::memory_order_relaxed);
+            snap.counts[i] += n;
+            snap.count += n;
+        }
+        snap.sum_nanos += shard.sum_nanos.load(std::memory_order_relaxed);
+        snap.max_nanos = std::max(snap.max_nanos, shard.max_nanos.load(std::memory_order_relaxed));
+    }
+    return snap;
+}
+
+double LatencyHistogram::Snapshot::quantileMs(double q) const {
+    if (count == 0) {
+        return 0.0;
+    }
+    uint64_t target = std::max<uint64_t>(1, static_cast<uint64_t>(q * count + 0.5));
+    uint64_t seen = 0;
+    for (int i = 0; i <= kBuckets; ++i) {
+        seen += counts[i];
+        if (seen >= target) {
+            // Never report more than the slowest request actually seen
+            uint64_t bound = i < kBuckets ? bucketBound(i) : max_nanos;
+            return std::min(bound, max_nanos) / 1e6;
+        }
+    }
+    return max_nanos / 1e6;
+}
+
+const char* ServerMetrics::stageName(Stage stage) {
+    switch (stage) {
+    case kReceive: return "receive";
+    case kQueueWait: return "queue_wait";
+    case kDecode: return "decode";
+    case kRescale: return "rescale";
+    case kBinarize: return "binarize";
+    case kDeskew: return "deskew";
+    case kCrop: return "crop";
+    case kRecognize: return "recognize";
+    case kWrite: return "write";
+    case kTotal: return "total";
+    default: return "unknown";
+    }
+}
+
+ServerMetrics& serverMetrics() {
+    static ServerMetrics metrics;
+    return metrics;
+}
+
+ocr::StatsResponse collectProcessStats() {
+    ocr::StatsResponse stats;
+    ServerMetrics& metrics = serverMetrics();
+    for (int i = 0; i < ServerMetrics::kStageCount; ++i) {
+        auto stage = static_cast<ServerMetrics::Stage>(i);
+        LatencyHistogram::Snapshot snap = metrics.snapshot(stage);
+        ocr::StageStats* out = stats.add_stages();
+        out->set_stage(ServerMetrics::stageName(stage));
+        out->set_count(snap.count);
+        out->set_sum_seconds(snap.sum_nanos / 1e9);
+        out->set_p50_ms(snap.quantileMs(0.50));
+        out->set_p95_ms(snap.quantileMs(0.95));
+        out->set_p99_ms(snap.quantileMs(0.99));
+        out->set_max_ms(snap.max_nanos / 1e6);
+        for (int b = 0; b <= LatencyHistogram::kBuckets; ++b) {
+            if (b < LatencyHistogram::kBuckets) {
+                out->add_bucket_bounds_seconds(LatencyHistogram::bucketBound(b) / 1e9);
+            }
+            out->add_bucket_counts(snap.counts[b]);
+        }
+    }
+    stats.set_active_streams(static_cast<uint32_t>(metrics.active_streams.load()));
+    stats.set_expired_dropped(metrics.expired_dropped.load(std::memory_order_relaxed));
+    stats.set_cancelled(metrics.cancelled.load(std::memory_order_relaxed));
+    stats.set_redispatched(metrics.redispatched.load(std::memory_order_relaxed));
+    return stats;
+}
+
+ocr::StatsResponse collectStats(const OCRDispatcher& dispatcher) {
+    ocr::StatsResponse stats = collectProcessStats();
+    stats.set_queue_depth(static_cast<uint32_t>(dispatcher.queueDepth()));
+    stats.set_queue_capacity(static_cast<uint32_t>(dispatcher.queueCapacity()));
+    stats.set_workers(static_cast<uint32_t>(dispatcher.numWorkers()));
+    stats.set_workers_busy(static_cast<uint32_t>(dispatcher.busyWorkers()));
+    stats.set_worker_utilization(dispatcher.utilization());
+    stats.set_uptime_seconds(dispatcher.uptimeSeconds());
+    for (int lane = 0; lane < kLaneCount; ++lane) {
+        stats.add_lane_depths(static_cast<uint32_t>(dispatcher.laneDepth(static_cast<Lane>(lane))));
+    }
+
+    if (const ResultCache* cache = dispatcher.cache()) {
+        ResultCache::Stats cache_stats = cache->stats();
+        stats.set_cache_hits(cache_stats.hits);
+        stats.set_cache_misses(cache_stats.misses);
+        stats.set_cache_joins(cache_stats.joins);
+        stats.set_cache_entries(cache_stats.entries);
+        stats.set_cache_bytes(cache_stats.bytes);
+        stats.set_cache_evictions(cache_stats.evictions);
+    }
+    if (const EngineCache* engines = dispatcher.engines()) {
+        EngineCache::Stats engine_stats = engines->stats();
+        stats.set_engine_configs(engine_stats.configs);
+        stats.set_engines_idle(engine_stats.idle);
+        stats.set_engine_cold_starts(engine_stats.cold_starts);
+        stats.set_engine_evictions(engine_stats.evictions);
+        stats.set_engine_lease_waits(engine_stats.lease_waits);
+    }
+    return stats;
+}
+
+std::string renderPrometheus(const ocr::StatsResponse& stats) {
+    std::ostringstream out;
+    // Integers print exactly; doubles need max_digits10 to survive the round trip.
+    out << std::setprecision(std::numeric_limits<double>::max_digits10);
+
+    out << "# HELP ocr_stage_duration_seconds Time spent in each request stage.\n"
+        << "# TYPE ocr_stage_duration_seconds histogram\n";
+    for (const ocr::StageStats& stage : stats.stages()) {
+        const std::string label = "stage=\"" + stage.stage() + "\"";
+        uint64_t cumulative = 0;
+        for (int b = 0; b < stage.bucket_bounds_seconds_size(); ++b) {
+            cumulative += stage.bucket_counts(b);
+            out << "ocr_stage_duration_seconds_bucket{" << label << ",le=\""
+                << stage.bucket_bounds_seconds(b) << "\"} " << cumulative << "\n";
+        }
+        out << "ocr_stage_duration_seconds_bucket{" << label << ",le=\"+Inf\"} " << stage.count() << "\n"
+            << "ocr_stage_duration_seconds_sum{" << label << "} " << stage.sum_seconds() << "\n"
+            << "ocr_stage_duration_seconds_count{" << label << "} " << stage.count() << "\n";
+    }
+
+    // Takes the field's own type so integer gauges never pass through a double.
+    auto gauge = [&out](const char* name, const char* help, auto value) {
+        out << "# HELP " << name << " " << help << "\n"
+            << "# TYPE " << name << " gauge\n"
+            << name << " " << value << "\n";
+    };
+    auto counter = [&out](const char* name, const char* help, uint64_t value) {
+        out << "# HELP " << name << " " << help << "\n"
+            << "# TYPE " << name << " counter\n"
+            << name << " " << value << "\n";
+    };
+
+    gauge("ocr_queue_depth", "Tasks waiting for a worker.", stats.queue_depth());
+    gauge("ocr_queue_capacity", "Size of the worker queue.", stats.queue_capacity());
+    gauge("ocr_workers", "OCR worker threads.", stats.workers());
+    gauge("ocr_workers_busy", "Workers currently running OCR.", stats.workers_busy());
+    gauge("ocr_worker_utilization", "Busy fraction of worker time since startup.",
+          stats.worker_utilization());
+    out << "# HELP ocr_lane_depth Tasks waiting for a worker, per scheduling lane.\n"
+        << "# TYPE ocr_lane_depth gauge\n";
+    for (int lane = 0; lane < stats.lane_depths_size(); ++lane) {
+        out << "ocr_lane_depth{lane=\"" << laneName(static_cast<Lane>(lane)) << "\"} "
+            << stats.lane_depths(lane) << "\n";
+    }
+    counter("ocr_expired_dropped_total", "Queued requests dropped because their deadline passed.",
+            stats.expired_dropped());
+    counter("ocr_cancelled_total", "Requests dropped or interrupted because their caller went away.",
+            stats.cancelled());
+    gauge("ocr_cluster_workers", "Live workers registered with this coordinator.", stats.cluster_workers());
+    counter("ocr_redispatched_total", "Images resent to another worker after theirs failed.",
+            stats.redispatched());
+    gauge("ocr_active_streams", "Open ProcessImageStream calls.", stats.active_streams());
+    gauge("ocr_uptime_seconds", "Seconds since the worker pool started.", stats.uptime_seconds());
+    counter("ocr_cache_hits_total", "Result cache hits.", stats.cache_hits());
+    counter("ocr_cache_misses_total", "Result cache misses.", stats.cache_misses());
+    counter("ocr_cache_joins_total", "Requests that joined an identical in-flight image.",
+            stats.cache_joins());
+    counter("ocr_cache_evictions_total", "Result cache evictions.", stats.cache_evictions());
+    gauge("ocr_cache_entries", "Results held in the cache.", stats.cache_entries());
+    gauge("ocr_cache_bytes", "Bytes of text held in the cache.", stats.cache_bytes());
+    gauge("ocr_engine_configs", "Language/engine mode combinations with engines besides the default.",
+          stats.engine_configs());
+    gauge("ocr_engines_idle", "Warm engines of those combinations waiting for work.", stats.engines_idle());
+    counter("ocr_engine_cold_starts_total", "Requests that waited for an engine to initialize.",
+            stats.engine_cold_starts());
+    counter("ocr_engine_evictions_total", "Engines closed after sitting idle.", stats.engine_evictions());
+    counter("ocr_engine_lease_waits_total", "Requests that waited for a busy engine of their combination.",
+            stats.engine_lease_waits());
+
+    return out.str();
+}
@@ -0,0 +1,118 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "ocr.pb.h"
+
+class OCRDispatcher;
+
+// Latency histogram with fixed power-of-two buckets, from 32 us up to about
+// two minutes. Recording is a few relaxed atomic adds on a shard picked per
+// thread, so hot paths never take a lock or share a cache line with another
+// recording thread; snapshot() sums the shards.
+class LatencyHistogram {
+public:
+    static constexpr int kBuckets = 23;  // Plus one overflow bucket
+
+    struct Snapshot {
+        uint64_t counts[kBuckets + 1] = {};  // Per bucket, not cumulative
+        uint64_t count = 0;
+        uint64_t sum_nanos = 0;
+        uint64_t max_nanos = 0;
+
+        // Upper bound of the bucket holding quantile `q` (0..1), in ms
+        double quantileMs(double q) const;
+    };
+
+    // Upper bound of bucket `i` in nanoseconds
+    static uint64_t bucketBound(int i);
+
+    void record(int64_t nanos);
+    Snapshot snapshot() const;
+
+private:
+    static constexpr int kShards = 16;
+
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> counts[kBuckets + 1] = {};
+        std::atomic<uint64_t> sum_nanos{0};
+        std::atomic<uint64_t> max_nanos{0};
+    };
+
+    Shard shards_[kShards];
+};
+
+// Process-wide instrumentation: one histogram per request stage plus a few
+// gauges that are not owned by any other component.
+class ServerMetrics {
+public:
+    enum Stage {
+        kReceive,    // Waiting for the next streamed request from gRPC
+        kQueueWait,  // Queued for a worker, or waiting for a pooled engine
+        kDecode,     // PNG/JPEG to pixels
+        kRescale,    // Preprocessing steps, when enabled
+        kBinarize,
+        kDeskew,
+        kCrop,
+        kRecognize,  // Tesseract GetUTF8Text
+        kWrite,      // Writing a streamed response back to the client
+        kTotal,      // Request received until its response was ready
+        kStageCount
+    };
+
+    void record(Stage stage, int64_t nanos) { stages_[stage].record(nanos); }
+    LatencyHistogram::Snapshot snapshot(Stage stage) const { return stages_[stage].snapshot(); }
+
+    static const char* stageName(Stage stage);
+
+    // Open ProcessImageStream calls, across both server engines
+    std::atomic<int64_t> active_streams{0};
+    // Queued requests answered without OCR because their deadline passed
+    std::atomic<uint64_t> expired_dropped{0};
+    // Requests whose caller went away: dropped from the queue or stopped
+    // part way through OCR
+    std::atomic<uint64_t> cancelled{0};
+    // Coordinator: images resent to another worker after theirs failed
+    std::atomic<uint64_t> redispatched{0};
+
+private:
+    LatencyHistogram stages_[kStageCount];
+};
+
+ServerMetrics& serverMetrics();
+
+inline int64_t nanosSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+// Records the lifetime of the enclosing scope against a stage
+class StageTimer {
+public:
+    explicit StageTimer(ServerMetrics::Stage stage)
+        : stage_(stage), start_(std::chrono::steady_clock::now()) {}
+    ~StageTimer() { serverMetrics().record(stage_, nanosSince(start_)); }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+    ServerMetrics::Stage stage_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Stage histograms and process-wide counters, without any dispatcher gauges
+ocr::StatsResponse collectProcessStats();
+
+// Everything GetStats reports: stage histograms, queue and worker gauges
+// and result cache counters.
+ocr::StatsResponse collectStats(const OCRDispatcher& dispatcher);
+
+// Renders a stats snapshot in the Prometheus text exposition format.
+std::string renderPrometheus(const ocr::StatsResponse& stats);
+
+#endif // METRICS_H
@@ -0,0 +1,180 @@
+#include "metrics_endpoint.h"
+#include <cerrno>
+#include <cstring>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+using socket_t = SOCKET;
+#define CLOSE_SOCKET closesocket
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+using socket_t = int;
+#define CLOSE_SOCKET close
+#endif
+
+namespace {
+
+// How often the accept loop checks whether it has been stopped
+constexpr long kPollMicros = 250000;
+
+// A scraper that hangs up mid-response must not raise SIGPIPE, which would
+// kill the whole server. Linux takes a flag per send; BSDs and macOS set
+// SO_NOSIGPIPE on the socket instead (see noSigpipe).
+#ifdef MSG_NOSIGNAL
+constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+constexpr int kSendFlags = 0;
+#endif
+
+void noSigpipe(socket_t fd) {
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#else
+    (void)fd;
+#endif
+}
+
+void sendAll(socket_t fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        int n = send(fd, data.data() + sent, static_cast<int>(data.size() - sent), kSendFlags);
+#ifndef _WIN32
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+#endif
+        if (n <= 0) {
+            return;
+        }
+        sent += static_cast<size_t>(n);
+    }
+}
+
+// Reads until the end of the request headers; the body is never needed
+std::string readRequest(socket_t fd) {
+    std::string request;
+    char buffer[1024];
+    while (request.size() < 8192 && request.find("\r\n\r\n") == std::string::npos) {
+        int n = recv(fd, buffer, sizeof(buffer), 0);
+#ifndef _WIN32
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+#endif
+        if (n <= 0) {
+            break;
+        }
+        request.append(buffer, static_cast<size_t>(n));
+    }
+    return request;
+}
+
+std::string httpResponse(const char* status, const std::string& content_type, const std::string& body) {
+    return std::string("HTTP/1.1 ") + status + "\r\n"
+        + "Content-Type: " + content_type + "\r\n"
+        + "Content-Length: " + std::to_string(body.size()) + "\r\n"
+        + "Connection: close\r\n\r\n" + body;
+}
+
+} // namespace
+
+MetricsEndpoint::MetricsEndpoint(std::function<std::string()> render) : render_(std::move(render)) {}
+
+MetricsEndpoint::~MetricsEndpoint() {
+    stop();
+}
+
+bool MetricsEndpoint::start(int port) {
+#ifdef _WIN32
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+        return false;
+    }
+#endif
+    socket_t fd = socket(AF_INET, SOCK_STREAM, 0);
+#ifdef _WIN32
+    if (fd == INVALID_SOCKET) {
+        return false;
+    }
+#else
+    if (fd < 0) {
+        return false;
+    }
+#endif
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(static_cast<unsigned short>(port));
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, 8) != 0) {
+        CLOSE_SOCKET(fd);
+        return false;
+    }
+
+    listen_fd_ = static_cast<long long>(fd);
+    running_ = true;
+    thread_ = std::thread(&MetricsEndpoint::serve, this);
+    return true;
+}
+
+void MetricsEndpoint::stop() {
+    if (!running_.exchange(false)) {
+        return;
+    }
+    thread_.join();
+    CLOSE_SOCKET(static_cast<socket_t>(listen_fd_));
+    listen_fd_ = -1;
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+void MetricsEndpoint::serve() {
+    socket_t listen_fd = static_cast<socket_t>(listen_fd_);
+    while (running_) {
+        // Wake up periodically so stop() never waits on a blocked accept
+        fd_set ready;
+        FD_ZERO(&ready);
+        FD_SET(listen_fd, &ready);
+        timeval timeout{0, kPollMicros};
+        if (select(static_cast<int>(listen_fd + 1), &ready, nullptr, nullptr, &timeout) <= 0) {
+            continue;
+        }
+
+        socket_t client = accept(listen_fd, nullptr, nullptr);
+#ifdef _WIN32
+        if (client == INVALID_SOCKET) {
+            continue;
+        }
+#else
+        if (client < 0) {
+            continue;
+        }
+#endif
+        noSigpipe(client);
+        // Don't let a client that never sends its request stall scrapes
+#ifdef _WIN32
+        DWORD read_timeout = 2000;
+#else
+        timeval read_timeout{2, 0};
+#endif
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&read_timeout),
+                   sizeof(read_timeout));
+        std::string request = readRequest(client);
+        if (request.rfind("GET /metrics", 0) == 0 || request.rfind("GET / ", 0) == 0) {
+            sendAll(client, httpResponse("200 OK", "text/plain; version=0.0.4", render_()));
+        } else {
+            sendAll(client, httpResponse("404 Not Found", "text/plain", "Not found\n"));
+        }
+        CLOSE_SOCKET(client);
+    }
+}
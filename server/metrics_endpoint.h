@@ -0,0 +1,34 @@
+#ifndef METRICS_ENDPOINT_H
+#define METRICS_ENDPOINT_H
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+// Minimal HTTP listener on 127.0.0.1 that answers GET /metrics with the
+// text produced by `render`, for Prometheus to scrape. One connection is
+// served at a time on a background thread; scrapes are cheap and rare, so
+// it never needs more.
+class MetricsEndpoint {
+public:
+    explicit MetricsEndpoint(std::function<std::string()> render);
+    ~MetricsEndpoint();
+
+    MetricsEndpoint(const MetricsEndpoint&) = delete;
+    MetricsEndpoint& operator=(const MetricsEndpoint&) = delete;
+
+    // Binds the port and starts serving. Returns false if it is taken.
+    bool start(int port);
+    void stop();
+
+private:
+    void serve();
+
+    std::function<std::string()> render_;
+    std::atomic<bool> running_{false};
+    long long listen_fd_ = -1;  // SOCKET on Windows, int elsewhere
+    std::thread thread_;
+};
+
+#endif // METRICS_ENDPOINT_H
@@ -0,0 +1,477 @@
+#include "ocr_dispatcher.h"
+#include <iostream>
+#include <leptonica/allheaders.h>
+
+#include "image_decoder.h"
+
+// A tall image cut into bands. Each band is a row range of one decoded
+// image, so no pixels are copied; the last band to finish answers.
+struct BandJob {
+    ProcessingTask parent;
+    ResultCache::Key key;
+    cv::Mat image;
+    int dpi = 0;
+    std::vector<cv::Range> ranges;
+    std::vector<OCRResult> results;  // One per band, each written by one worker
+    std::atomic<size_t> remaining{0};
+};
+
+// A multi-page document whose pages are recognized separately. Each page
+// is freed once recognized; the last page to finish answers.
+struct DocumentJob {
+    ProcessingTask parent;
+    ResultCache::Key key;
+    std::vector<Pix*> pages;
+    std::vector<OCRResult> results;  // One per page, each written by one worker
+    std::vector<ocr::ImageResponse> details;  // Likewise, if structured output was asked for
+    std::atomic<size_t> remaining{0};
+
+    ~DocumentJob() {
+        for (Pix*& page : pages) {
+            pixDestroy(&page);
+        }
+    }
+};
+
+// The in-flight result cache entry a task leads. Bands and pages of one
+// image share it, so the entry is given up at most once: afterwards its key
+// may belong to a newer leader.
+struct CacheFlight {
+    ResultCache& cache;
+    ResultCache::Key key;
+    std::mutex mutex;
+    bool abandoned = false;
+
+    CacheFlight(ResultCache& cache, const ResultCache::Key& key) : cache(cache), key(key) {}
+
+    // Whether the leader may stop: true once nobody is waiting for the entry
+    bool abandon() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!abandoned) {
+            abandoned = cache.abandon(key);
+        }
+        return abandoned;
+    }
+
+    bool wasAbandoned() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return abandoned;
+    }
+};
+
+namespace {
+
+// Counts a worker as busy for the lifetime of the scope
+class BusyScope {
+public:
+    BusyScope(std::atomic<int>& busy_workers, std::atomic<uint64_t>& busy_nanos)
+        : busy_workers_(busy_workers), busy_nanos_(busy_nanos),
+          started_(std::chrono::steady_clock::now()) {
+        busy_workers_.fetch_add(1, std::memory_order_relaxed);
+    }
+    ~BusyScope() {
+        busy_nanos_.fetch_add(static_cast<uint64_t>(nanosSince(started_)), std::memory_order_relaxed);
+        busy_workers_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<int>& busy_workers_;
+    std::atomic<uint64_t>& busy_nanos_;
+    std::chrono::steady_clock::time_point started_;
+};
+
+// Stops OCR once the caller has gone or the task's deadline has passed;
+// nullptr (no polling at all) when neither can happen. A cache leader
+// whose image others have joined runs on for them.
+CancelCheck cancelCheck(const ProcessingTask& task) {
+    if (!task.is_cancelled && task.deadline == std::chrono::steady_clock::time_point::max()) {
+        return nullptr;
+    }
+    return [is_cancelled = task.is_cancelled, deadline = task.deadline, flight = task.flight] {
+        bool gone = (is_cancelled && is_cancelled()) || std::chrono::steady_clock::now() >= deadline;
+        return gone && (!flight || flight->abandon());
+    };
+}
+
+} // namespace
+
+ocr::ImageResponse buildResponse(const std::string& image_id, const OCRResult& result) {
+    ocr::ImageResponse response;
+    response.set_image_id(image_id);
+    response.set_extracted_text(result.text);
+    response.set_success(result.ok());
+    response.set_error_code(result.error);
+    response.set_error_message(result.message);
+    return response;
+}
+
+void appendDetail(ocr::ImageResponse& from, ocr::ImageResponse& to) {
+    if (to.words_size() == 0) {
+        to.mutable_words()->Swap(from.mutable_words());
+    } else {
+        to.mutable_words()->MergeFrom(from.words());
+    }
+    to.mutable_hocr()->append(from.hocr());
+    to.mutable_tsv()->append(from.tsv());
+}
+
+std::string ocrParams(const Preprocessor* preprocessor, const EngineConfig& defaults,
+                      const ocr::OCRConfig& config) {
+    // The resolved engine, so a restart with another --lang does not serve
+    // results of the old one from a persisted cache. An unset PSM means the
+    // engine's own default, which the engine name already pins down.
+    std::string params = engineConfig(config, defaults).name() + "|" +
+                         std::to_string(config.page_seg_mode()) + "|" + config.whitelist() + "|" +
+                         std::to_string(config.dpi());
+    if (preprocessor) {
+        params += "|" + preprocessor->options().signature();
+    }
+    return params;
+}
+
+OCRResult noEngine(const ocr::OCRConfig& config, ocr::ErrorCode refused) {
+    switch (refused) {
+    case ocr::ERROR_TIMEOUT:
+        return OCRResult::failure(refused, "Deadline exceeded waiting for an OCR engine");
+    case ocr::ERROR_CANCELLED:
+        return OCRResult::failure(refused, "Request cancelled");
+    case ocr::ERROR_UNAVAILABLE:
+        return OCRResult::failure(refused, "Server shutting down");
+    default:
+        return OCRResult::failure(ocr::ERROR_INVALID_CONFIG,
+                                  "Language \"" + config.language() + "\" is not available");
+    }
+}
+
+OCRDispatcher::OCRDispatcher(int num_workers, size_t queue_capacity, ResultCache* cache,
+                             const Preprocessor* preprocessor, const BandOptions& bands,
+                             EngineCache* engines)
+    : task_queue_(queue_capacity, laneWeights()), cache_(cache), preprocessor_(preprocessor), bands_(bands),
+      engines_(engines) {
+    // Create every engine before starting threads so workers_ is not
+    // reallocated while a worker is reading it
+    for (int i = 0; i < num_workers; ++i) {
+        workers_.push_back(std::make_unique<OCRWorker>(preprocessor_, engineDefaults()));
+    }
+    for (int i = 0; i < num_workers; ++i) {
+        worker_threads_.emplace_back(&OCRDispatcher::workerThread, this, i);
+        std::cout << "Started worker thread " << i << std::endl;
+    }
+}
+
+OCRDispatcher::~OCRDispatcher() {
+    task_queue_.set_finished();
+    for (auto& thread : worker_threads_) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+}
+
+bool OCRDispatcher::submit(ProcessingTask task) {
+    task.enqueued_at = std::chrono::steady_clock::now();
+    ScheduleTicket ticket{task.lane, task.client, task.deadline};
+    return task_queue_.push(std::move(task), ticket);
+}
+
+bool OCRDispatcher::trySubmit(ProcessingTask& task) {
+    task.enqueued_at = std::chrono::steady_clock::now();
+    return task_queue_.try_push(task, ScheduleTicket{task.lane, task.client, task.deadline});
+}
+
+double OCRDispatcher::utilization() const {
+    double capacity = uptimeSeconds() * 1e9 * workers_.size();
+    return capacity > 0 ? busy_nanos_.load(std::memory_order_relaxed) / capacity : 0.0;
+}
+
+double OCRDispatcher::uptimeSeconds() const {
+    return nanosSince(started_at_) / 1e9;
+}
+
+void OCRDispatcher::workerThread(int worker_id) {
+    ProcessingTask task;
+    ServerMetrics& metrics = serverMetrics();
+    OCRWorker& worker = *workers_[worker_id];
+    while (task_queue_.pop(task)) {
+        metrics.record(ServerMetrics::kQueueWait, nanosSince(task.enqueued_at));
+        // Returns a borrowed engine at the end of the task
+        EngineCache::Lease lease;
+
+        ocr::ErrorCode refused = ocr::ERROR_NONE;
+        if (task.band) {
+            const ProcessingTask& parent = task.band->parent;
+            if (OCRWorker* engine = engineFor(parent.config, worker, engines_, lease, parent.deadline,
+                                              cancelCheck(parent), &refused)) {
+                runBand(task.band, task.band_index, *engine);
+            } else {
+                finishBand(task.band, task.band_index, noEngine(parent.config, refused));
+            }
+            task.band = nullptr;
+            continue;
+        }
+        if (task.document) {
+            const ProcessingTask& parent = task.document->parent;
+            if (OCRWorker* engine = engineFor(parent.config, worker, engines_, lease, parent.deadline,
+                                              cancelCheck(parent), &refused)) {
+                runPage(task.document, task.page_index, *engine);
+            } else {
+                finishPage(task.document, task.page_index, noEngine(parent.config, refused));
+            }
+            task.document = nullptr;
+            continue;
+        }
+
+        // Nobody is waiting for this answer any more
+        if (task.deadline <= std::chrono::steady_clock::now()) {
+            metrics.expired_dropped.fetch_add(1, std::memory_order_relaxed);
+            task.on_complete(buildResponse(task.image_id, OCRResult::failure(
+                ocr::ERROR_TIMEOUT, "Deadline exceeded before processing")));
+            task.on_complete = nullptr;
+            continue;
+        }
+        if (task.is_cancelled && task.is_cancelled()) {
+            metrics.cancelled.fetch_add(1, std::memory_order_relaxed);
+            task.on_complete(buildResponse(task.image_id,
+                                           OCRResult::failure(ocr::ERROR_CANCELLED, "Request cancelled")));
+            task.on_complete = nullptr;
+            continue;
+        }
+
+        ResultCache::Key key{};
+        if (cached(task)) {
+            key = ResultCache::makeKey(task.image_data.view(),
+                                       ocrParams(preprocessor_, engineDefaults(), task.config));
+            std::string cached;
+            ResultCache::Lookup lookup = cache_->begin(key, &cached,
+                [image_id = task.image_id, on_complete = task.on_complete,
+                 received_at = task.received_at](const OCRResult& result) {
+                    serverMetrics().record(ServerMetrics::kTotal, nanosSince(received_at));
+                    on_complete(buildResponse(image_id, result));
+                });
+            if (lookup == ResultCache::Lookup::kHit) {
+                metrics.record(ServerMetrics::kTotal, nanosSince(task.received_at));
+                task.on_complete(buildResponse(task.image_id, OCRResult::success(std::move(cached))));
+            }
+            if (lookup != ResultCache::Lookup::kLeader) {
+                // Answered now, or by whichever worker owns the same content
+                task.on_complete = nullptr;
+                continue;
+            }
+            task.flight = std::make_shared<CacheFlight>(*cache_, key);
+        }
+
+        OCRWorker* engine = engineFor(task.config, worker, engines_, lease, task.deadline, cancelCheck(task),
+                                      &refused);
+        if (!engine) {
+            complete(task, key, noEngine(task.config, refused));
+            continue;
+        }
+
+        const ImageDecoder* decoder = findDecoder(task.image_data.view());
+        if (decoder && decoder->read_pages) {
+            processDocument(task, key, *engine);
+            continue;
+        }
+        if (bands_.enabled() && decoder && !wantsDetail(task.output)) {
+            processInBands(task, key, *engine);
+            continue;
+        }
+
+        // Process the image
+        OCRResult result;
+        ocr::ImageResponse detail;
+        {
+            BusyScope busy(busy_workers_, busy_nanos_);
+            result = engine->processImage(
+                task.image_data.view(),
+                cancelCheck(task),
+                task.output,
+                &detail
+            );
+        }
+        complete(task, key, std::move(result), 0, &detail);
+    }
+}
+
+void OCRDispatcher::processInBands(ProcessingTask& task, const ResultCache::Key& key, OCRWorker& worker) {
+    auto job = std::make_shared<BandJob>();
+    {
+        BusyScope busy(busy_workers_, busy_nanos_);
+        job->image = worker.decodeImage(task.image_data.view(), &job->dpi);
+        if (job->image.empty()) {
+            complete(task, key, OCRResult::failure(ocr::ERROR_DECODE_FAILED, "Could not decode image"));
+            return;
+        }
+        job->ranges = splitIntoBands(job->image, bands_);
+        if (job->ranges.size() < 2) {
+            complete(task, key, worker.recognizeImage(job->image, job->dpi, cancelCheck(task)));
+            return;
+        }
+    }
+
+    // The encoded bytes are no longer needed once decoded
+    task.image_data = ImagePayload();
+    job->key = key;
+    job->results.resize(job->ranges.size());
+    job->remaining = job->ranges.size();
+    job->parent = std::move(task);
+
+    // Queue every band but the first for idle workers and OCR the first
+    // here. A band that does not fit in the queue runs here too; blocking
+    // on a full queue from a worker could deadlock the pool.
+    for (size_t i = 1; i < job->ranges.size(); ++i) {
+        // Bands keep their request's place in the schedule
+        ProcessingTask band;
+        band.band = job;
+        band.band_index = i;
+        band.lane = job->parent.lane;
+        band.client = job->parent.client;
+        band.deadline = job->parent.deadline;
+        if (!trySubmit(band)) {
+            runBand(job, i, worker);
+        }
+    }
+    runBand(job, 0, worker);
+}
+
+void OCRDispatcher::runBand(const std::shared_ptr<BandJob>& job, size_t index, OCRWorker& worker) {
+    OCRResult result;
+    {
+        BusyScope busy(busy_workers_, busy_nanos_);
+        result = worker.recognizeImage(job->image.rowRange(job->ranges[index]), job->dpi,
+                                       cancelCheck(job->parent));
+    }
+    finishBand(job, index, std::move(result));
+}
+
+void OCRDispatcher::finishBand(const std::shared_ptr<BandJob>& job, size_t index, OCRResult result) {
+    job->results[index] = std::move(result);
+    if (job->remaining.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    // Last band: report the first failure, or the stitched text
+    std::vector<std::string> texts;
+    for (OCRResult& band : job->results) {
+        if (!band.ok()) {
+            complete(job->parent, job->key, std::move(band));
+            job->image.release();
+            return;
+        }
+        texts.push_back(std::move(band.text));
+    }
+    complete(job->parent, job->key, OCRResult::success(stitchBands(texts)));
+    job->image.release();
+}
+
+void OCRDispatcher::processDocument(ProcessingTask& task, const ResultCache::Key& key, OCRWorker& worker) {
+    auto job = std::make_shared<DocumentJob>();
+    {
+        BusyScope busy(busy_workers_, busy_nanos_);
+        job->pages = worker.decodePages(task.image_data.view());
+        if (job->pages.empty()) {
+            complete(task, key, OCRResult::failure(ocr::ERROR_DECODE_FAILED, "Could not decode image"));
+            return;
+        }
+        if (job->pages.size() == 1) {
+            ocr::ImageResponse detail;
+            OCRResult result = worker.recognizePage(job->pages[0], 0, cancelCheck(task), task.output, &detail);
+            complete(task, key, std::move(result), 0, &detail);
+            return;
+        }
+    }
+
+    // The encoded bytes are no longer needed once decoded
+    task.image_data = ImagePayload();
+    job->key = key;
+    job->results.resize(job->pages.size());
+    if (wantsDetail(task.output)) {
+        job->details.resize(job->pages.size());
+    }
+    job->remaining = job->pages.size();
+    job->parent = std::move(task);
+
+    // As with bands: pages go to idle workers, the first page and any page
+    // that does not fit in the queue run here
+    for (size_t i = 1; i < job->pages.size(); ++i) {
+        ProcessingTask page;
+        page.document = job;
+        page.page_index = i;
+        page.lane = job->parent.lane;
+        page.client = job->parent.client;
+        page.deadline = job->parent.deadline;
+        if (!trySubmit(page)) {
+            runPage(job, i, worker);
+        }
+    }
+    runPage(job, 0, worker);
+}
+
+void OCRDispatcher::runPage(const std::shared_ptr<DocumentJob>& job, size_t index, OCRWorker& worker) {
+    OCRResult result;
+    {
+        BusyScope busy(busy_workers_, busy_nanos_);
+        ocr::ImageResponse* detail = job->details.empty() ? nullptr : &job->details[index];
+        result = worker.recognizePage(job->pages[index], index, cancelCheck(job->parent),
+                                      job->parent.output, detail);
+    }
+    finishPage(job, index, std::move(result));
+}
+
+void OCRDispatcher::finishPage(const std::shared_ptr<DocumentJob>& job, size_t index, OCRResult result) {
+    pixDestroy(&job->pages[index]);
+    job->results[index] = std::move(result);
+    uint32_t page_count = static_cast<uint32_t>(job->pages.size());
+    if (job->parent.page_results) {
+        ocr::ImageResponse page = buildResponse(job->parent.image_id, job->results[index]);
+        page.set_page_index(static_cast<uint32_t>(index));
+        page.set_page_count(page_count);
+        page.set_partial(true);
+        if (!job->details.empty() && page.success()) {
+            // Copied: the document's own response needs it too
+            ocr::ImageResponse detail = job->details[index];
+            appendDetail(detail, page);
+        }
+        job->parent.on_complete(std::move(page));
+    }
+    if (job->remaining.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    // Last page: report the first failure, or every page in order
+    OCRResult document;
+    for (size_t i = 0; i < job->results.size(); ++i) {
+        if (!job->results[i].ok()) {
+            document = std::move(job->results[i]);
+            break;
+        }
+        document.text += (i > 0 ? OCRWorker::kPageSeparator : "") + job->results[i].text;
+    }
+    ocr::ImageResponse detail;
+    for (ocr::ImageResponse& page : job->details) {
+        appendDetail(page, detail);
+    }
+    complete(job->parent, job->key, std::move(document), page_count, &detail);
+}
+
+void OCRDispatcher::complete(ProcessingTask& task, const ResultCache::Key& key, OCRResult result,
+                             uint32_t page_count, ocr::ImageResponse* detail) {
+    if (result.error == ocr::ERROR_CANCELLED) {
+        serverMetrics().cancelled.fetch_add(1, std::memory_order_relaxed);
+        if (std::chrono::steady_clock::now() >= task.deadline) {
+            result = OCRResult::failure(ocr::ERROR_TIMEOUT, "Deadline exceeded during processing");
+        }
+    }
+    ocr::ImageResponse response = buildResponse(task.image_id, result);
+    response.set_page_count(page_count);
+    if (detail && response.success()) {
+        appendDetail(*detail, response);
+    }
+    // An abandoned entry has nobody waiting, and may have a new leader
+    if (cached(task) && !(task.flight && task.flight->wasAbandoned())) {
+        cache_->finish(key, result);
+    }
+    serverMetrics().record(ServerMetrics::kTotal, nanosSince(task.received_at));
+    task.on_complete(std::move(response));
+    task.on_complete = nullptr;
+}
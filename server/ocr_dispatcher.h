@@ -0,0 +1,180 @@
+#ifndef OCR_DISPATCHER_H
+#define OCR_DISPATCHER_H
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ocr.pb.h"
+#include "SchedulingQueue.hpp"
+#include "band_splitter.h"
+#include "engine_cache.h"
+#include "image_payload.h"
+#include "metrics.h"
+#include "ocr_worker.h"
+#include "result_cache.h"
+#include "scheduling.h"
+
+struct BandJob;
+struct DocumentJob;
+struct CacheFlight;
+
+// Task structure for worker threads. Move-only so the queue can never
+// duplicate an image payload.
+struct ProcessingTask {
+    std::string image_id;
+    ImagePayload image_data;
+    std::string image_format;
+    // Runs on the worker thread with the finished response. Must not block
+    // on the network; hand the response to a writer instead.
+    std::function<void(ocr::ImageResponse)> on_complete;
+    // Optional; returns true once the caller has gone (cancelled, timed
+    // out or disconnected). Polled before and during OCR from the worker
+    // thread, so it must be cheap and thread-safe.
+    std::function<bool()> is_cancelled;
+    // When the request arrived and when it entered the queue, for the
+    // total and queue_wait stage timings
+    std::chrono::steady_clock::time_point received_at = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point enqueued_at;
+    // Where the task waits in the queue (see SchedulingQueue); tasks still
+    // queued at their deadline are answered without running OCR
+    size_t lane = kLaneNormal;
+    uint64_t client = 0;
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    // Set when this task is one band of a split image; the image itself
+    // lives in the job and the fields above are unused
+    std::shared_ptr<BandJob> band;
+    size_t band_index = 0;
+    // Likewise for one page of a multi-page document
+    std::shared_ptr<DocumentJob> document;
+    size_t page_index = 0;
+    // Report each page of a multi-page document through on_complete as it
+    // finishes (marked partial), ahead of the document's own result. Only
+    // for callers that can send several responses per image.
+    bool page_results = false;
+    // Structured output wanted besides the text. Tasks asking for any skip
+    // the result cache, which holds text only, and are not split into bands.
+    ocr::OutputOptions output;
+    // Language, page segmentation mode and the like; empty for the
+    // server's defaults
+    ocr::OCRConfig config;
+    // Set while the task leads an in-flight result cache entry; its
+    // caller going away then stops OCR only if nobody has joined
+    std::shared_ptr<CacheFlight> flight;
+
+    ProcessingTask() = default;
+    ProcessingTask(ProcessingTask&&) = default;
+    ProcessingTask& operator=(ProcessingTask&&) = default;
+    ProcessingTask(const ProcessingTask&) = delete;
+    ProcessingTask& operator=(const ProcessingTask&) = delete;
+};
+
+// Builds the response for one image from the worker's result.
+ocr::ImageResponse buildResponse(const std::string& image_id, const OCRResult& result);
+
+// Answer to a request engineFor() found no engine for, by the reason it
+// gave: the language set cannot be loaded, or the caller ran out of time or
+// went away while one was loading
+OCRResult noEngine(const ocr::OCRConfig& config, ocr::ErrorCode refused);
+
+// Moves the structured output of `from` (words, hOCR, TSV) onto the end of
+// `to`'s.
+void appendDetail(ocr::ImageResponse& from, ocr::ImageResponse& to);
+
+// Everything besides the image bytes that changes the OCR result; part of
+// the result cache key. `config`'s engine is resolved against `defaults`, so
+// an empty config still names the server's language. Not the request's
+// image_format: decoders go by the bytes themselves, so the same image
+// labelled differently is one entry.
+std::string ocrParams(const Preprocessor* preprocessor, const EngineConfig& defaults,
+                      const ocr::OCRConfig& config);
+
+// Compute pool shared by both server engines: a bounded task queue feeding
+// a fixed set of worker threads, each owning its own OCR engine. The queue
+// serves priority lanes by weight, clients fairly within a lane and the
+// earliest deadline first; work that expired while queued is dropped, and
+// work whose caller has gone is dropped or interrupted mid-OCR. With a
+// cache, workers answer repeated content without running OCR and join
+// identical images that are already being processed. With band options,
+// tall images are cut into bands that go back on the queue so idle
+// workers can OCR them in parallel; the pages of a multi-page TIFF are
+// spread the same way. Each worker owns an engine for the default
+// configuration; tasks asking for another language or engine mode borrow
+// one from `engines`.
+class OCRDispatcher {
+public:
+    OCRDispatcher(int num_workers, size_t queue_capacity, ResultCache* cache = nullptr,
+                  const Preprocessor* preprocessor = nullptr,
+                  const BandOptions& bands = BandOptions(), EngineCache* engines = nullptr);
+    // Stops accepting tasks; workers finish what is already queued.
+    ~OCRDispatcher();
+
+    OCRDispatcher(const OCRDispatcher&) = delete;
+    OCRDispatcher& operator=(const OCRDispatcher&) = delete;
+
+    // Blocks while the queue is full. Returns false once shut down.
+    bool submit(ProcessingTask task);
+    // Never blocks. On failure (queue full or shut down) `task` is left
+    // untouched so the caller can retry or reject it.
+    bool trySubmit(ProcessingTask& task);
+
+    int numWorkers() const { return static_cast<int>(workers_.size()); }
+
+    // Gauges for GetStats and the metrics endpoint
+    size_t queueDepth() const { return task_queue_.size(); }
+    size_t queueCapacity() const { return task_queue_.capacity(); }
+    size_t laneDepth(Lane lane) const { return task_queue_.lane_size(lane); }
+    int busyWorkers() const { return busy_workers_.load(std::memory_order_relaxed); }
+    // Fraction of worker time spent processing since the pool started
+    double utilization() const;
+    double uptimeSeconds() const;
+    const ResultCache* cache() const { return cache_; }
+    const EngineCache* engines() const { return engines_; }
+    // The engine of requests that name no language or engine mode
+    EngineConfig engineDefaults() const { return engines_ ? engines_->defaults() : EngineConfig(); }
+
+private:
+    // Blocks in pop() until a task arrives; exits once the queue has been
+    // finished and drained.
+    void workerThread(int worker_id);
+
+    // Decodes `task`'s image and, if it is tall enough, queues its bands;
+    // otherwise recognizes it whole. Always answers the task eventually.
+    void processInBands(ProcessingTask& task, const ResultCache::Key& key, OCRWorker& worker);
+    // OCRs one band; the worker that finishes the last band stitches and
+    // answers the original request.
+    void runBand(const std::shared_ptr<BandJob>& job, size_t index, OCRWorker& worker);
+    void finishBand(const std::shared_ptr<BandJob>& job, size_t index, OCRResult result);
+    // Decodes every page of a TIFF and queues all but the first for idle
+    // workers. Always answers the task eventually.
+    void processDocument(ProcessingTask& task, const ResultCache::Key& key, OCRWorker& worker);
+    // OCRs one page and reports it if the caller wants pages; the worker
+    // that finishes the last page answers the original request.
+    void runPage(const std::shared_ptr<DocumentJob>& job, size_t index, OCRWorker& worker);
+    void finishPage(const std::shared_ptr<DocumentJob>& job, size_t index, OCRResult result);
+    // Publishes `result` as the answer to `task`: cache, metrics, callback.
+    // A job stopped once the task's deadline had passed is reported as a
+    // timeout rather than a cancellation. `detail` (optional) holds the
+    // structured output, moved into the response if the image succeeded.
+    void complete(ProcessingTask& task, const ResultCache::Key& key, OCRResult result,
+                  uint32_t page_count = 0, ocr::ImageResponse* detail = nullptr);
+    // Whether `task` goes through the result cache
+    bool cached(const ProcessingTask& task) const { return cache_ && !wantsDetail(task.output); }
+
+    SchedulingQueue<ProcessingTask> task_queue_;
+    ResultCache* cache_;
+    const Preprocessor* preprocessor_;
+    BandOptions bands_;
+    EngineCache* engines_;
+    std::vector<std::unique_ptr<OCRWorker>> workers_;
+    std::vector<std::thread> worker_threads_;
+    const std::chrono::steady_clock::time_point started_at_ = std::chrono::steady_clock::now();
+    std::atomic<int> busy_workers_{0};
+    std::atomic<uint64_t> busy_nanos_{0};
+};
+
+#endif // OCR_DISPATCHER_H
@@ -0,0 +1,32 @@
+#ifndef OCR_RESULT_H
+#define OCR_RESULT_H
+
+#include <string>
+#include <utility>
+
+#include "ocr.pb.h"
+
+// Outcome of OCR on one image or page: its text, or why there is none.
+// Empty text with no error is a blank page, not a failure.
+struct OCRResult {
+    ocr::ErrorCode error = ocr::ERROR_NONE;
+    std::string text;     // Recognized text; empty on failure
+    std::string message;  // What went wrong, for people; empty on success
+
+    bool ok() const { return error == ocr::ERROR_NONE; }
+
+    static OCRResult success(std::string text) {
+        OCRResult result;
+        result.text = std::move(text);
+        return result;
+    }
+
+    static OCRResult failure(ocr::ErrorCode error, std::string message) {
+        OCRResult result;
+        result.error = error;
+        result.message = std::move(message);
+        return result;
+    }
+};
+
+#endif // OCR_RESULT_H
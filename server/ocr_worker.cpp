@@ -0,0 +1,336 @@
+#include "ocr_worker.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <iostream>
+#include <leptonica/allheaders.h>
+#include <tesseract/ocrclass.h>
+#include <tesseract/resultiterator.h>
+
+#include "image_decoder.h"
+#include "metrics.h"
+
+namespace {
+
+tesseract::PageSegMode pageSegMode(ocr::PageSegMode mode, tesseract::PageSegMode fallback) {
+    switch (mode) {
+    case ocr::PSM_AUTO: return tesseract::PSM_AUTO;
+    case ocr::PSM_AUTO_OSD: return tesseract::PSM_AUTO_OSD;
+    case ocr::PSM_SINGLE_COLUMN: return tesseract::PSM_SINGLE_COLUMN;
+    case ocr::PSM_SINGLE_BLOCK: return tesseract::PSM_SINGLE_BLOCK;
+    case ocr::PSM_SINGLE_BLOCK_VERTICAL: return tesseract::PSM_SINGLE_BLOCK_VERT_TEXT;
+    case ocr::PSM_SINGLE_LINE: return tesseract::PSM_SINGLE_LINE;
+    case ocr::PSM_SINGLE_WORD: return tesseract::PSM_SINGLE_WORD;
+    case ocr::PSM_SINGLE_CHAR: return tesseract::PSM_SINGLE_CHAR;
+    case ocr::PSM_SPARSE_TEXT: return tesseract::PSM_SPARSE_TEXT;
+    case ocr::PSM_RAW_LINE: return tesseract::PSM_RAW_LINE;
+    default: return fallback;
+    }
+}
+
+} // namespace
+
+EngineConfig engineConfig(const ocr::OCRConfig& request, const EngineConfig& defaults) {
+    EngineConfig config = defaults;
+    if (!request.language().empty()) {
+        config.language = request.language();
+    }
+    switch (request.engine_mode()) {
+    case ocr::OEM_LSTM:
+        config.oem = tesseract::OEM_LSTM_ONLY;
+        break;
+    case ocr::OEM_LEGACY:
+        config.oem = tesseract::OEM_TESSERACT_ONLY;
+        break;
+    case ocr::OEM_LEGACY_LSTM:
+        config.oem = tesseract::OEM_TESSERACT_LSTM_COMBINED;
+        break;
+    default:
+        break;
+    }
+    return config;
+}
+
+bool validLanguage(const std::string& language) {
+    // Letters, digits, '_' and '-', plus '/' inside a name for the script/
+    // models; no name may be empty or start with '/'
+    bool name_start = true;
+    for (char c : language) {
+        if (c == '+') {
+            if (name_start) {
+                return false;
+            }
+            name_start = true;
+        } else if (std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '-' ||
+                   (c == '/' && !name_start)) {
+            name_start = false;
+        } else {
+            return false;
+        }
+    }
+    return !name_start;
+}
+
+OCRWorker::OCRWorker(const Preprocessor* preprocessor, const EngineConfig& config)
+    : preprocessor_(preprocessor), config_(config), initialized_(false) {
+    tess_ = std::make_unique<tesseract::TessBaseAPI>();
+    // Loads the traineddata of every language in the set
+    if (tess_->Init(nullptr, config_.language.c_str(), config_.oem)) {
+        std::cerr << "Could not initialize tesseract for " << config_.name() << std::endl;
+        initialized_ = false;
+    } else {
+        initialized_ = true;
+    }
+    default_psm_ = tess_->GetPageSegMode();
+}
+
+OCRWorker::~OCRWorker() {
+    if (initialized_) {
+        tess_->End();
+    }
+}
+
+bool OCRWorker::isInitialized() const {
+    return initialized_;
+}
+
+void OCRWorker::configure(const ocr::OCRConfig& config) {
+    dpi_ = static_cast<int>(config.dpi());
+    if (!initialized_) {
+        return;
+    }
+    tess_->SetPageSegMode(pageSegMode(config.page_seg_mode(), default_psm_));
+    // Variables outlive the image, so an empty whitelist is set as well
+    tess_->SetVariable("tessedit_char_whitelist", config.whitelist().c_str());
+}
+
+bool wantsDetail(const ocr::OutputOptions& output) {
+    return output.words() || output.hocr() || output.tsv();
+}
+
+OCRResult OCRWorker::processImage(std::string_view imageData, const CancelCheck& cancelled,
+                                  const ocr::OutputOptions& output, ocr::ImageResponse* detail) {
+    if (!initialized_) {
+        return OCRResult::failure(ocr::ERROR_UNAVAILABLE, "OCR engine not initialized");
+    }
+
+    const ImageDecoder* decoder = findDecoder(imageData);
+    if (!decoder) {
+        return OCRResult::failure(ocr::ERROR_UNSUPPORTED_FORMAT, "Unsupported image format");
+    }
+
+    try {
+        // Documents are recognized page by page as decoded; preprocessing
+        // works on single encoded images only
+        if (decoder->read_pages) {
+            std::vector<Pix*> pages = decodePages(imageData);
+            if (pages.empty()) {
+                return OCRResult::failure(ocr::ERROR_DECODE_FAILED, "Could not decode image");
+            }
+            OCRResult result;
+            for (size_t i = 0; i < pages.size(); ++i) {
+                if (result.ok()) {
+                    OCRResult page = recognizePage(pages[i], i, cancelled, output, detail);
+                    if (!page.ok()) {
+                        result = std::move(page);
+                    } else {
+                        result.text += (i > 0 ? kPageSeparator : "") + page.text;
+                    }
+                }
+                pixDestroy(&pages[i]);
+            }
+            return result;
+        }
+
+        if (preprocessor_ && preprocessor_->options().enabled()) {
+            // Decode and clean up with OpenCV, then hand Tesseract the pixels.
+            // Word boxes must be in the pixels the client sent, so detail
+            // requests only get the steps that move nothing.
+            int dpi = 0;
+            cv::Mat image = decodeImage(imageData, &dpi, wantsDetail(output));
+            if (image.empty()) {
+                return OCRResult::failure(ocr::ERROR_DECODE_FAILED, "Could not decode image");
+            }
+            return recognizeImage(image, dpi, cancelled, output, detail);
+        }
+
+        // Convert image data to PIX format
+        PIX* pix = nullptr;
+        int dpi = 0;
+        {
+            StageTimer timer(ServerMetrics::kDecode);
+            // Word boxes must be in the pixels the client sent
+            int reduction = decodeReduction(*decoder, imageData, &dpi, wantsDetail(output));
+            pix = decodePix(*decoder, imageData, reduction);
+        }
+
+        if (!pix) {
+            return OCRResult::failure(ocr::ERROR_DECODE_FAILED, "Could not decode image");
+        }
+
+        // Set image for OCR
+        tess_->SetImage(pix);
+        if (dpi > 0) {
+            tess_->SetSourceResolution(dpi);
+        }
+
+        // Perform OCR
+        OCRResult result = recognize(cancelled, output, detail, 0);
+
+        // Cleanup
+        pixDestroy(&pix);
+
+        return result;
+    } catch (const std::exception& e) {
+        return OCRResult::failure(ocr::ERROR_INTERNAL, e.what());
+    }
+}
+
+cv::Mat OCRWorker::decodeImage(std::string_view imageData, int* dpi, bool keep_geometry) const {
+    if (preprocessor_ && preprocessor_->options().enabled()) {
+        return preprocessor_->run(imageData, dpi, dpi_, keep_geometry);
+    }
+
+    const ImageDecoder* decoder = findDecoder(imageData);
+    if (!decoder) {
+        return cv::Mat();
+    }
+    StageTimer timer(ServerMetrics::kDecode);
+    // Tesseract binarizes gray anyway, so decoding colour would only cost
+    // memory
+    int reduction = decodeReduction(*decoder, imageData, dpi, keep_geometry);
+    return decodeMat(*decoder, imageData, true, reduction);
+}
+
+OCRResult OCRWorker::recognizeImage(const cv::Mat& image, int dpi, const CancelCheck& cancelled,
+                                    const ocr::OutputOptions& output, ocr::ImageResponse* detail) {
+    if (!initialized_) {
+        return OCRResult::failure(ocr::ERROR_UNAVAILABLE, "OCR engine not initialized");
+    }
+    try {
+        tess_->SetImage(image.data, image.cols, image.rows, image.channels(),
+                        static_cast<int>(image.step));
+        if (dpi > 0) {
+            tess_->SetSourceResolution(dpi);
+        }
+        return recognize(cancelled, output, detail, 0);
+    } catch (const std::exception& e) {
+        return OCRResult::failure(ocr::ERROR_INTERNAL, e.what());
+    }
+}
+
+std::vector<Pix*> OCRWorker::decodePages(std::string_view imageData) const {
+    const ImageDecoder* decoder = findDecoder(imageData);
+    if (!decoder || !decoder->read_pages) {
+        return {};
+    }
+    StageTimer timer(ServerMetrics::kDecode);
+    return decoder->read_pages(imageData);
+}
+
+int OCRWorker::decodeReduction(const ImageDecoder& decoder, std::string_view imageData, int* dpi,
+                               bool full_scale) const {
+    *dpi = dpi_ > 0 ? dpi_ : sniffResolution(imageData);
+    if (!preprocessor_) {
+        return 1;
+    }
+    if (*dpi <= 0) {
+        *dpi = preprocessor_->options().assumed_dpi;
+    }
+    if (full_scale) {
+        return 1;
+    }
+    int reduction = ::decodeReduction(decoder, *dpi, preprocessor_->options().reducedDecodeDpi());
+    *dpi /= reduction;
+    return reduction;
+}
+
+OCRResult OCRWorker::recognizePage(Pix* page, size_t index, const CancelCheck& cancelled,
+                                   const ocr::OutputOptions& output, ocr::ImageResponse* detail) {
+    if (!initialized_) {
+        return OCRResult::failure(ocr::ERROR_UNAVAILABLE, "OCR engine not initialized");
+    }
+    try {
+        tess_->SetImage(page);
+        if (dpi_ > 0) {
+            tess_->SetSourceResolution(dpi_);
+        }
+        return recognize(cancelled, output, detail, index);
+    } catch (const std::exception& e) {
+        return OCRResult::failure(ocr::ERROR_INTERNAL, e.what());
+    }
+}
+
+OCRResult OCRWorker::recognize(const CancelCheck& cancelled, const ocr::OutputOptions& output,
+                               ocr::ImageResponse* detail, size_t page) {
+    StageTimer timer(ServerMetrics::kRecognize);
+    if (cancelled) {
+        if (cancelled()) {
+            return OCRResult::failure(ocr::ERROR_CANCELLED, "Request cancelled");
+        }
+        // Tesseract polls the monitor's cancel callback between words and
+        // abandons the page when it returns true
+        tesseract::ETEXT_DESC monitor;
+        monitor.cancel = [](void* check, int /*words*/) {
+            return (*static_cast<const CancelCheck*>(check))();
+        };
+        monitor.cancel_this = const_cast<CancelCheck*>(&cancelled);
+        if (tess_->Recognize(&monitor) != 0 || cancelled()) {
+            tess_->Clear();
+            return cancelled() ? OCRResult::failure(ocr::ERROR_CANCELLED, "Request cancelled")
+                               : OCRResult::failure(ocr::ERROR_INTERNAL, "Recognition failed");
+        }
+    }
+    char* outText = tess_->GetUTF8Text();
+    OCRResult result = OCRResult::success(outText ? outText : "");
+    delete[] outText;
+    if (detail && wantsDetail(output)) {
+        addDetail(output, page, detail);
+    }
+    return result;
+}
+
+void OCRWorker::addDetail(const ocr::OutputOptions& output, size_t page, ocr::ImageResponse* detail) {
+    // Everything below reads the results GetUTF8Text() already produced
+    if (output.words()) {
+        std::unique_ptr<tesseract::ResultIterator> it(tess_->GetIterator());
+        uint32_t line = 0;
+        bool first = true;
+        while (it) {
+            if (!it->Empty(tesseract::RIL_WORD)) {
+                if (it->IsAtBeginningOf(tesseract::RIL_TEXTLINE) && !first) {
+                    ++line;
+                }
+                first = false;
+                int left = 0, top = 0, right = 0, bottom = 0;
+                it->BoundingBox(tesseract::RIL_WORD, &left, &top, &right, &bottom);
+                std::unique_ptr<char[]> text(it->GetUTF8Text(tesseract::RIL_WORD));
+                ocr::Word* word = detail->add_words();
+                word->set_text(text ? text.get() : "");
+                word->set_left(left);
+                word->set_top(top);
+                word->set_width(right - left);
+                word->set_height(bottom - top);
+                word->set_confidence(static_cast<uint32_t>(
+                    std::lround(std::clamp(it->Confidence(tesseract::RIL_WORD), 0.0f, 100.0f))));
+                word->set_line(line);
+                word->set_page(static_cast<uint32_t>(page));
+            }
+            if (!it->Next(tesseract::RIL_WORD)) {
+                break;
+            }
+        }
+    }
+    if (output.hocr()) {
+        std::unique_ptr<char[]> hocr(tess_->GetHOCRText(static_cast<int>(page)));
+        if (hocr) {
+            detail->mutable_hocr()->append(hocr.get());
+        }
+    }
+    if (output.tsv()) {
+        std::unique_ptr<char[]> tsv(tess_->GetTSVText(static_cast<int>(page)));
+        if (tsv) {
+            detail->mutable_tsv()->append(tsv.get());
+        }
+    }
+}
@@ -0,0 +1,121 @@
+#ifndef OCR_WORKER_H
+#define OCR_WORKER_H
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <tesseract/baseapi.h>
+
+#include "ocr.pb.h"
+#include "ocr_result.h"
+#include "preprocessor.h"
+
+struct Pix;
+struct ImageDecoder;
+
+// Polled while recognizing; returns true once nobody wants the result.
+// Called from the OCR thread about once per word, so it must be cheap and
+// thread-safe.
+using CancelCheck = std::function<bool()>;
+
+// True if `output` asks for anything besides the text
+bool wantsDetail(const ocr::OutputOptions& output);
+
+// What Tesseract's Init() depends on. Engines can serve any request whose
+// language set and engine mode match theirs; the rest of ocr::OCRConfig is
+// applied per image.
+struct EngineConfig {
+    std::string language = "eng";  // Traineddata names joined with '+'
+    tesseract::OcrEngineMode oem = tesseract::OEM_DEFAULT;
+
+    bool operator==(const EngineConfig& other) const {
+        return language == other.language && oem == other.oem;
+    }
+    bool operator!=(const EngineConfig& other) const { return !(*this == other); }
+    // Unique per config, e.g. "eng+fil/1"
+    std::string name() const { return language + "/" + std::to_string(static_cast<int>(oem)); }
+};
+
+// The engine `request` asks for, its unset fields taken from `defaults`
+EngineConfig engineConfig(const ocr::OCRConfig& request, const EngineConfig& defaults);
+
+// True if `language` is one or more traineddata names joined with '+'.
+// Anything else (a path, say) is never handed to Init().
+bool validLanguage(const std::string& language);
+
+// Wraps one Tesseract engine. Init() loads traineddata, which is expensive,
+// so instances are meant to be created once and reused.
+class OCRWorker {
+public:
+    // `preprocessor` (optional, shared) cleans images up before recognition
+    explicit OCRWorker(const Preprocessor* preprocessor = nullptr,
+                       const EngineConfig& config = EngineConfig());
+    ~OCRWorker();
+
+    OCRWorker(const OCRWorker&) = delete;
+    OCRWorker& operator=(const OCRWorker&) = delete;
+
+    bool isInitialized() const;
+    const EngineConfig& config() const { return config_; }
+
+    // Applies the per-image settings of `config` (page segmentation mode,
+    // whitelist, DPI) to every call until the next configure(). Its
+    // language and engine mode must match config(); that is the caller's
+    // job.
+    void configure(const ocr::OCRConfig& config);
+
+    // Between the page texts of a document, as in Tesseract's own output
+    static constexpr const char* kPageSeparator = "\f";
+
+    // Decodes and OCRs `imageData` in place; the bytes are not copied. The
+    // format is detected from the data. The pages of a multi-page TIFF are
+    // recognized in turn and their texts joined with form feeds. A job that
+    // `cancelled` stopped fails with ERROR_CANCELLED.
+    //
+    // Each recognition call below can also add the structured output that
+    // `output` asks for (words, hOCR, TSV) to `detail`, from the same pass.
+    OCRResult processImage(std::string_view imageData, const CancelCheck& cancelled = nullptr,
+                           const ocr::OutputOptions& output = ocr::OutputOptions::default_instance(),
+                           ocr::ImageResponse* detail = nullptr);
+
+    // Decodes to a cv::Mat, applying the preprocessor if one is enabled.
+    // Returns an empty Mat on failure. Used when an image may be split into
+    // bands, since bands of one decoded image can go to different workers.
+    // `keep_geometry` leaves every pixel where the client sent it, for
+    // requests whose word boxes must match the source image.
+    cv::Mat decodeImage(std::string_view imageData, int* dpi, bool keep_geometry = false) const;
+    // OCRs an 8-bit gray or RGB image (or a row range of one)
+    OCRResult recognizeImage(const cv::Mat& image, int dpi, const CancelCheck& cancelled = nullptr,
+                             const ocr::OutputOptions& output = ocr::OutputOptions::default_instance(),
+                             ocr::ImageResponse* detail = nullptr);
+
+    // Every page of a multi-page format (TIFF), decoded with Leptonica.
+    // Empty on failure; the caller owns (and must pixDestroy) the pages.
+    std::vector<Pix*> decodePages(std::string_view imageData) const;
+    // OCRs page `index` of a document
+    OCRResult recognizePage(Pix* page, size_t index, const CancelCheck& cancelled = nullptr,
+                            const ocr::OutputOptions& output = ocr::OutputOptions::default_instance(),
+                            ocr::ImageResponse* detail = nullptr);
+
+private:
+    OCRResult recognize(const CancelCheck& cancelled, const ocr::OutputOptions& output,
+                        ocr::ImageResponse* detail, size_t page);
+    // Appends the requested structured output of the last recognition
+    void addDetail(const ocr::OutputOptions& output, size_t page, ocr::ImageResponse* detail);
+    // Scale to decode `imageData` at, per the preprocessor's reduced decode
+    // setting; `dpi` receives the resolution after reduction (0 if unknown).
+    // `full_scale` always returns 1 but still fills in `dpi`.
+    int decodeReduction(const ImageDecoder& decoder, std::string_view imageData, int* dpi,
+                        bool full_scale = false) const;
+
+    std::unique_ptr<tesseract::TessBaseAPI> tess_;
+    const Preprocessor* preprocessor_;
+    EngineConfig config_;
+    bool initialized_;
+    tesseract::PageSegMode default_psm_;  // As left by Init()
+    int dpi_ = 0;                         // From configure(); 0 uses the file's
+};
+
+#endif // OCR_WORKER_H
@@ -0,0 +1,204 @@
+#include "preprocessor.h"
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <vector>
+#include <opencv2/imgproc.hpp>
+
+#include "image_decoder.h"
+#include "metrics.h"
+
+namespace {
+
+// Foreground (ink) pixels as 255 on a black background
+cv::Mat inkMask(const cv::Mat& gray) {
+    cv::Mat mask;
+    cv::threshold(gray, mask, 0, 255, cv::THRESH_BINARY_INV | cv::THRESH_OTSU);
+    return mask;
+}
+
+} // namespace
+
+bool PreprocessOptions::parse(const std::string& steps) {
+    std::stringstream list(steps);
+    std::string step;
+    while (std::getline(list, step, ',')) {
+        if (step == "gray" || step == "grayscale") {
+            grayscale = true;
+        } else if (step == "rescale") {
+            rescale = true;
+        } else if (step == "binarize") {
+            binarize = true;
+        } else if (step == "deskew") {
+            deskew = true;
+        } else if (step == "crop") {
+            crop = true;
+        } else if (step == "all") {
+            grayscale = rescale = binarize = deskew = crop = true;
+        } else if (step == "none") {
+            grayscale = rescale = binarize = deskew = crop = false;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string PreprocessOptions::signature() const {
+    std::ostringstream out;
+    if (enabled()) {
+        out << "pre:" << grayscale << rescale << binarize << deskew << crop
+            << ":" << target_dpi << ":" << assumed_dpi << ":" << max_skew_degrees;
+    }
+    if (reducedDecodeDpi() > 0) {
+        // A reduced decode changes the pixels Tesseract sees
+        out << "reduce:" << reducedDecodeDpi() << ":" << assumed_dpi;
+    }
+    return out.str();
+}
+
+Preprocessor::Preprocessor(const PreprocessOptions& options) : options_(options) {}
+
+cv::Mat Preprocessor::run(std::string_view imageData, int* dpi, int given_dpi, bool keep_geometry) const {
+    // Every step after decoding works on a single channel
+    bool gray = options_.grayscale || options_.binarize || options_.deskew || options_.crop;
+
+    const ImageDecoder* decoder = findDecoder(imageData);
+    if (!decoder) {
+        return cv::Mat();
+    }
+    *dpi = given_dpi > 0 ? given_dpi : sniffResolution(imageData);
+    if (*dpi <= 0) {
+        *dpi = options_.assumed_dpi;
+    }
+
+    cv::Mat image;
+    {
+        StageTimer timer(ServerMetrics::kDecode);
+        int reduction = keep_geometry ? 1 : decodeReduction(*decoder, *dpi, options_.reducedDecodeDpi());
+        image = decodeMat(*decoder, imageData, gray, reduction);
+        *dpi /= reduction;
+    }
+    if (image.empty()) {
+        return image;
+    }
+
+    if (options_.rescale && !keep_geometry) {
+        StageTimer timer(ServerMetrics::kRescale);
+        image = rescale(image, dpi);
+    }
+    if (options_.binarize) {
+        StageTimer timer(ServerMetrics::kBinarize);
+        image = binarize(image);
+    }
+    if (options_.deskew && !keep_geometry) {
+        StageTimer timer(ServerMetrics::kDeskew);
+        image = deskew(image);
+    }
+    if (options_.crop && !keep_geometry) {
+        StageTimer timer(ServerMetrics::kCrop);
+        image = crop(image);
+    }
+
+    if (image.channels() == 3) {
+        // Tesseract expects RGB byte order
+        cv::cvtColor(image, image, cv::COLOR_BGR2RGB);
+    }
+    return image;
+}
+
+cv::Mat Preprocessor::rescale(const cv::Mat& image, int* dpi) const {
+    if (*dpi <= 0 || options_.target_dpi <= 0) {
+        return image;
+    }
+    double scale = static_cast<double>(options_.target_dpi) / *dpi;
+    // Close enough; resampling would only cost time
+    if (std::abs(scale - 1.0) < 0.15) {
+        return image;
+    }
+    scale = std::clamp(scale, 0.25, 4.0);
+
+    cv::Mat scaled;
+    cv::resize(image, scaled, cv::Size(), scale, scale,
+               scale < 1.0 ? cv::INTER_AREA : cv::INTER_CUBIC);
+    *dpi = static_cast<int>(std::lround(*dpi * scale));
+    return scaled;
+}
+
+cv::Mat Preprocessor::binarize(const cv::Mat& image) const {
+    // Local thresholds cope with the uneven lighting of phone photos
+    cv::Mat binary;
+    cv::adaptiveThreshold(image, binary, 255, cv::ADAPTIVE_THRESH_GAUSSIAN_C,
+                          cv::THRESH_BINARY, 31, 15);
+    return binary;
+}
+
+cv::Mat Preprocessor::deskew(const cv::Mat& image) const {
+    // Search for the rotation that makes row ink profiles sharpest, on a
+    // downscaled mask so each candidate angle is cheap
+    cv::Mat mask = inkMask(image);
+    double scale = std::min(1.0, 600.0 / std::max(mask.cols, 1));
+    cv::Mat small;
+    cv::resize(mask, small, cv::Size(), scale, scale, cv::INTER_AREA);
+    cv::Point2f small_center(small.cols / 2.0f, small.rows / 2.0f);
+
+    auto sharpness = [&](double angle) {
+        cv::Mat rotated;
+        cv::Mat rotation = cv::getRotationMatrix2D(small_center, angle, 1.0);
+        cv::warpAffine(small, rotated, rotation, small.size(), cv::INTER_NEAREST,
+                       cv::BORDER_CONSTANT, cv::Scalar(0));
+        cv::Mat rows;
+        cv::reduce(rotated, rows, 1, cv::REDUCE_SUM, CV_64F);
+        double score = 0.0;
+        for (int i = 1; i < rows.rows; ++i) {
+            double delta = rows.at<double>(i, 0) - rows.at<double>(i - 1, 0);
+            score += delta * delta;
+        }
+        return score;
+    };
+
+    const double step = 0.5;
+    double best_angle = 0.0;
+    double best_score = sharpness(0.0);
+    for (double angle = -options_.max_skew_degrees; angle <= options_.max_skew_degrees; angle += step) {
+        if (std::abs(angle) < step / 2) {
+            continue;
+        }
+        double score = sharpness(angle);
+        if (score > best_score) {
+            best_score = score;
+            best_angle = angle;
+        }
+    }
+    if (best_angle == 0.0) {
+        return image;
+    }
+
+    cv::Point2f center(image.cols / 2.0f, image.rows / 2.0f);
+    cv::Mat rotation = cv::getRotationMatrix2D(center, best_angle, 1.0);
+    cv::Mat straightened;
+    cv::warpAffine(image, straightened, rotation, image.size(), cv::INTER_LINEAR,
+                   cv::BORDER_CONSTANT, cv::Scalar::all(255));
+    return straightened;
+}
+
+cv::Mat Preprocessor::crop(const cv::Mat& image) const {
+    // Drop isolated specks so they do not stretch the bounding box
+    cv::Mat mask = inkMask(image);
+    cv::morphologyEx(mask, mask, cv::MORPH_OPEN,
+                     cv::getStructuringElement(cv::MORPH_RECT, cv::Size(3, 3)));
+
+    std::vector<cv::Point> ink;
+    cv::findNonZero(mask, ink);
+    if (ink.empty()) {
+        return image;
+    }
+
+    const int margin = 10;
+    cv::Rect box = cv::boundingRect(ink);
+    box -= cv::Point(margin, margin);
+    box += cv::Size(2 * margin, 2 * margin);
+    box &= cv::Rect(0, 0, image.cols, image.rows);
+    // A view into the same pixels; SetImage takes the row stride
+    return image(box);
+}
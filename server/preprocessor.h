@@ -0,0 +1,60 @@
+#ifndef PREPROCESSOR_H
+#define PREPROCESSOR_H
+
+#include <string>
+#include <string_view>
+#include <opencv2/core.hpp>
+
+// Which OpenCV clean-up steps run before an image reaches Tesseract.
+// Steps run in the order listed.
+struct PreprocessOptions {
+    bool grayscale = false;   // Decode straight to 8-bit gray
+    bool rescale = false;     // Scale towards target_dpi
+    bool binarize = false;    // Adaptive (local) threshold
+    bool deskew = false;      // Straighten text lines, up to max_skew_degrees
+    bool crop = false;        // Trim empty borders
+    int target_dpi = 300;
+    int assumed_dpi = 0;      // Used when the file has no resolution; 0 skips rescaling
+    double max_skew_degrees = 5.0;
+    // Decode JPEGs of twice target_dpi or more at 1/2, 1/4 or 1/8 scale.
+    // Applies with or without the steps above.
+    bool reduced_decode = true;
+
+    // Parses a comma separated list such as "gray,binarize,deskew".
+    // Returns false on an unknown step name.
+    bool parse(const std::string& steps);
+
+    bool enabled() const { return grayscale || rescale || binarize || deskew || crop; }
+
+    // Lowest resolution a reduced decode may go down to; 0 if off
+    int reducedDecodeDpi() const { return reduced_decode ? target_dpi : 0; }
+
+    // Stable description of the settings, used in result cache keys
+    std::string signature() const;
+};
+
+// Stateless image clean-up stage; safe to share between workers.
+class Preprocessor {
+public:
+    explicit Preprocessor(const PreprocessOptions& options);
+
+    const PreprocessOptions& options() const { return options_; }
+
+    // Decodes `imageData` and applies the configured steps. Returns an
+    // 8-bit single-channel or 8-bit BGR image, empty if decoding failed.
+    // `dpi` receives the resolution of the returned image (0 if unknown).
+    // A positive `given_dpi` is used in place of the file's resolution.
+    // `keep_geometry` decodes at full scale and skips rescale, deskew and
+    // crop, so positions in the result are those of the source pixels.
+    cv::Mat run(std::string_view imageData, int* dpi, int given_dpi = 0, bool keep_geometry = false) const;
+
+private:
+    cv::Mat rescale(const cv::Mat& image, int* dpi) const;
+    cv::Mat binarize(const cv::Mat& image) const;
+    cv::Mat deskew(const cv::Mat& image) const;
+    cv::Mat crop(const cv::Mat& image) const;
+
+    PreprocessOptions options_;
+};
+
+#endif // PREPROCESSOR_H
@@ -0,0 +1,311 @@
+#include "result_cache.h"
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+namespace {
+
+// MurmurHash64A: 8 bytes per step, fast enough to hash multi-megabyte
+// scans in well under the time it takes to decode them.
+uint64_t murmurHash64(const void* key, size_t len, uint64_t seed) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    uint64_t h = seed ^ (len * m);
+
+    const unsigned char* data = static_cast<const unsigned char*>(key);
+    const unsigned char* end = data + (len / 8) * 8;
+    while (data != end) {
+        uint64_t k;
+        std::memcpy(&k, data, sizeof(k));
+        data += 8;
+
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+
+        h ^= k;
+        h *= m;
+    }
+
+    switch (len & 7) {
+    case 7: h ^= uint64_t(data[6]) << 48; [[fallthrough]];
+    case 6: h ^= uint64_t(data[5]) << 40; [[fallthrough]];
+    case 5: h ^= uint64_t(data[4]) << 32; [[fallthrough]];
+    case 4: h ^= uint64_t(data[3]) << 24; [[fallthrough]];
+    case 3: h ^= uint64_t(data[2]) << 16; [[fallthrough]];
+    case 2: h ^= uint64_t(data[1]) << 8; [[fallthrough]];
+    case 1: h ^= uint64_t(data[0]);
+            h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+// Cache file layout, little-endian with no padding: the magic and a
+// version, then records of hash (u64), image size (u64), text length (u32)
+// and the text itself
+constexpr char kFileMagic[4] = {'O', 'C', 'R', 'C'};
+constexpr uint32_t kFileVersion = 1;
+constexpr size_t kFileHeaderSize = 8;
+constexpr size_t kRecordHeaderSize = 20;
+// Far more than any page of text; a longer record is corrupt
+constexpr uint32_t kMaxRecordText = 16 * 1024 * 1024;
+
+void putLittleEndian(char* out, uint64_t value, size_t bytes) {
+    for (size_t i = 0; i < bytes; ++i) {
+        out[i] = static_cast<char>(value >> (8 * i));
+    }
+}
+
+uint64_t getLittleEndian(const char* in, size_t bytes) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; ++i) {
+        value |= uint64_t(static_cast<unsigned char>(in[i])) << (8 * i);
+    }
+    return value;
+}
+
+void writeFileHeader(std::ostream& out) {
+    char header[kFileHeaderSize];
+    std::memcpy(header, kFileMagic, sizeof(kFileMagic));
+    putLittleEndian(header + 4, kFileVersion, 4);
+    out.write(header, sizeof(header));
+}
+
+void writeRecord(std::ostream& out, const ResultCache::Key& key, const std::string& text) {
+    char header[kRecordHeaderSize];
+    putLittleEndian(header, key.hash, 8);
+    putLittleEndian(header + 8, key.size, 8);
+    putLittleEndian(header + 16, text.size(), 4);
+    out.write(header, sizeof(header));
+    out.write(text.data(), text.size());
+}
+
+} // namespace
+
+ResultCache::Key ResultCache::makeKey(std::string_view image_data, std::string_view params) {
+    uint64_t h = murmurHash64(image_data.data(), image_data.size(), 0x9e3779b97f4a7c15ULL);
+    h = murmurHash64(params.data(), params.size(), h);
+    return Key{h, image_data.size()};
+}
+
+ResultCache::ResultCache(size_t max_bytes, size_t num_shards, const std::string& persist_path)
+    : persist_path_(persist_path) {
+    if (num_shards == 0) {
+        num_shards = 1;
+    }
+    for (size_t i = 0; i < num_shards; ++i) {
+        shards_.push_back(std::make_unique<Shard>());
+    }
+    shard_capacity_ = max_bytes / num_shards;
+
+    if (!persist_path_.empty()) {
+        load();
+        std::error_code error;
+        bool fresh = !std::filesystem::exists(persist_path_, error) ||
+                     std::filesystem::file_size(persist_path_, error) == 0;
+        file_.open(persist_path_, std::ios::binary | std::ios::app);
+        if (!file_) {
+            std::cerr << "Could not open cache file " << persist_path_ << std::endl;
+        } else if (fresh) {
+            writeFileHeader(file_);
+            file_.flush();
+        }
+    }
+}
+
+ResultCache::Shard& ResultCache::shardFor(const Key& key) {
+    // The low bits pick the bucket inside the shard; use the high ones here
+    return *shards_[(key.hash >> 48) % shards_.size()];
+}
+
+ResultCache::Lookup ResultCache::begin(const Key& key, std::string* text, Waiter waiter) {
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        *text = it->second->text;
+        hits_.fetch_add(1, std::memory_order_relaxed);
+        return Lookup::kHit;
+    }
+
+    auto pending = shard.in_flight.find(key);
+    if (pending != shard.in_flight.end()) {
+        pending->second.push_back(std::move(waiter));
+        joins_.fetch_add(1, std::memory_order_relaxed);
+        return Lookup::kJoined;
+    }
+
+    shard.in_flight.emplace(key, std::vector<Waiter>());
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return Lookup::kLeader;
+}
+
+void ResultCache::finish(const Key& key, const OCRResult& result) {
+    std::vector<Waiter> waiters;
+    {
+        Shard& shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto pending = shard.in_flight.find(key);
+        if (pending != shard.in_flight.end()) {
+            waiters.swap(pending->second);
+            shard.in_flight.erase(pending);
+        }
+        if (result.ok()) {
+            insertLocked(shard, key, result.text);
+        }
+    }
+
+    if (result.ok()) {
+        append(key, result.text);
+    }
+    for (Waiter& waiter : waiters) {
+        waiter(result);
+    }
+}
+
+bool ResultCache::abandon(const Key& key) {
+    // One locked step, so nobody can join between the check and the drop
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto pending = shard.in_flight.find(key);
+    if (pending == shard.in_flight.end()) {
+        return true;
+    }
+    if (!pending->second.empty()) {
+        return false;
+    }
+    shard.in_flight.erase(pending);
+    return true;
+}
+
+void ResultCache::insertLocked(Shard& shard, const Key& key, const std::string& text) {
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+        shard.bytes -= it->second->text.size();
+        it->second->text = text;
+        shard.bytes += text.size();
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    } else {
+        shard.lru.push_front(Entry{key, text});
+        shard.index.emplace(key, shard.lru.begin());
+        shard.bytes += text.size() + sizeof(Entry);
+    }
+
+    while (shard.bytes > shard_capacity_ && shard.lru.size() > 1) {
+        Entry& victim = shard.lru.back();
+        shard.bytes -= victim.text.size() + sizeof(Entry);
+        shard.index.erase(victim.key);
+        shard.lru.pop_back();
+        evictions_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+ResultCache::Stats ResultCache::stats() const {
+    Stats stats{};
+    stats.hits = hits_.load(std::memory_order_relaxed);
+    stats.misses = misses_.load(std::memory_order_relaxed);
+    stats.joins = joins_.load(std::memory_order_relaxed);
+    stats.evictions = evictions_.load(std::memory_order_relaxed);
+    for (const auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        stats.entries += shard->lru.size();
+        stats.bytes += shard->bytes;
+    }
+    return stats;
+}
+
+void ResultCache::load() {
+    std::error_code error;
+    uint64_t file_size = std::filesystem::file_size(persist_path_, error);
+    std::ifstream in(persist_path_, std::ios::binary);
+    if (error || !in) {
+        return;
+    }
+
+    // Replay up to the first record that cannot be read: a torn write at
+    // the end, or corruption. A file from another version is not read.
+    size_t records = 0;
+    uint64_t good = 0;
+    char header[kRecordHeaderSize];
+    if (in.read(header, kFileHeaderSize) && std::memcmp(header, kFileMagic, sizeof(kFileMagic)) == 0 &&
+        getLittleEndian(header + 4, 4) == kFileVersion) {
+        good = kFileHeaderSize;
+    }
+    std::string text;
+    while (good > 0 && in.read(header, kRecordHeaderSize)) {
+        uint64_t text_len = getLittleEndian(header + 16, 4);
+        if (text_len > kMaxRecordText || text_len > file_size - good - kRecordHeaderSize) {
+            break;
+        }
+        text.resize(text_len);
+        if (!in.read(&text[0], text_len)) {
+            break;
+        }
+        Key key{getLittleEndian(header, 8), getLittleEndian(header + 8, 8)};
+        Shard& shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        insertLocked(shard, key, text);
+        good += kRecordHeaderSize + text_len;
+        ++records;
+    }
+    in.close();
+
+    // Cut off the unreadable part so new records are not appended after it
+    if (good < file_size) {
+        std::cerr << "Discarding " << file_size - good << " unreadable bytes of cache file "
+                  << persist_path_ << std::endl;
+        std::filesystem::resize_file(persist_path_, good, error);
+        if (error) {
+            std::cerr << "Could not truncate cache file " << persist_path_ << ": " << error.message()
+                      << std::endl;
+        }
+    }
+
+    // Compact once the log holds mostly overwritten or evicted records
+    size_t entries = 0;
+    for (const auto& shard : shards_) {
+        entries += shard->lru.size();
+    }
+    std::cout << "Loaded " << entries << " cached results from " << persist_path_ << std::endl;
+    if (records > 2 * entries) {
+        std::string tmp_path = persist_path_ + ".tmp";
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        writeFileHeader(out);
+        for (const auto& shard : shards_) {
+            // Oldest first so replay restores the same LRU order
+            for (auto it = shard->lru.rbegin(); it != shard->lru.rend(); ++it) {
+                writeRecord(out, it->key, it->text);
+            }
+        }
+        out.close();
+        if (out && std::rename(tmp_path.c_str(), persist_path_.c_str()) == 0) {
+            std::cout << "Compacted cache file from " << records << " to " << entries << " records" << std::endl;
+        }
+    }
+
+    hits_ = 0;
+    misses_ = 0;
+    evictions_ = 0;
+}
+
+void ResultCache::append(const Key& key, const std::string& text) {
+    if (persist_path_.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(file_mutex_);
+    if (!file_) {
+        return;
+    }
+    if (text.size() > kMaxRecordText) {
+        return;  // Would be rejected on load
+    }
+    writeRecord(file_, key, text);
+    file_.flush();
+}
@@ -0,0 +1,114 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "ocr_result.h"
+
+// Content-addressed cache of OCR results, keyed by a hash of the image bytes
+// and the OCR parameters. Entries live in independently locked shards with
+// per-shard LRU eviction by size, and can optionally be appended to a local
+// file that is replayed on startup.
+//
+// Identical requests that arrive while the first is still being processed
+// join it: begin() registers them as waiters and finish() answers everyone.
+class ResultCache {
+public:
+    struct Key {
+        uint64_t hash;  // Image bytes and parameters
+        uint64_t size;  // Image size, as a cheap collision guard
+        bool operator==(const Key& other) const {
+            return hash == other.hash && size == other.size;
+        }
+    };
+
+    enum class Lookup {
+        kHit,     // Text returned immediately
+        kJoined,  // Same content in flight; waiter will be called
+        kLeader,  // Caller must run OCR and then call finish()
+    };
+
+    using Waiter = std::function<void(const OCRResult& result)>;
+
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t joins;
+        uint64_t evictions;
+        uint64_t entries;
+        uint64_t bytes;
+    };
+
+    static Key makeKey(std::string_view image_data, std::string_view params);
+
+    // `max_bytes` bounds the cached text across all shards. An empty
+    // `persist_path` keeps the cache in memory only.
+    ResultCache(size_t max_bytes, size_t num_shards = 16, const std::string& persist_path = "");
+
+    ResultCache(const ResultCache&) = delete;
+    ResultCache& operator=(const ResultCache&) = delete;
+
+    Lookup begin(const Key& key, std::string* text, Waiter waiter);
+
+    // Completes an in-flight key: every joined waiter receives `result`, and
+    // its text is stored if it succeeded.
+    void finish(const Key& key, const OCRResult& result);
+
+    // For a leader whose caller has gone: drops the in-flight `key` and
+    // returns true if nobody has joined it, so the next identical request
+    // starts afresh. Returns false, leaving it in flight, if others are
+    // waiting; the leader must then finish it for them. Once this returns
+    // true the leader must not call finish(), and must not call abandon()
+    // again: the key may already belong to a newer leader.
+    bool abandon(const Key& key);
+
+    Stats stats() const;
+
+private:
+    struct KeyHash {
+        size_t operator()(const Key& key) const { return static_cast<size_t>(key.hash); }
+    };
+
+    struct Entry {
+        Key key;
+        std::string text;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::list<Entry> lru;  // Most recently used first
+        std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+        std::unordered_map<Key, std::vector<Waiter>, KeyHash> in_flight;
+        size_t bytes = 0;
+    };
+
+    Shard& shardFor(const Key& key);
+    // Requires shard.mutex
+    void insertLocked(Shard& shard, const Key& key, const std::string& text);
+    void load();
+    void append(const Key& key, const std::string& text);
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    size_t shard_capacity_;
+
+    std::string persist_path_;
+    std::mutex file_mutex_;
+    std::ofstream file_;
+
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> joins_{0};
+    std::atomic<uint64_t> evictions_{0};
+};
+
+#endif // RESULT_CACHE_H
@@ -0,0 +1,90 @@
+#include "scheduling.h"
+#include <algorithm>
+#include <functional>
+#include <string>
+
+#include "ocr_dispatcher.h"
+
+Lane laneFor(ocr::Priority priority) {
+    switch (priority) {
+    case ocr::PRIORITY_INTERACTIVE:
+        return kLaneInteractive;
+    case ocr::PRIORITY_BULK:
+        return kLaneBulk;
+    default:
+        return kLaneNormal;
+    }
+}
+
+const char* laneName(Lane lane) {
+    switch (lane) {
+    case kLaneInteractive: return "interactive";
+    case kLaneNormal:      return "normal";
+    case kLaneBulk:        return "bulk";
+    default:               return "unknown";
+    }
+}
+
+std::vector<unsigned> laneWeights() {
+    return {16, 4, 1};
+}
+
+std::string clientName(const grpc::ServerContext& context) {
+    const auto& metadata = context.client_metadata();
+    auto id = metadata.find("x-client-id");
+    if (id != metadata.end()) {
+        return "id:" + std::string(id->second.data(), id->second.size());
+    }
+
+    // "ipv4:10.0.0.5:51234" or "ipv6:[::1]:51234"; other transports as is
+    std::string peer = context.peer();
+    if (peer.rfind("ipv4:", 0) == 0 || peer.rfind("ipv6:", 0) == 0) {
+        size_t port = peer.rfind(':');
+        if (port != std::string::npos && port > 5) {
+            peer.resize(port);
+        }
+    }
+    return peer;
+}
+
+uint64_t clientKey(const grpc::ServerContext& context) {
+    return std::hash<std::string>()(clientName(context));
+}
+
+std::chrono::steady_clock::time_point requestDeadline(const ocr::ImageRequest& request,
+                                                      const grpc::ServerContext& context,
+                                                      std::chrono::steady_clock::time_point received_at) {
+    return requestDeadline(request.deadline_ms(), context, received_at);
+}
+
+std::chrono::steady_clock::time_point requestDeadline(uint32_t deadline_ms,
+                                                      const grpc::ServerContext& context,
+                                                      std::chrono::steady_clock::time_point received_at) {
+    auto deadline = std::chrono::steady_clock::time_point::max();
+    if (deadline_ms > 0) {
+        deadline = received_at + std::chrono::milliseconds(deadline_ms);
+    }
+
+    // gRPC reports the call deadline on the system clock
+    auto call_deadline = context.deadline();
+    if (call_deadline != std::chrono::system_clock::time_point::max()) {
+        auto remaining = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            call_deadline - std::chrono::system_clock::now());
+        deadline = std::min(deadline, std::chrono::steady_clock::now() + remaining);
+    }
+    return deadline;
+}
+
+void applySchedule(ProcessingTask& task, const ocr::ImageRequest& request,
+                   const grpc::ServerContext& context) {
+    task.lane = laneFor(request.priority());
+    task.client = clientKey(context);
+    task.deadline = requestDeadline(request, context, task.received_at);
+}
+
+void applySchedule(ProcessingTask& task, const ocr::UploadHeader& header,
+                   const grpc::ServerContext& context) {
+    task.lane = laneFor(header.priority());
+    task.client = clientKey(context);
+    task.deadline = requestDeadline(header.deadline_ms(), context, task.received_at);
+}
@@ -0,0 +1,52 @@
+#ifndef SCHEDULING_H
+#define SCHEDULING_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <grpcpp/server_context.h>
+
+#include "ocr.pb.h"
+
+struct ProcessingTask;
+
+// Scheduling lanes, most urgent first. Each ImageRequest priority maps to
+// one lane.
+enum Lane {
+    kLaneInteractive,
+    kLaneNormal,
+    kLaneBulk,
+    kLaneCount
+};
+
+Lane laneFor(ocr::Priority priority);
+const char* laneName(Lane lane);
+
+// Share of worker time per lane while every lane has work queued
+std::vector<unsigned> laneWeights();
+
+// Requests from one client share that client's slice of a lane. A client
+// is the `x-client-id` metadata value when the caller sends one, otherwise
+// the caller's host (the peer address without its port).
+uint64_t clientKey(const grpc::ServerContext& context);
+// The string clientKey() hashes; a coordinator forwards it as the
+// `x-client-id` of the calls it makes on the client's behalf
+std::string clientName(const grpc::ServerContext& context);
+
+// The earlier of the call's gRPC deadline and the request's own
+// deadline_ms, counted from `received_at`. time_point::max() for neither.
+std::chrono::steady_clock::time_point requestDeadline(const ocr::ImageRequest& request,
+                                                      const grpc::ServerContext& context,
+                                                      std::chrono::steady_clock::time_point received_at);
+std::chrono::steady_clock::time_point requestDeadline(uint32_t deadline_ms,
+                                                      const grpc::ServerContext& context,
+                                                      std::chrono::steady_clock::time_point received_at);
+
+// Fills in `task`'s lane, client and deadline from its request and call
+void applySchedule(ProcessingTask& task, const ocr::ImageRequest& request,
+                   const grpc::ServerContext& context);
+void applySchedule(ProcessingTask& task, const ocr::UploadHeader& header,
+                   const grpc::ServerContext& context);
+
+#endif // SCHEDULING_H
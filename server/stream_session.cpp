@@ -0,0 +1,68 @@
+#include "stream_session.h"
+
+StreamSession::StreamSession(size_t window)
+    : window_(window > 0 ? window : 1), in_flight_(0) {}
+
+void StreamSession::acquireSlot() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    slot_cv_.wait(lock, [this] { return in_flight_ < window_; });
+    ++in_flight_;
+}
+
+void StreamSession::releaseSlot() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --in_flight_;
+    }
+    slot_cv_.notify_all();
+}
+
+void StreamSession::complete(ocr::ImageResponse response) {
+    responses_.push(std::move(response));
+}
+
+bool StreamSession::nextResponse(ocr::ImageResponse& out) {
+    return responses_.pop(out);
+}
+
+bool StreamSession::nextResponses(ocr::BatchResponse& out, size_t max) {
+    out.Clear();
+    ocr::ImageResponse response;
+    if (!responses_.pop(response)) {
+        return false;
+    }
+    *out.add_results() = std::move(response);
+    while (static_cast<size_t>(out.results_size()) < max && responses_.try_pop(response)) {
+        *out.add_results() = std::move(response);
+    }
+    return true;
+}
+
+void StreamSession::responseWritten(const ocr::ImageResponse& response) {
+    if (!response.partial()) {
+        releaseSlot();
+    }
+}
+
+void StreamSession::responseWritten(const ocr::BatchResponse& response) {
+    size_t answered = 0;
+    for (const ocr::ImageResponse& result : response.results()) {
+        answered += result.partial() ? 0 : 1;
+    }
+    if (answered == 0) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        in_flight_ -= answered;
+    }
+    slot_cv_.notify_all();
+}
+
+void StreamSession::close() {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        slot_cv_.wait(lock, [this] { return in_flight_ == 0; });
+    }
+    responses_.set_finished();
+}
@@ -0,0 +1,60 @@
+#ifndef STREAM_SESSION_H
+#define STREAM_SESSION_H
+
+#include <condition_variable>
+#include <mutex>
+
+#include "ocr.pb.h"
+#include "ThreadSafeQueue.hpp"
+
+// Images one ProcessImageStream call may have in flight at once.
+constexpr size_t kDefaultStreamWindow = 32;
+
+// Per-call state for one ProcessImageStream RPC. The handler and every task
+// queued on behalf of the stream hold a shared_ptr to it, so workers never
+// touch a stream that has already returned.
+//
+// At most `window` images may be in flight (queued, being OCRed or waiting
+// to be written). Workers hand finished responses to complete(), which never
+// blocks; a dedicated writer drains them with nextResponse() and frees the
+// slot once the response has been written.
+class StreamSession {
+public:
+    explicit StreamSession(size_t window);
+
+    StreamSession(const StreamSession&) = delete;
+    StreamSession& operator=(const StreamSession&) = delete;
+
+    // Reader side: blocks while the window is full.
+    void acquireSlot();
+    // Frees a slot for an image that will not produce a response.
+    void releaseSlot();
+
+    // Worker side: queue a response for the writer.
+    void complete(ocr::ImageResponse response);
+
+    // Writer side: returns false once close() has been called and every
+    // in-flight image has been answered.
+    bool nextResponse(ocr::ImageResponse& out);
+    // Batching writer side: waits for one response like nextResponse(),
+    // then adds whatever else is already finished, up to `max` in all.
+    bool nextResponses(ocr::BatchResponse& out, size_t max);
+    // Called by the writer after responses have been written (or dropped).
+    // Partial responses (single pages of a document) hold no slot of their
+    // own; the image's slot is freed with its final response.
+    void responseWritten(const ocr::ImageResponse& response);
+    void responseWritten(const ocr::BatchResponse& response);
+
+    // No more requests will be admitted. Blocks until every in-flight image
+    // has been written, then lets the writer exit.
+    void close();
+
+private:
+    size_t window_;
+    size_t in_flight_;
+    std::mutex mutex_;
+    std::condition_variable slot_cv_;
+    ThreadSafeQueue<ocr::ImageResponse> responses_;
+};
+
+#endif // STREAM_SESSION_H
@@ -0,0 +1,158 @@
+#include "upload_spool.h"
+
+#include "scheduling.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace {
+
+// Maps the whole of `file` read-only. The returned owner unmaps it and
+// closes the file, which deletes a tmpfile().
+std::shared_ptr<const void> mapFile(std::FILE* file, size_t size, const char** data) {
+#ifdef _WIN32
+    HANDLE handle = reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(file)));
+    HANDLE mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!view) {
+        if (mapping) {
+            CloseHandle(mapping);
+        }
+        return nullptr;
+    }
+    *data = static_cast<const char*>(view);
+    return std::shared_ptr<const void>(view, [mapping, file](const void* view) {
+        UnmapViewOfFile(view);
+        CloseHandle(mapping);
+        std::fclose(file);
+    });
+#else
+    void* view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    if (view == MAP_FAILED) {
+        return nullptr;
+    }
+    *data = static_cast<const char*>(view);
+    return std::shared_ptr<const void>(view, [size, file](const void* view) {
+        munmap(const_cast<void*>(view), size);
+        std::fclose(file);
+    });
+#endif
+}
+
+} // namespace
+
+UploadSpool::UploadSpool(const UploadLimits& limits) : limits_(limits) {}
+
+UploadSpool::~UploadSpool() {
+    if (file_) {
+        std::fclose(file_);
+    }
+}
+
+bool UploadSpool::add(ocr::UploadChunk& chunk, std::string& error) {
+    if (ended_) {
+        error = "Upload data after the end marker";
+        return false;
+    }
+
+    switch (chunk.part_case()) {
+    case ocr::UploadChunk::kHeader:
+        if (started_) {
+            error = "Upload has more than one header";
+            return false;
+        }
+        started_ = true;
+        header_ = std::move(*chunk.mutable_header());
+        if (header_.total_size() > limits_.max_bytes) {
+            error = "Upload of " + std::to_string(header_.total_size()) +
+                    " bytes exceeds the limit of " + std::to_string(limits_.max_bytes);
+            return false;
+        }
+        if (header_.total_size() <= limits_.memory_bytes) {
+            buffer_.reserve(header_.total_size());
+        }
+        return true;
+    case ocr::UploadChunk::kData:
+        if (!started_) {
+            error = "Upload data before the header";
+            return false;
+        }
+        return write(chunk.data(), error);
+    case ocr::UploadChunk::kEnd:
+        if (!started_) {
+            error = "Upload ended before the header";
+            return false;
+        }
+        if (chunk.end().total_size() != size_) {
+            error = "Upload ended after " + std::to_string(size_) + " bytes, expected " +
+                    std::to_string(chunk.end().total_size());
+            return false;
+        }
+        ended_ = true;
+        return true;
+    default:
+        error = "Empty upload message";
+        return false;
+    }
+}
+
+bool UploadSpool::write(const std::string& bytes, std::string& error) {
+    if (size_ + bytes.size() > limits_.max_bytes) {
+        error = "Upload exceeds the limit of " + std::to_string(limits_.max_bytes) + " bytes";
+        return false;
+    }
+
+    // Move to a file once memory would overflow, carrying over what was held
+    if (!file_ && buffer_.size() + bytes.size() > limits_.memory_bytes) {
+        file_ = std::tmpfile();
+        if (!file_ || std::fwrite(buffer_.data(), 1, buffer_.size(), file_) != buffer_.size()) {
+            error = "Could not spool upload to a temporary file";
+            return false;
+        }
+        std::string().swap(buffer_);
+    }
+
+    if (file_) {
+        if (std::fwrite(bytes.data(), 1, bytes.size(), file_) != bytes.size()) {
+            error = "Could not spool upload to a temporary file";
+            return false;
+        }
+    } else {
+        buffer_.append(bytes);
+    }
+    size_ += bytes.size();
+    return true;
+}
+
+ImagePayload UploadSpool::take(std::string& error) {
+    if (!file_) {
+        return ImagePayload(std::move(buffer_));
+    }
+
+    const char* data = nullptr;
+    std::shared_ptr<const void> owner;
+    if (std::fflush(file_) == 0) {
+        owner = mapFile(file_, size_, &data);
+    }
+    if (!owner) {
+        error = "Could not map spooled upload";
+        return ImagePayload();
+    }
+    file_ = nullptr;  // Closed by the mapping's owner
+    return ImagePayload(std::move(owner), std::string_view(data, size_));
+}
+
+ProcessingTask uploadTask(UploadSpool& spool, const grpc::ServerContext& context, std::string& error) {
+    ProcessingTask task;
+    applySchedule(task, spool.header(), context);
+    task.image_id = spool.header().image_id();
+    task.image_format = spool.header().image_format();
+    task.output = spool.header().output();
+    task.config = spool.header().config();
+    task.image_data = spool.take(error);
+    return task;
+}
@@ -0,0 +1,61 @@
+#ifndef UPLOAD_SPOOL_H
+#define UPLOAD_SPOOL_H
+
+#include <cstdio>
+#include <string>
+#include <grpcpp/server_context.h>
+
+#include "ocr.pb.h"
+#include "image_payload.h"
+#include "ocr_dispatcher.h"
+
+struct UploadLimits {
+    size_t memory_bytes = 8 * 1024 * 1024;   // Kept in memory up to this; spooled to a file beyond
+    size_t max_bytes = 512 * 1024 * 1024;    // Larger uploads are rejected
+};
+
+// Collects one ProcessImageUpload call: checks the header/data/end order
+// and gathers the data chunks. Small uploads stay in one string; once an
+// upload passes `memory_bytes` it moves to an anonymous temporary file,
+// which is mapped for the worker when the upload ends, so a large scan
+// costs page cache rather than heap however big it is.
+class UploadSpool {
+public:
+    explicit UploadSpool(const UploadLimits& limits);
+    ~UploadSpool();
+
+    UploadSpool(const UploadSpool&) = delete;
+    UploadSpool& operator=(const UploadSpool&) = delete;
+
+    // Takes the next message of the upload. False, with `error` set, if it
+    // is out of order, too large or cannot be spooled; the upload should
+    // then be abandoned.
+    bool add(ocr::UploadChunk& chunk, std::string& error);
+
+    // True once the end marker has arrived
+    bool complete() const { return ended_; }
+    size_t size() const { return size_; }
+    const ocr::UploadHeader& header() const { return header_; }
+
+    // The uploaded bytes, once complete(). Empty, with `error` set, if a
+    // spooled file cannot be mapped.
+    ImagePayload take(std::string& error);
+
+private:
+    bool write(const std::string& bytes, std::string& error);
+
+    UploadLimits limits_;
+    ocr::UploadHeader header_;
+    bool started_ = false;
+    bool ended_ = false;
+    std::string buffer_;          // Data while it fits in memory
+    std::FILE* file_ = nullptr;   // Spool once it does not; deleted when closed
+    size_t size_ = 0;
+};
+
+// Task for a complete upload, taking its bytes from `spool`. Scheduled
+// from now, so a deadline does not count the time spent uploading.
+// `error` is set if the bytes cannot be taken.
+ProcessingTask uploadTask(UploadSpool& spool, const grpc::ServerContext& context, std::string& error);
+
+#endif // UPLOAD_SPOOL_H